@@ -0,0 +1,366 @@
+#include "sphero/v2/FrameDecoder.h"
+#include "sphero/v2/Packets.h"
+#include "sphero/Uuids.h"
+#include "capture/Format.h"
+#include "Logging.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QtEndian>
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+/// Microbenchmarks for the protocol code, without a robot or an event loop.
+/// Run it with a capture from $ROBOT_CAPTURE_DIR of a V2 robot, or without
+/// one to use generated frames.
+
+// Fixed, so runs are comparable
+static constexpr unsigned seed = 1234;
+
+static void report(const char *name, const int64_t nanoseconds, const uint64_t items, const char *unit, const uint64_t bytes = 0)
+{
+    const double seconds = nanoseconds / 1e9;
+    QString line = QString::asprintf("  %-36s %8.1f ms %12.0f %s/s", name, nanoseconds / 1e6, items / seconds, unit);
+    if (bytes) {
+        line += QString::asprintf(" %8.1f MB/s", bytes / seconds / 1e6);
+    }
+    qInfo().noquote() << line;
+}
+
+/// The notifications from a V2 robot in a capture, back to back
+static bool readCapture(const QString &path, QByteArray *stream, std::vector<int> *notificationSizes)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed to open capture" << path << file.errorString();
+        return false;
+    }
+    const QByteArray contents = file.readAll();
+    if (contents.size() < int(sizeof(capture::FileHeader))) {
+        qWarning() << "Capture too small" << path;
+        return false;
+    }
+
+    capture::FileHeader header;
+    memcpy(&header, contents.constData(), sizeof header);
+    if (memcmp(header.magic, capture::fileMagic, sizeof header.magic) != 0 || qFromLittleEndian(header.version) != capture::fileVersion) {
+        qWarning() << "Not a supported capture file" << path;
+        return false;
+    }
+
+    const uint64_t end = qMin(qFromLittleEndian(header.end), uint64_t(contents.size()));
+    int v2Characteristic = -1;
+
+    capture::Record record;
+    for (uint64_t offset = qFromLittleEndian(header.headerSize); offset + sizeof record <= end; offset += sizeof record + record.size) {
+        memcpy(&record, contents.constData() + offset, sizeof record);
+        record.size = qFromLittleEndian(record.size);
+        if (offset + sizeof record + record.size > end) {
+            break;
+        }
+        const char *data = contents.constData() + offset + sizeof record;
+
+        if (record.type == capture::DefineCharacteristic) {
+            const QBluetoothUuid uuid(QUuid::fromRfc4122(QByteArray(data, record.size)));
+            if (uuid == sphero::Characteristics::Main::V2::commands) {
+                v2Characteristic = record.characteristic;
+            }
+        } else if (record.type == capture::Notification && record.characteristic == v2Characteristic) {
+            stream->append(data, record.size);
+            notificationSizes->push_back(record.size);
+        }
+    }
+
+    if (stream->isEmpty()) {
+        qWarning() << "No V2 notifications in" << path;
+        return false;
+    }
+    return true;
+}
+
+/// Frames with random payloads the size of typical sensor and response packets
+static void generateFrames(const int count, QByteArray *stream, std::vector<int> *notificationSizes)
+{
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> sizes(sizeof(sphero::v2::Packet), 40);
+    std::uniform_int_distribution<int> bytes(0, 255);
+
+    char raw[40];
+    char encoded[2 * (sizeof raw + 1) + 2];
+    for (int i=0; i<count; i++) {
+        const int size = sizes(random);
+        for (int j=0; j<size; j++) {
+            raw[j] = char(bytes(random));
+        }
+        const int encodedSize = sphero::v2::encode(raw, size, encoded);
+        stream->append(encoded, encodedSize);
+        notificationSizes->push_back(encodedSize);
+    }
+}
+
+/// Feeds the stream in chunks of the given sizes (repeated if needed),
+/// returns the number of frames decoded
+static uint64_t decode(const QByteArray &stream, const std::vector<int> &chunkSizes, int64_t *nanoseconds)
+{
+    sphero::v2::FrameDecoder decoder;
+    uint64_t frames = 0;
+
+    QElapsedTimer timer;
+    timer.start();
+    int offset = 0;
+    for (size_t i=0; offset < stream.size(); i = (i + 1) % chunkSizes.size()) {
+        const int size = qMin(chunkSizes[i], stream.size() - offset);
+        decoder.feed(stream.constData() + offset, size, [&frames](const sphero::v2::FrameDecoder::Frame &) {
+            frames++;
+        });
+        offset += size;
+    }
+    *nanoseconds = timer.nsecsElapsed();
+
+    if (decoder.stats().checksumErrors || decoder.stats().escapeErrors) {
+        qWarning() << " ! Decode errors, checksum:" << decoder.stats().checksumErrors << "escape:" << decoder.stats().escapeErrors;
+    }
+    return frames;
+}
+
+/// Replays the same bytes as they were received, and split at random points
+/// (down to single bytes), which should give the same frames.
+static void benchmarkDecode(const QByteArray &stream, const std::vector<int> &notificationSizes, const int iterations)
+{
+    qInfo() << "Decoding" << stream.size() << "bytes in" << notificationSizes.size() << "notifications," << iterations << "times:";
+
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> randomSize(1, 64);
+    std::vector<int> randomSizes(4096);
+    for (int &size : randomSizes) {
+        size = randomSize(random);
+    }
+
+    const struct {
+        const char *name;
+        std::vector<int> chunkSizes;
+    } splits[] = {
+        { "as received", notificationSizes },
+        { "random splits", randomSizes },
+        { "single bytes", { 1 } },
+    };
+
+    uint64_t expectedFrames = 0;
+    for (const auto &split : splits) {
+        int64_t total = 0;
+        uint64_t frames = 0;
+        for (int i=0; i<iterations; i++) {
+            int64_t nanoseconds = 0;
+            frames = decode(stream, split.chunkSizes, &nanoseconds);
+            total += nanoseconds;
+        }
+        if (!expectedFrames) {
+            expectedFrames = frames;
+        } else if (frames != expectedFrames) {
+            qWarning() << " ! Got" << frames << "frames with" << split.name << "instead of" << expectedFrames;
+        }
+        report(split.name, total, frames * uint64_t(iterations), "frames", uint64_t(stream.size()) * uint64_t(iterations));
+    }
+}
+
+/// How v2::encode() used to do it, checksum in one pass and escaping into a
+/// growing QByteArray in another
+template <typename PACKET>
+static QByteArray encodeTwoPass(const PACKET &packet)
+{
+    using namespace sphero::v2;
+
+    QByteArray raw(reinterpret_cast<const char*>(&packet), sizeof(PACKET));
+    uint8_t checksum = 0;
+    for (const char c : raw) {
+        checksum += c;
+    }
+    raw.append(checksum xor 0xFF);
+
+    QByteArray encoded(1, StartOfPacket);
+    for (const char c : raw) {
+        switch(c) {
+        case Escape:
+            encoded.append(Escape);
+            encoded.append(EscapedEscape);
+            break;
+        case StartOfPacket:
+            encoded.append(Escape);
+            encoded.append(EscapedStartOfPacket);
+            break;
+        case EndOfPacket:
+            encoded.append(Escape);
+            encoded.append(EscapedEndOfPacket);
+            break;
+        default:
+            encoded.append(c);
+            break;
+        }
+    }
+    encoded.append(EndOfPacket);
+
+    return encoded;
+}
+
+template <typename PACKET, typename ENCODER>
+static void benchmarkEncoder(const char *name, const std::vector<PACKET> &packets, const int iterations, ENCODER &&encoder)
+{
+    uint64_t bytes = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i=0; i<iterations; i++) {
+        for (const PACKET &packet : packets) {
+            bytes += uint64_t(encoder(packet));
+        }
+    }
+    report(name, timer.nsecsElapsed(), uint64_t(packets.size()) * uint64_t(iterations), "frames", bytes);
+}
+
+/// The old and the single pass encoder on what we send the most, setpoints
+/// for every heading (some of which need escaping)
+static void benchmarkEncode(const int iterations)
+{
+    using sphero::v2::DrivePacket;
+
+    std::vector<DrivePacket> packets;
+    for (int heading=0; heading<360; heading++) {
+        packets.emplace_back(uint8_t(heading % 256), uint16_t(heading));
+    }
+
+    for (const DrivePacket &packet : packets) {
+        if (encodeTwoPass(packet) != sphero::v2::encode(packet)) {
+            qWarning() << " ! Encoders disagree for heading" << qFromBigEndian(packet.m_heading);
+        }
+    }
+
+    qInfo() << "Encoding" << packets.size() << "drive packets," << iterations << "times:";
+
+    benchmarkEncoder("two passes into QByteArray", packets, iterations, [](const DrivePacket &packet) {
+        return encodeTwoPass(packet).size();
+    });
+    benchmarkEncoder("single pass into QByteArray", packets, iterations, [](const DrivePacket &packet) {
+        return sphero::v2::encode(packet).size();
+    });
+    benchmarkEncoder("single pass into fixed buffer", packets, iterations, [](const DrivePacket &packet) {
+        char buffer[sphero::v2::maxEncodedSize<DrivePacket>()];
+        return sphero::v2::encode(packet, buffer);
+    });
+}
+
+static void discardMessage(QtMsgType, const QMessageLogContext &, const QString &)
+{
+}
+
+/// What sending a setpoint and receiving notifications cost with the per
+/// packet logging we used to have (unconditional qDebug(), with toHex()),
+/// and with TRACE() on the disabled sphero.tx/sphero.rx categories.
+/// The old logging is timed with a message handler that throws the output
+/// away, so writing it to the terminal isn't even included.
+static void benchmarkLogging(const QByteArray &stream, const std::vector<int> &notificationSizes, const int iterations)
+{
+    using sphero::v2::DrivePacket;
+    using sphero::v2::FrameDecoder;
+
+    if (lcSpheroTx().isDebugEnabled() || lcSpheroRx().isDebugEnabled()) {
+        qWarning() << " ! Tracing is enabled, the numbers are not for the normal case";
+    }
+
+    qInfo() << "Sending 360 drive packets and receiving" << notificationSizes.size() << "notifications," << iterations << "times:";
+
+    QtMessageHandler previousHandler = qInstallMessageHandler(discardMessage);
+
+    // Before
+    int64_t sendBefore = 0, receiveBefore = 0;
+    uint64_t frames = 0;
+    QElapsedTimer timer;
+    for (int i=0; i<iterations; i++) {
+        timer.start();
+        for (int heading=0; heading<360; heading++) {
+            const QByteArray frame = sphero::v2::encode(DrivePacket(uint8_t(heading % 256), uint16_t(heading)));
+            qDebug() << " >>>>>>>>>>> sending command <<<<<<<<<<";
+            qDebug() << " - Writing command" << frame.toHex(':');
+        }
+        sendBefore += timer.nsecsElapsed();
+
+        timer.start();
+        FrameDecoder decoder;
+        int offset = 0;
+        for (const int size : notificationSizes) {
+            qDebug() << "main characteristic changed" << stream.mid(offset, size).toHex(':');
+            decoder.feed(stream.constData() + offset, size, [&frames](const FrameDecoder::Frame &frame) {
+                frames++;
+                qDebug() << " - data notification" << frame.data[0] << frame.size;
+            });
+            offset += size;
+        }
+        receiveBefore += timer.nsecsElapsed();
+    }
+
+    // After
+    int64_t sendAfter = 0, receiveAfter = 0;
+    for (int i=0; i<iterations; i++) {
+        timer.start();
+        for (int heading=0; heading<360; heading++) {
+            const QByteArray frame = sphero::v2::encode(DrivePacket(uint8_t(heading % 256), uint16_t(heading)));
+            TRACE(lcSpheroTx) << " > Sending command, data" << HexDump(frame);
+        }
+        sendAfter += timer.nsecsElapsed();
+
+        timer.start();
+        FrameDecoder decoder;
+        int offset = 0;
+        for (const int size : notificationSizes) {
+            TRACE(lcSpheroRx) << " < Notification" << HexDump(stream.constData() + offset, size);
+            decoder.feed(stream.constData() + offset, size, [](const FrameDecoder::Frame &frame) {
+                TRACE(lcSpheroRx) << " - data notification" << frame.data[0] << frame.size;
+            });
+            offset += size;
+        }
+        receiveAfter += timer.nsecsElapsed();
+    }
+
+    qInstallMessageHandler(previousHandler);
+
+    const uint64_t sent = 360 * uint64_t(iterations);
+    const uint64_t received = frames;
+    report("send, qDebug() and toHex()", sendBefore, sent, "frames");
+    report("send, TRACE() disabled", sendAfter, sent, "frames");
+    report("receive, qDebug() and toHex()", receiveBefore, received, "frames", uint64_t(stream.size()) * uint64_t(iterations));
+    report("receive, TRACE() disabled", receiveAfter, received, "frames", uint64_t(stream.size()) * uint64_t(iterations));
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addPositionalArgument("capture", "Session recorded from a V2 robot with $ROBOT_CAPTURE_DIR set, generated frames are used if not given.", "[capture]");
+    const QCommandLineOption iterationsOption("iterations", "How many times to run each benchmark.", "count", "100");
+    const QCommandLineOption framesOption("frames", "How many frames to generate when no capture is given.", "count", "10000");
+    parser.addOption(iterationsOption);
+    parser.addOption(framesOption);
+    parser.process(app);
+
+    const int iterations = qMax(parser.value(iterationsOption).toInt(), 1);
+
+    QByteArray stream;
+    std::vector<int> notificationSizes;
+    if (!parser.positionalArguments().isEmpty()) {
+        if (!readCapture(parser.positionalArguments().first(), &stream, &notificationSizes)) {
+            return 1;
+        }
+    } else {
+        generateFrames(qMax(parser.value(framesOption).toInt(), 1), &stream, &notificationSizes);
+    }
+
+    benchmarkDecode(stream, notificationSizes, iterations);
+    benchmarkEncode(iterations);
+    benchmarkLogging(stream, notificationSizes, iterations);
+
+    return 0;
+}
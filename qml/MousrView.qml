@@ -9,7 +9,7 @@ import "." as Lol
 
 Rectangle {
     id: robotView
-    property MousrHandler device
+    property var device // a DeviceProxy
     readonly property int margins: 10
     anchors.fill: parent
 
@@ -230,7 +230,7 @@ Rectangle {
 
         Button {
             id: chirpButton
-            onClicked: device.chirp()
+            onClicked: device.call("chirp")
             text: qsTr("Chirp")
         }
 
@@ -260,7 +260,7 @@ Rectangle {
                 }
 
                 ComboBox {
-                    model: device.autoplayGameModeNames()
+                    model: device.autoplayGameModeNames
                     currentIndex: device.autoplayGameMode
                     width: parent.width
                     onActivated: {
@@ -272,7 +272,7 @@ Rectangle {
                 }
 
                 ComboBox {
-                    model: device.autoplayDrivingModeNames()
+                    model: device.autoplayDrivingModeNames
                     currentIndex: device.autoplayDrivingMode
                     width: parent.width
                     onActivated: {
@@ -293,10 +293,10 @@ Rectangle {
     focus: true
 
     Keys.onLeftPressed: {
-        device.rotate(MousrHandler.Left);
+        device.call("rotate", MousrHandler.Left);
     }
     Keys.onRightPressed: {
-        device.rotate(MousrHandler.Right);
+        device.call("rotate", MousrHandler.Right);
     }
     Keys.onPressed: {
         if (event.key === Qt.Key_Up) {
@@ -322,11 +322,11 @@ Rectangle {
 
         if (event.key === Qt.Key_Up || event.key === Qt.Key_Down) {
             device.speed = 0;
-            device.stop()
+            device.call("stop")
         } else if (event.key === Qt.Key_Return) {
-            device.flickTail();
+            device.call("flickTail");
         } else if (event.key === Qt.Key_Space) {
-            device.flip();
+            device.call("flip");
         }
     }
 }
@@ -11,14 +11,10 @@ Rectangle {
     id: robotView
     anchors.fill: parent
 
-    property SpheroHandler device
+    property var device // a DeviceProxy
 
-    Connections {
-        target: device
-        function onConnectedChanged() {
-            console.log(" Connected changed! " + device.isConnected)
-        }
-    }
+    property bool isConnected: device.isConnected
+    onIsConnectedChanged: console.log(" Connected changed! " + isConnected)
 
     Lol.Spinner {
         id: spinner
@@ -31,7 +27,7 @@ Rectangle {
         id: disconnectButton
         visible: device.isConnected
         text: "Disconnect"
-        onClicked: device.disconnectFromRobot();
+        onClicked: DeviceDiscoverer.disconnectDevice(device);
     }
 
     Text {
@@ -155,29 +155,12 @@ Window {
                 model: DeviceDiscoverer.availableDevices
 
                 delegate: Lol.Button {
-                    color: DeviceDiscoverer.displayColor(modelData)
-
-                    function updateText(strength) {
-                        text = DeviceDiscoverer.displayName(modelData) + " (" + Math.floor(strength * 100) + "%)";
-
-                        active = strength > 0
-                    }
-
-                    Component.onCompleted: {
-                        updateText(DeviceDiscoverer.signalStrength(modelData))
-                    }
-
-                    Connections {
-                        target: DeviceDiscoverer
-                        function onSignalStrengthChanged(deviceName, strength) {
-                            if (deviceName === modelData) {
-                                updateText(strength)
-                            }
-                        }
-                    }
+                    color: model.color
+                    text: model.name + " (" + Math.floor(model.signalStrength * 100) + "%)"
+                    active: model.signalStrength > 0
 
                     onClicked: {
-                        DeviceDiscoverer.connectDevice(modelData)
+                        DeviceDiscoverer.connectDevice(model.address)
                     }
                 }
             }
@@ -239,4 +222,36 @@ Window {
             return undefined;
         }
     }
+
+    // Switch between connected robots, or go back to connect another one
+    Row {
+        anchors {
+            top: parent.top
+            horizontalCenter: parent.horizontalCenter
+            topMargin: 5
+        }
+        spacing: 5
+        visible: DeviceDiscoverer.connectedDevices.count > 0
+
+        Repeater {
+            model: DeviceDiscoverer.connectedDevices
+
+            delegate: Lol.Button {
+                width: 150
+                height: 40
+                text: model.name
+                active: model.device === DeviceDiscoverer.device
+                color: DeviceDiscoverer.displayColor(model.address)
+                onClicked: DeviceDiscoverer.device = model.device
+            }
+        }
+
+        Lol.Button {
+            width: 40
+            height: 40
+            text: "+"
+            active: !DeviceDiscoverer.device
+            onClicked: DeviceDiscoverer.device = null
+        }
+    }
 }
@@ -0,0 +1,56 @@
+#include "Application.h"
+#include "Logging.h"
+
+#include <QThread>
+
+static QElapsedTimer s_startupTimer;
+
+Application::Application(int &argc, char **argv) :
+    QGuiApplication(argc, argv)
+{
+    s_startupTimer.start();
+
+    m_enabled = lcLoad().isInfoEnabled();
+    if (!m_enabled) {
+        return;
+    }
+
+    m_reportTimer.setInterval(1000);
+    connect(&m_reportTimer, &QTimer::timeout, this, &Application::report);
+    m_reportTimer.start();
+    m_reportInterval.start();
+}
+
+int64_t Application::msecsSinceStartup()
+{
+    return s_startupTimer.isValid() ? s_startupTimer.elapsed() : 0;
+}
+
+bool Application::notify(QObject *receiver, QEvent *event)
+{
+    // Called for events on all threads, only ours is interesting
+    if (!m_enabled || QThread::currentThread() != thread()) {
+        return QGuiApplication::notify(receiver, event);
+    }
+
+    if (m_depth++ == 0) {
+        m_events++;
+        m_eventTimer.start();
+    }
+    const bool ret = QGuiApplication::notify(receiver, event);
+    if (--m_depth == 0) {
+        m_busyNanoseconds += m_eventTimer.nsecsElapsed();
+    }
+    return ret;
+}
+
+void Application::report()
+{
+    const int64_t elapsed = m_reportInterval.restart();
+    qCInfo(lcLoad).noquote() << QStringLiteral("GUI thread busy %1 ms/s, %2 events/s")
+            .arg(elapsed > 0 ? m_busyNanoseconds / 1000. / elapsed : 0., 0, 'f', 1)
+            .arg(elapsed > 0 ? m_events * 1000. / elapsed : 0., 0, 'f', 0);
+
+    m_busyNanoseconds = 0;
+    m_events = 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <QGuiApplication>
+#include <QElapsedTimer>
+#include <QTimer>
+
+#include <cstdint>
+
+/// Measures how much of every second the GUI thread spends handling events,
+/// to see what the robots cost it (e. g. with and without --gui-thread-io).
+/// Logged to "robot.load", which is off by default.
+class Application : public QGuiApplication
+{
+    Q_OBJECT
+
+public:
+    Application(int &argc, char **argv);
+
+    bool notify(QObject *receiver, QEvent *event) override;
+
+    /// Since the application was created, which is the first thing in main()
+    static int64_t msecsSinceStartup();
+
+private slots:
+    void report();
+
+private:
+    bool m_enabled = false;
+    int m_depth = 0; // events sent while handling others are already counted
+    uint32_t m_events = 0;
+    int64_t m_busyNanoseconds = 0;
+
+    QElapsedTimer m_eventTimer;
+    QElapsedTimer m_reportInterval;
+    QTimer m_reportTimer;
+};
@@ -0,0 +1,125 @@
+#include "AvailableDevices.h"
+#include "BasicTypes.h"
+
+#include <QDebug>
+
+int AvailableDevices::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid()) {
+        return 0;
+    }
+    return m_devices.count();
+}
+
+QVariant AvailableDevices::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_devices.count()) {
+        return QVariant();
+    }
+    const Device &device = m_devices[index.row()];
+
+    switch(role) {
+    case AddressRole:
+        return device.address;
+    case Qt::DisplayRole:
+    case NameRole:
+        return device.name;
+    case TypeRole:
+        return device.type;
+    case RssiRole:
+        return device.rssi;
+    case SignalStrengthRole:
+        return rssiToStrength(device.rssi);
+    case ColorRole:
+        return displayColor(device.address);
+    default:
+        return QVariant();
+    }
+}
+
+QHash<int, QByteArray> AvailableDevices::roleNames() const
+{
+    return {
+        { AddressRole, "address" },
+        { NameRole, "name" },
+        { TypeRole, "deviceType" },
+        { RssiRole, "rssi" },
+        { SignalStrengthRole, "signalStrength" },
+        { ColorRole, "color" },
+    };
+}
+
+bool AvailableDevices::update(const QBluetoothDeviceInfo &info, const QString &name, const QString &type)
+{
+    const QString address = info.address().toString();
+    const int row = m_rows.value(address, -1);
+    if (row == -1) {
+        beginInsertRows(QModelIndex(), m_devices.count(), m_devices.count());
+        m_rows.insert(address, m_devices.count());
+        m_devices.append({info, address, name, type, info.rssi()});
+        endInsertRows();
+        emit countChanged();
+        return true;
+    }
+
+    Device &device = m_devices[row];
+    device.info = info;
+
+    QVector<int> roles;
+    if (device.name != name) {
+        device.name = name;
+        roles.append(NameRole);
+    }
+    if (device.type != type) {
+        device.type = type;
+        roles.append(TypeRole);
+    }
+    if (device.rssi != info.rssi()) {
+        device.rssi = info.rssi();
+        roles.append({RssiRole, SignalStrengthRole});
+    }
+    if (!roles.isEmpty()) {
+        const QModelIndex changed = index(row);
+        emit dataChanged(changed, changed, roles);
+    }
+    return false;
+}
+
+void AvailableDevices::updateRssi(const QString &address, const int16_t rssi)
+{
+    const int row = m_rows.value(address, -1);
+    if (row == -1 || m_devices[row].rssi == rssi) {
+        return;
+    }
+    m_devices[row].rssi = rssi;
+    m_devices[row].info.setRssi(rssi);
+
+    const QModelIndex changed = index(row);
+    emit dataChanged(changed, changed, {RssiRole, SignalStrengthRole});
+}
+
+QBluetoothDeviceInfo AvailableDevices::take(const QString &address)
+{
+    const int row = m_rows.value(address, -1);
+    if (row == -1) {
+        qWarning() << "Unknown device" << address;
+        return QBluetoothDeviceInfo();
+    }
+
+    beginRemoveRows(QModelIndex(), row, row);
+    const QBluetoothDeviceInfo info = m_devices.takeAt(row).info;
+    m_rows.remove(address);
+    for (int i=row; i<m_devices.count(); i++) {
+        m_rows[m_devices[i].address] = i;
+    }
+    endRemoveRows();
+    emit countChanged();
+
+    return info;
+}
+
+QColor AvailableDevices::displayColor(const QString &address)
+{
+    static constexpr int maxHue = 360;
+    return QColor::fromHsv(uint16_t(qHash(address)) % maxHue, 255, 255, 32);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <QAbstractListModel>
+#include <QBluetoothDeviceInfo>
+#include <QColor>
+#include <QHash>
+#include <QVector>
+
+/// The robots we have seen adverts from, but aren't connected to, for QML.
+/// Rows are only inserted for new robots, and repeated adverts only change the
+/// roles that actually changed (usually just the signal strength).
+class AvailableDevices : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(int count READ count NOTIFY countChanged)
+
+public:
+    enum Roles {
+        AddressRole = Qt::UserRole + 1,
+        NameRole,
+        TypeRole,
+        RssiRole,
+        SignalStrengthRole,
+        ColorRole
+    };
+
+    explicit AvailableDevices(QObject *parent = nullptr) : QAbstractListModel(parent) {}
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    int count() const { return m_devices.count(); }
+    bool isEmpty() const { return m_devices.isEmpty(); }
+    bool contains(const QString &address) const { return m_rows.contains(address); }
+
+    /// Adds it if it is new, returns true if it was
+    bool update(const QBluetoothDeviceInfo &device, const QString &name, const QString &type);
+    void updateRssi(const QString &address, const int16_t rssi);
+
+    QBluetoothDeviceInfo take(const QString &address);
+
+    static QColor displayColor(const QString &address);
+
+signals:
+    void countChanged();
+
+private:
+    struct Device {
+        QBluetoothDeviceInfo info;
+        QString address;
+        QString name;
+        QString type;
+        int16_t rssi = 0;
+    };
+
+    QVector<Device> m_devices;
+    QHash<QString, int> m_rows; // address to row
+};
@@ -0,0 +1,168 @@
+#include "BleTransport.h"
+
+#include <QDebug>
+
+BleTransport::BleTransport(QObject *parent) :
+    Transport(parent)
+{
+}
+
+void BleTransport::addService(QLowEnergyService *service)
+{
+    if (!service) {
+        qWarning() << "Can't add invalid service";
+        return;
+    }
+
+    m_services.push_back({service, {}});
+    m_characteristics.clear();
+
+    connect(service, &QLowEnergyService::characteristicChanged, this, &BleTransport::onCharacteristicChanged);
+    connect(service, &QLowEnergyService::stateChanged, this, &BleTransport::onServiceStateChanged);
+    connect(service, QOverload<QLowEnergyService::ServiceError>::of(&QLowEnergyService::error), this, &BleTransport::onServiceError);
+    connect(service, &QLowEnergyService::characteristicWritten, this, [this](const QLowEnergyCharacteristic &characteristic) {
+        Service *target = serviceFor(sender());
+        if (target && !target->pendingWrites.empty()) {
+            target->pendingWrites.pop_front();
+        }
+        emit written(characteristic.uuid());
+    });
+}
+
+void BleTransport::setController(QLowEnergyController *controller)
+{
+    m_controller = controller;
+    connect(controller, &QLowEnergyController::connectionUpdated, this, &Transport::connectionUpdated);
+}
+
+bool BleTransport::requestConnectionUpdate(const QLowEnergyConnectionParameters &parameters)
+{
+    if (!m_controller || m_controller->state() == QLowEnergyController::UnconnectedState) {
+        return false;
+    }
+
+    // With BlueZ this needs CAP_NET_ADMIN, otherwise Qt just logs a warning and nothing happens
+    m_controller->requestConnectionUpdate(parameters);
+    return true;
+}
+
+void BleTransport::close()
+{
+    // The controller tells the handler when it is done
+    if (m_controller) {
+        m_controller->disconnectFromDevice();
+    }
+}
+
+bool BleTransport::isOpen() const
+{
+    if (m_services.empty()) {
+        return false;
+    }
+    for (const Service &service : m_services) {
+        if (!service.service || service.service->state() != QLowEnergyService::ServiceDiscovered) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BleTransport::canWriteWithoutResponse(const QBluetoothUuid &characteristic) const
+{
+    QLowEnergyCharacteristic found;
+    if (!const_cast<BleTransport*>(this)->serviceFor(characteristic, &found)) {
+        return false;
+    }
+    return found.properties() & QLowEnergyCharacteristic::WriteNoResponse;
+}
+
+void BleTransport::writeCharacteristic(const QBluetoothUuid &characteristic, const QByteArray &data, const QLowEnergyService::WriteMode mode)
+{
+    QLowEnergyCharacteristic found;
+    Service *service = serviceFor(characteristic, &found);
+    if (!service) {
+        qWarning() << "Can't write to unknown characteristic" << characteristic;
+        failWrite(characteristic, mode);
+        return;
+    }
+
+    if (mode == QLowEnergyService::WriteWithResponse) {
+        service->pendingWrites.push_back(characteristic);
+    }
+    service->service->writeCharacteristic(found, data, mode);
+}
+
+void BleTransport::onCharacteristicChanged(const QLowEnergyCharacteristic &characteristic, const QByteArray &data)
+{
+    emit received(characteristic.uuid(), data);
+}
+
+void BleTransport::onServiceStateChanged(QLowEnergyService::ServiceState newState)
+{
+    // Characteristics might have moved or disappeared
+    m_characteristics.clear();
+
+    if (newState != QLowEnergyService::InvalidService) {
+        return;
+    }
+
+    Service *service = serviceFor(sender());
+    if (service) {
+        service->pendingWrites.clear();
+    }
+    emit closed();
+}
+
+void BleTransport::onServiceError(QLowEnergyService::ServiceError error)
+{
+    if (error != QLowEnergyService::CharacteristicWriteError) {
+        return;
+    }
+
+    Service *service = serviceFor(sender());
+    if (!service || service->pendingWrites.empty()) {
+        // Nothing acknowledged pending, so a write without response, which nobody waits for
+        qWarning() << "Write without response failed";
+        return;
+    }
+
+    const QBluetoothUuid characteristic = service->pendingWrites.front();
+    service->pendingWrites.pop_front();
+    emit writeFailed(characteristic);
+}
+
+BleTransport::Service *BleTransport::serviceFor(const QBluetoothUuid &characteristic, QLowEnergyCharacteristic *found)
+{
+    const QHash<QBluetoothUuid, Cached>::const_iterator cached = m_characteristics.constFind(characteristic);
+    if (cached != m_characteristics.constEnd()) {
+        Service &service = m_services[size_t(cached->service)];
+        if (service.service) {
+            *found = cached->characteristic;
+            return &service;
+        }
+        m_characteristics.remove(characteristic);
+    }
+
+    for (size_t i=0; i<m_services.size(); i++) {
+        Service &service = m_services[i];
+        if (!service.service || service.service->state() != QLowEnergyService::ServiceDiscovered) {
+            continue;
+        }
+        *found = service.service->characteristic(characteristic);
+        if (found->isValid()) {
+            m_characteristics.insert(characteristic, {int(i), *found});
+            return &service;
+        }
+    }
+    return nullptr;
+}
+
+BleTransport::Service *BleTransport::serviceFor(const QObject *service)
+{
+    for (Service &candidate : m_services) {
+        if (candidate.service == service) {
+            return &candidate;
+        }
+    }
+    return nullptr;
+}
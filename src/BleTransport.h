@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Transport.h"
+
+#include <QPointer>
+#include <QLowEnergyCharacteristic>
+#include <QLowEnergyController>
+#include <QHash>
+
+#include <deque>
+#include <vector>
+
+/// Transport on top of one or more QLowEnergyServices (e. g. the Sphero main
+/// and radio services), writes go to whichever service has the characteristic.
+class BleTransport : public Transport
+{
+    Q_OBJECT
+
+public:
+    explicit BleTransport(QObject *parent = nullptr);
+
+    /// The service should be created but doesn't need to be discovered yet
+    void addService(QLowEnergyService *service);
+
+    /// For requestConnectionUpdate(), and forwards its connectionUpdated()
+    void setController(QLowEnergyController *controller);
+
+    bool isOpen() const override;
+    void close() override;
+    bool canWriteWithoutResponse(const QBluetoothUuid &characteristic) const override;
+    bool requestConnectionUpdate(const QLowEnergyConnectionParameters &parameters) override;
+
+protected:
+    void writeCharacteristic(const QBluetoothUuid &characteristic, const QByteArray &data, const QLowEnergyService::WriteMode mode) override;
+
+private slots:
+    void onCharacteristicChanged(const QLowEnergyCharacteristic &characteristic, const QByteArray &data);
+    void onServiceStateChanged(QLowEnergyService::ServiceState newState);
+    void onServiceError(QLowEnergyService::ServiceError error);
+
+private:
+    struct Service {
+        QPointer<QLowEnergyService> service;
+
+        // Qt does one write at a time per service, so the errors (which don't
+        // say which characteristic) are for the oldest one
+        std::deque<QBluetoothUuid> pendingWrites;
+    };
+
+    Service *serviceFor(const QBluetoothUuid &characteristic, QLowEnergyCharacteristic *found);
+    Service *serviceFor(const QObject *service);
+
+    std::vector<Service> m_services;
+    QPointer<QLowEnergyController> m_controller;
+
+    // Looking through all characteristics in all services for every write adds up
+    struct Cached {
+        int service;
+        QLowEnergyCharacteristic characteristic;
+    };
+    QHash<QBluetoothUuid, Cached> m_characteristics;
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "Logging.h"
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+/// The steps needed to get a robot ready to drive, and what each of them has
+/// to wait for. Every step whose dependencies are done is started right away,
+/// so e. g. independent services are discovered in parallel instead of one
+/// after another. A step is done when finish() is called for it, which can be
+/// from inside its own action if there is nothing to wait for.
+/// When and how long each step ran is logged to "robot.connect" when all are done.
+class ConnectSequence
+{
+public:
+    using Action = std::function<void()>;
+
+    /// The dependencies have to be added first
+    void addStep(const QString &name, const QStringList &dependencies, Action action)
+    {
+        for (const QString &dependency : dependencies) {
+            if (indexOf(dependency) == -1) {
+                qWarning() << " ! Connect step" << name << "depends on unknown step" << dependency;
+                return;
+            }
+        }
+        m_steps.append({name, dependencies, std::move(action)});
+    }
+
+    /// Times are relative to when the clock was started, e. g. when we started connecting
+    void start(const QElapsedTimer &clock)
+    {
+        m_clock = clock;
+        m_running = true;
+        startReady();
+    }
+
+    void finish(const QString &name)
+    {
+        const int index = indexOf(name);
+        if (index == -1 || m_steps[index].started < 0 || m_steps[index].finished >= 0) {
+            qWarning() << " ! Connect step" << name << "finished without running";
+            return;
+        }
+        m_steps[index].finished = m_clock.elapsed();
+        qCDebug(lcConnect) << " - Finished" << name << "at" << m_steps[index].finished << "ms";
+
+        startReady();
+
+        // Can be nested inside another step's finish(), only log once
+        if (isDone() && !m_traced) {
+            m_traced = true;
+            qCInfo(lcConnect).noquote() << trace();
+        }
+    }
+
+    /// Nothing more will be started, e. g. because a step failed
+    void stop() { m_running = false; }
+
+    bool isFinished(const QString &name) const
+    {
+        const int index = indexOf(name);
+        return index != -1 && m_steps[index].finished >= 0;
+    }
+
+    bool isDone() const
+    {
+        for (const Step &step : m_steps) {
+            if (step.finished < 0) {
+                return false;
+            }
+        }
+        return !m_steps.isEmpty();
+    }
+
+    /// One line per step, with when it started, how long it waited for its
+    /// dependencies and how long it ran
+    QString trace() const
+    {
+        QString ret = QStringLiteral("Connect sequence:");
+        for (const Step &step : m_steps) {
+            if (step.started < 0) {
+                ret += QStringLiteral("\n  %1 not started").arg(step.name, -16);
+                continue;
+            }
+
+            int64_t ready = 0;
+            for (const QString &dependency : step.dependencies) {
+                ready = std::max(ready, m_steps[indexOf(dependency)].finished);
+            }
+            ret += QStringLiteral("\n  %1 started at %2 ms, waited %3 ms, ")
+                    .arg(step.name, -16)
+                    .arg(step.started, 5)
+                    .arg(step.started - ready, 4);
+            if (step.finished < 0) {
+                ret += QStringLiteral("still running");
+            } else {
+                ret += QStringLiteral("took %1 ms").arg(step.finished - step.started);
+            }
+        }
+        return ret;
+    }
+
+private:
+    struct Step {
+        QString name;
+        QStringList dependencies;
+        Action action;
+        int64_t started = -1; // ms
+        int64_t finished = -1;
+    };
+
+    int indexOf(const QString &name) const
+    {
+        for (int i=0; i<m_steps.count(); i++) {
+            if (m_steps[i].name == name) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void startReady()
+    {
+        // Actions can finish() themselves, which ends up back here
+        for (int i=0; i<m_steps.count() && m_running; i++) {
+            if (m_steps[i].started >= 0 || !dependenciesFinished(m_steps[i])) {
+                continue;
+            }
+            m_steps[i].started = m_clock.elapsed();
+            qCDebug(lcConnect) << " - Starting" << m_steps[i].name << "at" << m_steps[i].started << "ms";
+
+            const Action action = m_steps[i].action;
+            if (action) {
+                action();
+            }
+        }
+    }
+
+    bool dependenciesFinished(const Step &step) const
+    {
+        for (const QString &dependency : step.dependencies) {
+            if (!isFinished(dependency)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    QVector<Step> m_steps;
+    QElapsedTimer m_clock;
+    bool m_running = false;
+    bool m_traced = false;
+};
@@ -0,0 +1,156 @@
+#include "ConnectedDevices.h"
+
+#include <QDebug>
+
+int ConnectedDevices::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid()) {
+        return 0;
+    }
+    return m_devices.count();
+}
+
+QVariant ConnectedDevices::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_devices.count()) {
+        return QVariant();
+    }
+    const Device &device = m_devices[index.row()];
+    if (!device.proxy) {
+        return QVariant();
+    }
+
+    switch(role) {
+    case DeviceRole:
+        return QVariant::fromValue<QObject*>(device.proxy.data());
+    case AddressRole:
+        return device.address;
+    case Qt::DisplayRole:
+    case NameRole:
+        return device.proxy->value(QStringLiteral("name"));
+    case TypeRole:
+        return device.proxy->value(QStringLiteral("deviceType"));
+    case ConnectedRole:
+        return device.proxy->value(QStringLiteral("isConnected"));
+    default:
+        return QVariant();
+    }
+}
+
+QHash<int, QByteArray> ConnectedDevices::roleNames() const
+{
+    return {
+        { DeviceRole, "device" },
+        { AddressRole, "address" },
+        { NameRole, "name" },
+        { TypeRole, "deviceType" },
+        { ConnectedRole, "isConnected" },
+    };
+}
+
+void ConnectedDevices::add(DeviceProxy *device, const QString &address)
+{
+    if (indexOf(device) != -1) {
+        qWarning() << "Already have" << address;
+        return;
+    }
+
+    connect(device, &DeviceProxy::updated, this, &ConnectedDevices::onDeviceUpdated);
+
+    beginInsertRows(QModelIndex(), m_devices.count(), m_devices.count());
+    m_devices.append({device, address});
+    endInsertRows();
+    emit countChanged();
+}
+
+void ConnectedDevices::remove(DeviceProxy *device)
+{
+    const int row = indexOf(device);
+    if (row == -1) {
+        return;
+    }
+    disconnect(device, nullptr, this, nullptr);
+
+    beginRemoveRows(QModelIndex(), row, row);
+    m_devices.remove(row);
+    endRemoveRows();
+    emit countChanged();
+}
+
+QObject *ConnectedDevices::at(const int row) const
+{
+    if (row < 0 || row >= m_devices.count()) {
+        return nullptr;
+    }
+    return m_devices[row].proxy.data();
+}
+
+DeviceProxy *ConnectedDevices::find(const QString &address) const
+{
+    for (const Device &device : m_devices) {
+        if (device.address == address) {
+            return device.proxy.data();
+        }
+    }
+    return nullptr;
+}
+
+DeviceProxy *ConnectedDevices::proxyFor(const QObject *handler) const
+{
+    for (const Device &device : m_devices) {
+        if (device.proxy && device.proxy->handler() == handler) {
+            return device.proxy.data();
+        }
+    }
+    return nullptr;
+}
+
+QString ConnectedDevices::address(const QObject *device) const
+{
+    const int row = indexOf(device);
+    return row == -1 ? QString() : m_devices[row].address;
+}
+
+QVector<DeviceProxy*> ConnectedDevices::devices() const
+{
+    QVector<DeviceProxy*> ret;
+    ret.reserve(m_devices.count());
+    for (const Device &device : m_devices) {
+        if (device.proxy) {
+            ret.append(device.proxy.data());
+        }
+    }
+    return ret;
+}
+
+void ConnectedDevices::onDeviceUpdated(const QStringList &keys)
+{
+    // Most of what changes is sensor data and similar, which we don't care about
+    QVector<int> roles;
+    if (keys.contains(QStringLiteral("name"))) {
+        roles.append(NameRole);
+    }
+    if (keys.contains(QStringLiteral("isConnected"))) {
+        roles.append(ConnectedRole);
+    }
+    if (roles.isEmpty()) {
+        return;
+    }
+
+    const int row = indexOf(sender());
+    if (row == -1) {
+        return;
+    }
+    const QModelIndex changed = index(row);
+    emit dataChanged(changed, changed, roles);
+}
+
+int ConnectedDevices::indexOf(const QObject *device) const
+{
+    for (int i=0; i<m_devices.count(); i++) {
+        if (m_devices[i].proxy == device) {
+            return i;
+        }
+    }
+    return -1;
+}
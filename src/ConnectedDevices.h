@@ -0,0 +1,60 @@
+#pragma once
+
+#include "DeviceProxy.h"
+
+#include <QAbstractListModel>
+#include <QPointer>
+#include <QVector>
+
+/// The robots we have a session with, for QML.
+/// Doesn't own the proxies, the DeviceDiscoverer does.
+class ConnectedDevices : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(int count READ count NOTIFY countChanged)
+
+public:
+    enum Roles {
+        DeviceRole = Qt::UserRole + 1,
+        AddressRole,
+        NameRole,
+        TypeRole,
+        ConnectedRole
+    };
+
+    explicit ConnectedDevices(QObject *parent = nullptr) : QAbstractListModel(parent) {}
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    int count() const { return m_devices.count(); }
+
+    /// Address is whatever identifies it to the discoverer, e. g. the bluetooth address
+    void add(DeviceProxy *device, const QString &address);
+    void remove(DeviceProxy *device);
+
+    Q_INVOKABLE QObject *at(const int row) const;
+    DeviceProxy *find(const QString &address) const;
+    DeviceProxy *proxyFor(const QObject *handler) const;
+    bool contains(const QString &address) const { return find(address) != nullptr; }
+    QString address(const QObject *device) const;
+
+    QVector<DeviceProxy*> devices() const;
+
+signals:
+    void countChanged();
+
+private slots:
+    void onDeviceUpdated(const QStringList &keys);
+
+private:
+    struct Device {
+        QPointer<DeviceProxy> proxy;
+        QString address;
+    };
+
+    int indexOf(const QObject *device) const;
+
+    QVector<Device> m_devices;
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/// Counts decoded packets per type, how long handling them took and how many
+/// failed, for benchmarking the parsers against replayed captures.
+/// The handlers only time anything when they have one set.
+class DecodeStats
+{
+public:
+    using NameFunction = std::function<QString(uint16_t)>;
+
+    struct Type {
+        uint64_t count = 0;
+        uint64_t failures = 0;
+        int64_t nanoseconds = 0;
+    };
+
+    /// For packets that are too broken to have a type
+    static constexpr uint16_t InvalidType = 0xFFFF;
+
+    /// Measures from construction until it goes out of scope
+    class Timer
+    {
+    public:
+        Timer(DecodeStats *stats, const uint16_t type) : m_stats(stats), m_type(type) {
+            m_timer.start();
+        }
+        ~Timer() {
+            m_stats->add(m_type, m_timer.nsecsElapsed());
+        }
+
+    private:
+        DecodeStats *m_stats;
+        const uint16_t m_type;
+        QElapsedTimer m_timer;
+    };
+
+    void setTypeNames(NameFunction names) { m_names = std::move(names); }
+
+    void add(const uint16_t type, const int64_t nanoseconds) {
+        Type &stats = m_types[type];
+        stats.count++;
+        stats.nanoseconds += nanoseconds;
+        m_frames++;
+    }
+
+    void addFailure(const uint16_t type = InvalidType) {
+        m_types[type].failures++;
+        m_failures++;
+    }
+
+    uint64_t frames() const { return m_frames; }
+    uint64_t failures() const { return m_failures; }
+    const QHash<uint16_t, Type> &types() const { return m_types; }
+
+    void reset() {
+        m_types.clear();
+        m_frames = 0;
+        m_failures = 0;
+    }
+
+    /// Slowest packet types first
+    QString report(const int64_t elapsedNanoseconds) const {
+        QStringList lines;
+        lines.append(QStringLiteral("%1 frames in %2 ms, %3 frames/s, %4 decode failures")
+                .arg(m_frames)
+                .arg(elapsedNanoseconds / 1000000.)
+                .arg(elapsedNanoseconds > 0 ? m_frames * 1000000000. / elapsedNanoseconds : 0., 0, 'f', 0)
+                .arg(m_failures));
+
+        std::vector<QHash<uint16_t, Type>::const_iterator> sorted;
+        sorted.reserve(size_t(m_types.size()));
+        for (QHash<uint16_t, Type>::const_iterator it = m_types.constBegin(); it != m_types.constEnd(); ++it) {
+            sorted.push_back(it);
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const QHash<uint16_t, Type>::const_iterator &a, const QHash<uint16_t, Type>::const_iterator &b) {
+            return a->nanoseconds > b->nanoseconds;
+        });
+
+        for (const QHash<uint16_t, Type>::const_iterator &it : sorted) {
+            const uint16_t type = it.key();
+            const Type &stats = it.value();
+            QString name = m_names ? m_names(type) : QString();
+            if (name.isEmpty()) {
+                name = QStringLiteral("0x%1").arg(type, 4, 16, QLatin1Char('0'));
+            }
+            lines.append(QStringLiteral("  %1: %2 frames, %3 failed, %4 ms total, %5 ns/frame")
+                    .arg(name, -32)
+                    .arg(stats.count)
+                    .arg(stats.failures)
+                    .arg(stats.nanoseconds / 1000000.)
+                    .arg(stats.count ? stats.nanoseconds / int64_t(stats.count) : 0));
+        }
+
+        return lines.join(QLatin1Char('\n'));
+    }
+
+private:
+    QHash<uint16_t, Type> m_types;
+    uint64_t m_frames = 0;
+    uint64_t m_failures = 0;
+
+    NameFunction m_names;
+};
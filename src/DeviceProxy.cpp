@@ -0,0 +1,244 @@
+#include "DeviceProxy.h"
+
+#include <QDebug>
+#include <QMetaMethod>
+#include <QMetaProperty>
+#include <QThread>
+
+SnapshotPublisher::SnapshotPublisher(QObject *handler, std::shared_ptr<SnapshotMailbox> mailbox) :
+    QObject(handler),
+    m_handler(handler),
+    m_mailbox(std::move(mailbox))
+{
+    const QMetaObject *meta = handler->metaObject();
+    const QMetaMethod onChanged = metaObject()->method(metaObject()->indexOfSlot("onPropertyChanged()"));
+
+    // Skip objectName
+    for (int i=QObject::staticMetaObject.propertyCount(); i<meta->propertyCount(); i++) {
+        const QMetaProperty property = meta->property(i);
+        if (!property.isReadable() || !property.hasNotifySignal()) {
+            continue;
+        }
+        const int signal = property.notifySignalIndex();
+        if (!m_notifiers.contains(signal)) {
+            connect(handler, property.notifySignal(), this, onChanged);
+        }
+        m_notifiers[signal].append(i);
+    }
+
+    m_timer.setSingleShot(true);
+    m_timer.setInterval(interval);
+    connect(&m_timer, &QTimer::timeout, this, &SnapshotPublisher::publish);
+}
+
+void SnapshotPublisher::publishAll()
+{
+    const QMetaObject *meta = m_handler->metaObject();
+    for (int i=QObject::staticMetaObject.propertyCount(); i<meta->propertyCount(); i++) {
+        if (meta->property(i).isReadable()) {
+            m_dirty.insert(i);
+        }
+    }
+    publish();
+}
+
+void SnapshotPublisher::onPropertyChanged()
+{
+    for (const int property : m_notifiers.value(senderSignalIndex())) {
+        m_dirty.insert(property);
+    }
+    if (!m_timer.isActive()) {
+        m_timer.start();
+    }
+}
+
+void SnapshotPublisher::publish()
+{
+    if (m_dirty.isEmpty()) {
+        return;
+    }
+
+    QVariantMap *snapshot = new QVariantMap;
+    for (const int property : m_dirty) {
+        snapshot->insert(QString::fromLatin1(m_handler->metaObject()->property(property).name()), read(property));
+    }
+    m_dirty.clear();
+
+    // If the last one wasn't picked up yet, take it back and send what is still new in it along with this
+    const std::unique_ptr<QVariantMap> previous(m_mailbox->pending.exchange(nullptr));
+    if (previous) {
+        for (QVariantMap::const_iterator it = previous->constBegin(); it != previous->constEnd(); ++it) {
+            if (!snapshot->contains(it.key())) {
+                snapshot->insert(it.key(), it.value());
+            }
+        }
+    }
+
+    // We're the only one putting anything there
+    m_mailbox->pending.store(snapshot);
+
+    // Even if we took one back, the proxy might have looked in between and found nothing
+    emit published();
+}
+
+QVariant SnapshotPublisher::read(const int propertyIndex) const
+{
+    const QMetaProperty property = m_handler->metaObject()->property(propertyIndex);
+    const QVariant value = property.read(m_handler);
+
+    // QML compares these with the enum values, which are just numbers there
+    if (property.isEnumType()) {
+        return value.toInt();
+    }
+    return value;
+}
+
+DeviceProxy::DeviceProxy(QObject *handler, QObject *parent) :
+    QQmlPropertyMap(this, parent),
+    m_handler(handler),
+    m_mailbox(std::make_shared<SnapshotMailbox>())
+{
+    const std::shared_ptr<SnapshotMailbox> mailbox = m_mailbox;
+    const auto setup = [this, handler, mailbox]() {
+        SnapshotPublisher *publisher = new SnapshotPublisher(handler, mailbox);
+        connect(publisher, &SnapshotPublisher::published, this, &DeviceProxy::takeSnapshot, Qt::QueuedConnection);
+        publisher->publishAll();
+    };
+
+    if (handler->thread() == QThread::currentThread()) {
+        setup();
+    } else {
+        QMetaObject::invokeMethod(handler, setup, Qt::BlockingQueuedConnection);
+    }
+
+    // So everything is there before QML sees us
+    takeSnapshot();
+
+    if (handler->metaObject()->indexOfSignal("sensorSamplesAvailable()") != -1) {
+        connect(handler, SIGNAL(sensorSamplesAvailable()), this, SIGNAL(sensorSamplesAvailable()));
+    }
+}
+
+void DeviceProxy::takeSnapshot()
+{
+    const std::unique_ptr<QVariantMap> snapshot(m_mailbox->pending.exchange(nullptr));
+    if (!snapshot) {
+        return;
+    }
+
+    QStringList changed;
+    for (QVariantMap::const_iterator it = snapshot->constBegin(); it != snapshot->constEnd(); ++it) {
+        if (value(it.key()) == it.value() && contains(it.key())) {
+            continue;
+        }
+        insert(it.key(), it.value());
+        changed.append(it.key());
+    }
+
+    if (!changed.isEmpty()) {
+        emit updated(changed);
+    }
+}
+
+QVariant DeviceProxy::updateValue(const QString &key, const QVariant &input)
+{
+    if (!m_handler) {
+        return input;
+    }
+
+    QObject *handler = m_handler;
+    const QByteArray name = key.toLatin1();
+    QMetaObject::invokeMethod(handler, [handler, name, input]() {
+        if (!handler->setProperty(name.constData(), input)) {
+            qWarning() << "Failed to set" << name << "to" << input;
+        }
+    }, Qt::QueuedConnection);
+
+    // Shown until the handler publishes what it actually ended up as
+    return input;
+}
+
+// On the handler's thread, the arguments are already converted
+static void invokeDirectly(QObject *handler, const QMetaMethod &method, const QVector<QVariant> &arguments)
+{
+    const QList<QByteArray> types = method.parameterTypes();
+    QGenericArgument generic[2];
+    for (int i=0; i<arguments.count(); i++) {
+        generic[i] = QGenericArgument(types[i].constData(), arguments[i].constData());
+    }
+
+    if (!method.invoke(handler, Qt::DirectConnection, generic[0], generic[1])) {
+        qWarning() << "Failed to call" << method.methodSignature();
+    }
+}
+
+void DeviceProxy::call(const QString &method, const QVariant &argument1, const QVariant &argument2)
+{
+    if (!m_handler) {
+        qWarning() << "No handler to call" << method << "on";
+        return;
+    }
+
+    QVector<QVariant> arguments;
+    if (argument1.isValid()) {
+        arguments.append(argument1);
+    }
+    if (argument2.isValid()) {
+        arguments.append(argument2);
+    }
+
+    // Default arguments show up as separate methods with fewer parameters
+    const QMetaObject *meta = m_handler->metaObject();
+    const QByteArray name = method.toLatin1();
+    QMetaMethod target;
+    for (int i=0; i<meta->methodCount(); i++) {
+        const QMetaMethod candidate = meta->method(i);
+        if (candidate.access() != QMetaMethod::Public || candidate.methodType() == QMetaMethod::Signal) {
+            continue;
+        }
+        if (candidate.name() == name && candidate.parameterCount() == arguments.count()) {
+            target = candidate;
+            break;
+        }
+    }
+    if (!target.isValid()) {
+        qWarning() << "No method" << method << "with" << arguments.count() << "arguments on" << m_handler;
+        return;
+    }
+
+    for (int i=0; i<arguments.count(); i++) {
+        const int type = target.parameterType(i);
+        // Enums might not be registered for QVariant to convert to, but they're just numbers
+        if (type == QMetaType::UnknownType || (QMetaType::typeFlags(type) & QMetaType::IsEnumeration)) {
+            arguments[i] = arguments[i].toInt();
+            continue;
+        }
+        if (!arguments[i].convert(type)) {
+            qWarning() << "Can't convert" << arguments[i] << "for" << target.methodSignature();
+            return;
+        }
+    }
+
+    // Waiting for the handler's thread would block the GUI, values QML needs are properties
+    if (target.returnType() != QMetaType::Void) {
+        qWarning() << "Return value of" << target.methodSignature() << "is ignored, publish it as a property";
+    }
+
+    // Queued even on the same thread, so it stays in order with property writes
+    QObject *handler = m_handler;
+    QMetaObject::invokeMethod(handler, [handler, target, arguments]() {
+        invokeDirectly(handler, target, arguments);
+    }, Qt::QueuedConnection);
+}
+
+QVariantList DeviceProxy::takeSensorSamples(const int maxCount)
+{
+    if (!m_handler || m_handler->metaObject()->indexOfMethod("takeSensorSamples(int)") == -1) {
+        return {};
+    }
+
+    // The ring is single consumer and lock free, so no need to go through the handler's thread
+    QVariantList samples;
+    QMetaObject::invokeMethod(m_handler, "takeSensorSamples", Qt::DirectConnection, Q_RETURN_ARG(QVariantList, samples), Q_ARG(int, maxCount));
+    return samples;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <QQmlPropertyMap>
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
+#include <QVariantMap>
+
+#include <atomic>
+#include <memory>
+
+/// Where SnapshotPublisher leaves the properties that changed, for
+/// DeviceProxy to pick up. Only ever one snapshot waiting, newer ones are
+/// merged into it.
+struct SnapshotMailbox {
+    ~SnapshotMailbox() { delete pending.load(); }
+
+    std::atomic<QVariantMap*> pending{nullptr};
+};
+
+/// Lives on the handler's thread, and copies its properties when their
+/// notify signals are emitted, at most once per frame.
+class SnapshotPublisher : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int interval = 16; // ms, about a frame
+
+    SnapshotPublisher(QObject *handler, std::shared_ptr<SnapshotMailbox> mailbox);
+
+    /// Everything, not just what changed
+    void publishAll();
+
+signals:
+    void published();
+
+private slots:
+    void onPropertyChanged();
+    void publish();
+
+private:
+    QVariant read(const int propertyIndex) const;
+
+    QObject *m_handler;
+    std::shared_ptr<SnapshotMailbox> m_mailbox;
+
+    QHash<int, QVector<int>> m_notifiers; // signal index -> property indices
+    QSet<int> m_dirty;
+    QTimer m_timer;
+};
+
+/// What QML gets instead of a robot handler, which lives on its own thread
+/// (see IoThread). Reading properties never touches the handler, they are
+/// copied from the snapshots SnapshotPublisher hands over. Writes and call()
+/// are queued to the handler's thread. Sensor samples are the exception,
+/// they are popped straight from the handler's lock free ring.
+class DeviceProxy : public QQmlPropertyMap
+{
+    Q_OBJECT
+
+public:
+    explicit DeviceProxy(QObject *handler, QObject *parent = nullptr);
+
+    QObject *handler() const { return m_handler; }
+
+    /// Stops talking to the handler, before it is deleted
+    void detach() { m_handler = nullptr; }
+
+    /// Queues a call to a slot or Q_INVOKABLE on the handler, never waits for it
+    Q_INVOKABLE void call(const QString &method, const QVariant &argument1 = QVariant(), const QVariant &argument2 = QVariant());
+
+    /// Batch of samples from the handler's sensor stream (empty if it has none),
+    /// oldest first. Read until empty when sensorSamplesAvailable() is emitted.
+    Q_INVOKABLE QVariantList takeSensorSamples(const int maxCount = 64);
+
+signals:
+    void updated(const QStringList &keys);
+    void sensorSamplesAvailable();
+
+protected:
+    QVariant updateValue(const QString &key, const QVariant &input) override;
+
+private slots:
+    void takeSnapshot();
+
+private:
+    QObject *m_handler;
+    std::shared_ptr<SnapshotMailbox> m_mailbox;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <QThread>
+
+#include <utility>
+
+/// Each robot's handler, transport and decoders run on one of these, so a
+/// heavy QML frame can't delay a brake(), and a sensor burst can't stutter
+/// the UI or the other robots. QML only sees them through a DeviceProxy.
+/// Stops and deletes itself when the object created by create() is destroyed.
+class IoThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit IoThread(const QString &name, QObject *parent = nullptr) : QThread(parent) {
+        setObjectName(name);
+
+        m_context = new QObject;
+        m_context->moveToThread(this);
+        connect(this, &QThread::finished, m_context, &QObject::deleteLater);
+
+        start();
+    }
+
+    ~IoThread() {
+        quit();
+        wait();
+    }
+
+    /// Runs it on the thread, and waits for it to finish
+    template<typename FUNCTION> void invoke(FUNCTION &&function) {
+        QMetaObject::invokeMethod(m_context, std::forward<FUNCTION>(function), Qt::BlockingQueuedConnection);
+    }
+
+    /// Everything the factory creates belongs to the thread
+    template<typename FACTORY> QObject *create(FACTORY &&factory) {
+        QObject *object = nullptr;
+        invoke([&]() { object = factory(); });
+        if (!object) {
+            return nullptr;
+        }
+
+        // Direct, quit() is thread safe and it is our event loop anyways
+        connect(object, &QObject::destroyed, this, &QThread::quit, Qt::DirectConnection);
+        connect(this, &QThread::finished, this, &QObject::deleteLater);
+        return object;
+    }
+
+private:
+    QObject *m_context;
+};
@@ -0,0 +1,75 @@
+#include "KnownRobots.h"
+
+#include <QBluetoothAddress>
+#include <QSettings>
+#include <QDebug>
+
+void KnownRobots::load()
+{
+    m_robots.clear();
+
+    QSettings settings;
+    const int count = settings.beginReadArray("knownRobots");
+    for (int i=0; i<count && i<maxCount; i++) {
+        settings.setArrayIndex(i);
+
+        Robot robot;
+        robot.address = settings.value("address").toString();
+        robot.deviceType = settings.value("type").toString();
+        robot.name = settings.value("name").toString();
+        robot.rssi = int16_t(settings.value("rssi").toInt());
+        if (robot.address.isEmpty() || robot.deviceType.isEmpty()) {
+            qWarning() << "Invalid known robot" << i << robot.address << robot.deviceType;
+            continue;
+        }
+        m_robots.append(robot);
+    }
+    settings.endArray();
+}
+
+const KnownRobots::Robot *KnownRobots::find(const QString &address) const
+{
+    for (const Robot &robot : m_robots) {
+        if (robot.address == address) {
+            return &robot;
+        }
+    }
+    return nullptr;
+}
+
+void KnownRobots::remember(const Robot &robot)
+{
+    for (int i=0; i<m_robots.count(); i++) {
+        if (m_robots[i].address == robot.address) {
+            m_robots.remove(i);
+            break;
+        }
+    }
+    m_robots.prepend(robot);
+    if (m_robots.count() > maxCount) {
+        m_robots.resize(maxCount);
+    }
+    save();
+}
+
+QBluetoothDeviceInfo KnownRobots::deviceInfo(const Robot &robot)
+{
+    QBluetoothDeviceInfo info(QBluetoothAddress(robot.address), robot.name, 0);
+    info.setCoreConfigurations(QBluetoothDeviceInfo::LowEnergyCoreConfiguration);
+    info.setRssi(robot.rssi);
+    return info;
+}
+
+void KnownRobots::save() const
+{
+    QSettings settings;
+    settings.beginWriteArray("knownRobots", m_robots.count());
+    for (int i=0; i<m_robots.count(); i++) {
+        settings.setArrayIndex(i);
+        settings.setValue("address", m_robots[i].address);
+        settings.setValue("type", m_robots[i].deviceType);
+        settings.setValue("name", m_robots[i].name);
+        settings.setValue("rssi", m_robots[i].rssi);
+    }
+    settings.endArray();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <QBluetoothDeviceInfo>
+#include <QString>
+#include <QVector>
+
+#include <cstdint>
+
+/// Robots we have connected to before, stored with QSettings, so we can connect
+/// straight to them by address instead of scanning and waiting for an advert.
+class KnownRobots
+{
+public:
+    static constexpr int maxCount = 8;
+
+    struct Robot {
+        QString address;
+        QString deviceType; // same as the handlers' deviceType()
+        QString name; // as advertised, the Sphero handler needs it for the type
+        int16_t rssi = 0; // when we last saw it
+    };
+
+    void load();
+
+    /// Most recently used first
+    const QVector<Robot> &robots() const { return m_robots; }
+    const Robot *find(const QString &address) const;
+    bool contains(const QString &address) const { return find(address) != nullptr; }
+
+    /// Moves it to the front, and forgets the oldest ones
+    void remember(const Robot &robot);
+
+    /// Good enough for QLowEnergyController::createCentral()
+    static QBluetoothDeviceInfo deviceInfo(const Robot &robot);
+
+private:
+    void save() const;
+
+    QVector<Robot> m_robots;
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <QDebug>
+#include <QFile>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+#include <QVariantMap>
+#include <QtAlgorithms>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+
+/// Fixed size histogram of latencies, with log spaced buckets (eight per
+/// power of two, so within ~12%), from 1 µs to several hours.
+class LatencyHistogram
+{
+public:
+    static constexpr int SubBuckets = 8;
+    static constexpr int MaxOctave = 34; // 2^35 µs is about 9.5 hours
+    static constexpr int BucketCount = (MaxOctave - 2) * SubBuckets + SubBuckets;
+
+    void record(const int64_t nanoseconds) {
+        const uint64_t microseconds = uint64_t(qMax<int64_t>(nanoseconds, 0)) / 1000;
+        m_counts[bucketFor(microseconds)]++;
+        m_count++;
+        m_max = qMax(m_max, nanoseconds);
+    }
+
+    uint64_t count() const { return m_count; }
+    int64_t max() const { return m_max; }
+
+    /// In nanoseconds, the upper bound of the bucket it is in (but never more than the max)
+    int64_t percentile(const double fraction) const {
+        if (!m_count) {
+            return 0;
+        }
+        const uint64_t target = qMax<uint64_t>(1, uint64_t(fraction * m_count + 0.5));
+        uint64_t seen = 0;
+        for (int bucket=0; bucket<BucketCount; bucket++) {
+            seen += m_counts[bucket];
+            if (seen >= target) {
+                return qMin(int64_t(lowerBound(bucket + 1)) * 1000, m_max);
+            }
+        }
+        return m_max;
+    }
+
+    void clear() {
+        m_counts.fill(0);
+        m_count = 0;
+        m_max = 0;
+    }
+
+    /// Bucket for a value in µs, values from lowerBound(bucket) up to lowerBound(bucket + 1) go in it
+    static int bucketFor(uint64_t value) {
+        // Linear for the first few, they would otherwise be less than one apart
+        if (value < SubBuckets) {
+            return int(value);
+        }
+        value = qMin<uint64_t>(value, (uint64_t(1) << (MaxOctave + 1)) - 1);
+        const int octave = 63 - qCountLeadingZeroBits(quint64(value));
+        const int subBucket = int(value >> (octave - 3)) & (SubBuckets - 1);
+        return (octave - 2) * SubBuckets + subBucket;
+    }
+
+    static uint64_t lowerBound(const int bucket) {
+        if (bucket < SubBuckets) {
+            return uint64_t(bucket);
+        }
+        const int octave = bucket / SubBuckets + 2;
+        return uint64_t(SubBuckets + bucket % SubBuckets) << (octave - 3);
+    }
+
+private:
+    std::array<uint32_t, BucketCount> m_counts{};
+    uint64_t m_count = 0;
+    int64_t m_max = 0;
+};
+
+/// A LatencyHistogram per command, keyed by (device id << 8 | command id)
+/// or whatever else makes sense for the robot.
+class LatencyStats
+{
+public:
+    using NameFunction = std::function<QString(uint16_t)>;
+
+    void record(const uint16_t command, const int64_t nanoseconds) {
+        m_histograms[command].record(nanoseconds);
+    }
+
+    void clear() { m_histograms.clear(); }
+    bool isEmpty() const { return m_histograms.isEmpty(); }
+
+    /// Milliseconds, for QML: { name: { count, p50, p90, p99, max } }
+    QVariantMap toVariantMap(const NameFunction &name) const {
+        QVariantMap ret;
+        for (QHash<uint16_t, LatencyHistogram>::const_iterator it = m_histograms.constBegin(); it != m_histograms.constEnd(); ++it) {
+            const LatencyHistogram &histogram = it.value();
+            QVariantMap entry;
+            entry[QStringLiteral("count")] = qulonglong(histogram.count());
+            entry[QStringLiteral("p50")] = histogram.percentile(0.5) / 1000000.;
+            entry[QStringLiteral("p90")] = histogram.percentile(0.9) / 1000000.;
+            entry[QStringLiteral("p99")] = histogram.percentile(0.99) / 1000000.;
+            entry[QStringLiteral("max")] = histogram.max() / 1000000.;
+            ret[name(it.key())] = entry;
+        }
+        return ret;
+    }
+
+    QString toString(const NameFunction &name) const {
+        QStringList lines;
+        for (QHash<uint16_t, LatencyHistogram>::const_iterator it = m_histograms.constBegin(); it != m_histograms.constEnd(); ++it) {
+            const LatencyHistogram &histogram = it.value();
+            lines.append(QStringLiteral("%1 count %2 p50 %3 ms p90 %4 ms p99 %5 ms max %6 ms")
+                    .arg(name(it.key()), -40)
+                    .arg(histogram.count())
+                    .arg(histogram.percentile(0.5) / 1000000., 0, 'f', 2)
+                    .arg(histogram.percentile(0.9) / 1000000., 0, 'f', 2)
+                    .arg(histogram.percentile(0.99) / 1000000., 0, 'f', 2)
+                    .arg(histogram.max() / 1000000., 0, 'f', 2));
+        }
+        lines.sort();
+        return lines.join(QLatin1Char('\n'));
+    }
+
+    /// Appends, with a header line, so several dumps can go to the same file
+    bool dump(const QString &path, const QString &header, const NameFunction &name) const {
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+            qWarning() << "Failed to open" << path << file.errorString();
+            return false;
+        }
+        QTextStream stream(&file);
+        stream << header << '\n' << toString(name) << "\n\n";
+        return stream.status() == QTextStream::Ok;
+    }
+
+private:
+    QHash<uint16_t, LatencyHistogram> m_histograms;
+};
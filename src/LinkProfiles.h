@@ -0,0 +1,190 @@
+#pragma once
+
+#include "Transport.h"
+#include "Logging.h"
+
+#include <QtMath>
+#include <QElapsedTimer>
+#include <QLowEnergyConnectionParameters>
+#include <QPointer>
+#include <QTimer>
+
+#include <cstdint>
+#include <functional>
+
+/// Switches the BLE connection parameters with what the robot is doing.
+/// While it is driven we want the shortest connection interval and no
+/// slave latency, so a new setpoint goes out at the next connection event.
+/// When nobody has touched the controls for a while a long interval with
+/// a high slave latency, so a parked robot (and our radio) can sleep.
+/// Only one request is in flight at a time, if the wanted profile changes
+/// in the meantime it is requested when the first is answered.
+class LinkProfiles
+{
+public:
+    enum Profile {
+        None, // whatever the robot and the stack agreed on when connecting
+        Drive,
+        Idle
+    };
+
+    /// How often to send setpoints, about one connection event while driving
+    using PacingCallback = std::function<void(int milliseconds)>;
+
+    struct Stats {
+        Profile profile = None; // the last one negotiated
+        double interval = 0.; // ms, as negotiated
+        int latency = 0;
+        uint32_t requests = 0;
+        uint32_t switches = 0;
+        uint32_t unanswered = 0;
+    };
+
+    static constexpr int defaultIdleTimeout = 5000; // ms without input
+    static constexpr int responseTimeout = 2000; // not all stacks say anything if nothing changed
+
+    LinkProfiles() {
+        m_timer.setInterval(1000);
+        QObject::connect(&m_timer, &QTimer::timeout, &m_timer, [this]() { check(); });
+    }
+
+    // The timer connection captures this
+    LinkProfiles(const LinkProfiles &) = delete;
+    LinkProfiles &operator=(const LinkProfiles &) = delete;
+
+    /// How long without input before switching to the idle profile, short ones are mostly for testing
+    void setIdleTimeout(const int milliseconds) {
+        m_idleTimeout = qMax(1, milliseconds);
+        m_timer.setInterval(qMin(1000, m_idleTimeout));
+    }
+
+    /// Never slower than the drive profile, the first setpoints after a pause
+    /// shouldn't be paced by the idle interval while we switch back
+    void setPacingCallback(PacingCallback callback) { m_pacing = std::move(callback); }
+
+    void setTransport(Transport *transport) {
+        m_transport = transport;
+        QObject::connect(transport, &Transport::connectionUpdated, &m_timer, [this](const QLowEnergyConnectionParameters &parameters) {
+            onConnectionUpdated(parameters);
+        });
+        QObject::connect(transport, &Transport::closed, &m_timer, [this]() { stop(); });
+    }
+
+    /// When the robot is ready, goes idle if nothing happens
+    void start() {
+        m_lastActivity.start();
+        m_timer.start();
+    }
+
+    void stop() {
+        m_timer.stop();
+        m_wanted = None;
+        m_requested = None;
+    }
+
+    /// Called for every setpoint, so it has to be cheap
+    void onActivity() {
+        m_lastActivity.restart();
+        if (m_wanted != Drive && m_timer.isActive()) {
+            request(Drive);
+        }
+    }
+
+    const Stats &stats() const { return m_stats; }
+
+    static QLowEnergyConnectionParameters parameters(const Profile profile) {
+        QLowEnergyConnectionParameters parameters;
+        switch(profile) {
+        case Drive:
+            parameters.setIntervalRange(7.5, 15.);
+            parameters.setLatency(0);
+            parameters.setSupervisionTimeout(2000);
+            break;
+        case Idle:
+            // Has to be more than (1 + latency) * max interval * 2
+            parameters.setIntervalRange(100., 200.);
+            parameters.setLatency(4);
+            parameters.setSupervisionTimeout(6000);
+            break;
+        case None:
+            break;
+        }
+        return parameters;
+    }
+
+    static const char *name(const Profile profile) {
+        switch(profile) {
+        case Drive:
+            return "drive";
+        case Idle:
+            return "idle";
+        case None:
+            break;
+        }
+        return "none";
+    }
+
+private:
+    void request(const Profile profile) {
+        m_wanted = profile;
+        if (m_requested != None || !m_transport) {
+            return; // we'll get to it when the pending one is answered
+        }
+
+        if (!m_transport->requestConnectionUpdate(parameters(profile))) {
+            return;
+        }
+        qCDebug(lcLink) << " - Requesting link profile" << name(profile);
+        m_requested = profile;
+        m_requestTimer.start();
+        m_stats.requests++;
+    }
+
+    void onConnectionUpdated(const QLowEnergyConnectionParameters &parameters) {
+        // The robot can also ask for something else on its own
+        const Profile profile = m_requested != None ? m_requested : m_stats.profile;
+        qCDebug(lcLink) << " - Negotiated link profile" << name(profile) << "interval" << parameters.maximumInterval()
+                 << "ms latency" << parameters.latency() << "supervision timeout" << parameters.supervisionTimeout();
+
+        if (profile != m_stats.profile) {
+            m_stats.switches++;
+        }
+        m_stats.profile = profile;
+        m_stats.interval = parameters.maximumInterval();
+        m_stats.latency = parameters.latency();
+
+        if (m_pacing) {
+            m_pacing(qMin(qCeil(parameters.maximumInterval()), qCeil(LinkProfiles::parameters(Drive).maximumInterval())));
+        }
+
+        m_requested = None;
+        if (m_wanted != None && m_wanted != profile) {
+            request(m_wanted);
+        }
+    }
+
+    void check() {
+        // Not retried, if the stack doesn't support it we would just spam it
+        if (m_requested != None && m_requestTimer.elapsed() > responseTimeout) {
+            qCDebug(lcLink) << " ! No answer to link profile" << name(m_requested);
+            m_stats.unanswered++;
+            m_requested = None;
+        }
+
+        if (m_wanted != Idle && m_lastActivity.elapsed() > m_idleTimeout) {
+            request(Idle);
+        }
+    }
+
+    QPointer<Transport> m_transport;
+    PacingCallback m_pacing;
+
+    Profile m_wanted = None;
+    Profile m_requested = None; // in flight
+    QElapsedTimer m_requestTimer;
+    QElapsedTimer m_lastActivity;
+    QTimer m_timer;
+    int m_idleTimeout = defaultIdleTimeout;
+
+    Stats m_stats;
+};
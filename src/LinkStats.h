@@ -0,0 +1,104 @@
+#pragma once
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVariantMap>
+
+#include <cstdint>
+#include <functional>
+
+/// Counters for one link to a robot, cheap enough to always be on so there
+/// are numbers when a session goes bad. Only the traffic counters and the
+/// frame types are updated per packet, the rest is copied from the decoders,
+/// request tracker and transmit queue when a snapshot is taken.
+struct LinkStats
+{
+    using NameFunction = std::function<QString(uint16_t)>;
+
+    // Bumped for every notification and write, so keep them in one cache line
+    struct alignas(64) Traffic {
+        uint64_t bytesIn = 0;
+        uint64_t bytesOut = 0;
+        uint32_t notifications = 0; // a frame can be split over several
+        uint32_t framesIn = 0; // with a valid checksum
+        uint32_t framesOut = 0; // every write is one whole frame
+    };
+    Traffic traffic;
+
+    uint32_t checksumErrors = 0;
+    uint32_t escapeErrors = 0;
+    uint32_t resyncs = 0;
+    uint32_t overflows = 0;
+    uint32_t droppedBytes = 0;
+    uint32_t invalidFrames = 0; // valid checksum, but too short, wrong size or unknown type
+
+    uint32_t writeFailures = 0;
+    uint32_t droppedWrites = 0; // by the transmit queue, when full
+    uint32_t timeouts = 0; // requests that never got a response
+    uint32_t unexpectedResponses = 0;
+
+    QHash<uint16_t, uint32_t> frameTypes; // received, keyed like DecodeStats
+
+    // From LinkProfiles
+    QString linkProfile;
+    double connectionInterval = 0.; // ms, 0 if nothing was negotiated
+    int connectionLatency = 0;
+    uint32_t profileSwitches = 0;
+
+    void reset() { *this = LinkStats(); }
+
+    /// For QML, frame types are in "types" by name
+    QVariantMap toVariantMap(const NameFunction &name) const {
+        QVariantMap ret;
+        ret[QStringLiteral("bytesIn")] = qulonglong(traffic.bytesIn);
+        ret[QStringLiteral("bytesOut")] = qulonglong(traffic.bytesOut);
+        ret[QStringLiteral("notifications")] = traffic.notifications;
+        ret[QStringLiteral("framesIn")] = traffic.framesIn;
+        ret[QStringLiteral("framesOut")] = traffic.framesOut;
+        ret[QStringLiteral("checksumErrors")] = checksumErrors;
+        ret[QStringLiteral("escapeErrors")] = escapeErrors;
+        ret[QStringLiteral("resyncs")] = resyncs;
+        ret[QStringLiteral("overflows")] = overflows;
+        ret[QStringLiteral("droppedBytes")] = droppedBytes;
+        ret[QStringLiteral("invalidFrames")] = invalidFrames;
+        ret[QStringLiteral("writeFailures")] = writeFailures;
+        ret[QStringLiteral("droppedWrites")] = droppedWrites;
+        ret[QStringLiteral("timeouts")] = timeouts;
+        ret[QStringLiteral("unexpectedResponses")] = unexpectedResponses;
+        ret[QStringLiteral("linkProfile")] = linkProfile;
+        ret[QStringLiteral("connectionInterval")] = connectionInterval;
+        ret[QStringLiteral("connectionLatency")] = connectionLatency;
+        ret[QStringLiteral("profileSwitches")] = profileSwitches;
+
+        QVariantMap types;
+        for (QHash<uint16_t, uint32_t>::const_iterator it = frameTypes.constBegin(); it != frameTypes.constEnd(); ++it) {
+            types[name(it.key())] = it.value();
+        }
+        ret[QStringLiteral("types")] = types;
+        return ret;
+    }
+
+    /// One line of totals, and one per frame type
+    QString toString(const NameFunction &name) const {
+        QStringList lines;
+        lines.append(QStringLiteral("in %1 bytes %2 notifications %3 frames, out %4 bytes %5 frames, "
+                    "checksum %6 escape %7 resyncs %8 overflows %9 dropped bytes %10 invalid %11, "
+                    "write failures %12 dropped writes %13 timeouts %14 unexpected %15")
+                .arg(traffic.bytesIn).arg(traffic.notifications).arg(traffic.framesIn)
+                .arg(traffic.bytesOut).arg(traffic.framesOut)
+                .arg(checksumErrors).arg(escapeErrors).arg(resyncs).arg(overflows).arg(droppedBytes).arg(invalidFrames)
+                .arg(writeFailures).arg(droppedWrites).arg(timeouts).arg(unexpectedResponses));
+        lines.append(QStringLiteral("link profile %1, interval %2 ms latency %3, %4 switches")
+                .arg(linkProfile).arg(connectionInterval).arg(connectionLatency).arg(profileSwitches));
+
+        QStringList types;
+        for (QHash<uint16_t, uint32_t>::const_iterator it = frameTypes.constBegin(); it != frameTypes.constEnd(); ++it) {
+            types.append(QStringLiteral("  %1: %2").arg(name(it.key()), -32).arg(it.value()));
+        }
+        types.sort();
+        lines.append(types);
+
+        return lines.join(QLatin1Char('\n'));
+    }
+};
@@ -0,0 +1,10 @@
+#include "Logging.h"
+
+Q_LOGGING_CATEGORY(lcSpheroTx, "sphero.tx", QtInfoMsg)
+Q_LOGGING_CATEGORY(lcSpheroRx, "sphero.rx", QtInfoMsg)
+Q_LOGGING_CATEGORY(lcMousrTx, "mousr.tx", QtInfoMsg)
+Q_LOGGING_CATEGORY(lcMousrRx, "mousr.rx", QtInfoMsg)
+Q_LOGGING_CATEGORY(lcLinkStats, "robot.stats", QtWarningMsg)
+Q_LOGGING_CATEGORY(lcLoad, "robot.load", QtWarningMsg)
+Q_LOGGING_CATEGORY(lcConnect, "robot.connect", QtInfoMsg)
+Q_LOGGING_CATEGORY(lcLink, "robot.link", QtInfoMsg)
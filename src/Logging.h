@@ -0,0 +1,55 @@
+#pragma once
+
+#include <QLoggingCategory>
+#include <QDebug>
+
+// Per packet tracing, off by default since it is at joystick/sensor rate.
+// Enable with e. g. QT_LOGGING_RULES="sphero.tx.debug=true;mousr.*.debug=true"
+Q_DECLARE_LOGGING_CATEGORY(lcSpheroTx)
+Q_DECLARE_LOGGING_CATEGORY(lcSpheroRx)
+Q_DECLARE_LOGGING_CATEGORY(lcMousrTx)
+Q_DECLARE_LOGGING_CATEGORY(lcMousrRx)
+
+// Periodic link statistics, off by default, enable with "robot.stats.info=true"
+Q_DECLARE_LOGGING_CATEGORY(lcLinkStats)
+
+// Time the GUI thread spends handling events, enable with "robot.load.info=true"
+Q_DECLARE_LOGGING_CATEGORY(lcLoad)
+
+// When each step of connecting to a robot ran, the per step lines are "robot.connect.debug=true"
+Q_DECLARE_LOGGING_CATEGORY(lcConnect)
+
+// Connection parameter profile switches, enable with "robot.link.debug=true"
+Q_DECLARE_LOGGING_CATEGORY(lcLink)
+
+/// Like qCDebug(), so the arguments are only evaluated if the category is
+/// enabled, but compiled out completely in release builds.
+#ifndef NDEBUG
+#define TRACE(category) qCDebug(category)
+#else
+#define TRACE(category) while (false) QMessageLogger().noDebug()
+#endif
+
+/// Formats as colon separated hex only when actually printed, so it doesn't
+/// allocate like QByteArray::toHex().
+struct HexDump {
+    HexDump(const char *data, const int size) : data(data), size(size) {}
+    explicit HexDump(const QByteArray &bytes) : data(bytes.constData()), size(bytes.size()) {}
+
+    const char *data;
+    int size;
+};
+
+inline QDebug operator<<(QDebug debug, const HexDump &hex)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    QDebugStateSaver saver(debug);
+    debug.nospace().noquote();
+    for (int i=0; i<hex.size; i++) {
+        const uint8_t byte = uint8_t(hex.data[i]);
+        const char text[4] = { digits[byte >> 4], digits[byte & 0xF], i + 1 < hex.size ? ':' : '\0', '\0' };
+        debug << text;
+    }
+    return debug;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QTimer>
+
+#include <cstdint>
+#include <functional>
+
+/// For setpoints where only the latest value matters (speed, heading).
+/// Keeps at most one frame waiting, and writes at most one frame per
+/// minimum interval (about one connection event), so if the link slows down
+/// newer setpoints replace the waiting one instead of queueing up.
+class MotionWriter
+{
+public:
+    using Writer = std::function<void(const QByteArray &)>;
+
+    struct Stats {
+        uint32_t written = 0;
+        uint32_t coalesced = 0; // replaced before they were written
+    };
+
+    MotionWriter() {
+        m_timer.setSingleShot(true);
+        QObject::connect(&m_timer, &QTimer::timeout, &m_timer, [this]() { flush(); });
+    }
+
+    // The timer connection captures this
+    MotionWriter(const MotionWriter &) = delete;
+    MotionWriter &operator=(const MotionWriter &) = delete;
+
+    void setWriter(Writer writer) { m_write = std::move(writer); }
+    void setMinimumInterval(const int milliseconds) { m_minimumInterval = qMax(0, milliseconds); }
+
+    void write(const QByteArray &frame) {
+        if (!m_pending.isEmpty()) {
+            m_stats.coalesced++;
+        }
+        m_pending = frame;
+
+        if (m_timer.isActive()) {
+            return;
+        }
+
+        const qint64 elapsed = m_lastWrite.isValid() ? m_lastWrite.elapsed() : m_minimumInterval;
+        if (elapsed >= m_minimumInterval) {
+            flush();
+        } else {
+            m_timer.start(int(m_minimumInterval - elapsed));
+        }
+    }
+
+    /// Drops whatever is waiting, e. g. before sending a stop through the reliable path
+    void clear() {
+        m_pending.clear();
+        m_timer.stop();
+    }
+
+    const Stats &stats() const { return m_stats; }
+
+private:
+    void flush() {
+        if (m_pending.isEmpty()) {
+            return;
+        }
+        const QByteArray frame = m_pending;
+        m_pending.clear();
+
+        m_lastWrite.start();
+        m_stats.written++;
+
+        if (m_write) {
+            m_write(frame);
+        }
+    }
+
+    QTimer m_timer;
+    QElapsedTimer m_lastWrite;
+    QByteArray m_pending;
+
+    Writer m_write;
+    int m_minimumInterval = 20; // ms
+
+    Stats m_stats;
+};
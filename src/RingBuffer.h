@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/// Lock free ring buffer for one producer and one consumer thread.
+/// When full new values are dropped (and counted), the consumer is expected
+/// to drain it in batches.
+template<typename T, size_t SIZE>
+class SpscRingBuffer
+{
+    static_assert(SIZE && (SIZE & (SIZE - 1)) == 0, "Size needs to be a power of two");
+
+public:
+    static constexpr size_t capacity() { return SIZE; }
+
+    /// Producer side
+    bool push(const T &value) {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        const size_t tail = m_tail.load(std::memory_order_acquire);
+        if (head - tail >= SIZE) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        m_buffer[head & (SIZE - 1)] = value;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Consumer side, returns the number of values copied to out
+    size_t pop(T *out, const size_t maxCount) {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        const size_t head = m_head.load(std::memory_order_acquire);
+        const size_t count = std::min(head - tail, maxCount);
+
+        for (size_t i=0; i<count; i++) {
+            out[i] = m_buffer[(tail + i) & (SIZE - 1)];
+        }
+
+        m_tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    size_t size() const {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+
+    bool isEmpty() const { return size() == 0; }
+
+    uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    // Separate cache lines so the two sides don't fight over them
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+    alignas(64) std::atomic<uint64_t> m_dropped{0};
+
+    std::array<T, SIZE> m_buffer{};
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "BasicTypes.h"
+#include "SeqLock.h"
+
+#include <cstdint>
+#include <type_traits>
+
+/// What a handler knows about its robot, in one place, so it can be read
+/// consistently and from other threads without going through the properties.
+/// Fields a robot doesn't have stay at their defaults.
+struct RobotState
+{
+    enum Flag : uint32_t {
+        Connected = 1 << 0,
+        Charging = 1 << 1,
+        BatteryLow = 1 << 2,
+        FullyCharged = 1 << 3,
+        Flipped = 1 << 4,
+        AutoRunning = 1 << 5,
+        Stuck = 1 << 6,
+        SensorDirty = 1 << 7,
+    };
+
+    bool has(const Flag flag) const { return flags & flag; }
+    void set(const Flag flag, const bool on) { flags = on ? (flags | flag) : (flags & ~uint32_t(flag)); }
+
+    uint64_t version = 0; // bumped every time it is published
+    int64_t timestamp = 0; // nanoseconds, monotonic
+
+    Orientation<float> orientation{}; // degrees
+    float tailRotation = 0.f; // degrees
+
+    float speed = 0.f; // what we last asked for, 0 to 1
+    float heading = 0.f; // degrees
+
+    int voltage = -1; // percent, -1 if the robot doesn't report it
+    uint32_t color = 0; // 0xRRGGBB
+    uint32_t flags = 0;
+};
+static_assert(std::is_trivially_copyable<RobotState>::value, "Needs to be published through a SeqLock");
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/// Lock free publishing of a small plain struct, for one writer thread and any
+/// number of reader threads. Readers never block the writer, they retry if it
+/// was written to while they were copying it.
+/// The value is kept in atomic words, so the copying isn't a data race.
+template<typename T>
+class SeqLock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Needs to be copied with memcpy");
+
+    static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+public:
+    /// Writer side
+    void store(const T &value) {
+        uint64_t words[WORDS] = {};
+        std::memcpy(words, &value, sizeof(T));
+
+        // Odd while writing
+        const uint64_t sequence = m_sequence.load(std::memory_order_relaxed);
+        m_sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (size_t i=0; i<WORDS; i++) {
+            m_words[i].store(words[i], std::memory_order_relaxed);
+        }
+
+        m_sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    /// Any thread
+    T load() const {
+        uint64_t words[WORDS];
+        uint64_t before, after;
+        do {
+            before = m_sequence.load(std::memory_order_acquire);
+            for (size_t i=0; i<WORDS; i++) {
+                words[i] = m_words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = m_sequence.load(std::memory_order_relaxed);
+        } while (before != after || (before & 1));
+
+        T value;
+        std::memcpy(&value, words, sizeof(T));
+        return value;
+    }
+
+    /// How many times it has been stored, to check for changes without copying
+    uint64_t version() const { return m_sequence.load(std::memory_order_acquire) / 2; }
+
+private:
+    alignas(64) std::atomic<uint64_t> m_sequence{0};
+    std::atomic<uint64_t> m_words[WORDS] = {};
+};
@@ -0,0 +1,37 @@
+#include "ServiceChangedWatcher.h"
+
+#include <QLowEnergyController>
+#include <QLowEnergyService>
+#include <QDebug>
+
+void ServiceChangedWatcher::watch(QLowEnergyController *controller)
+{
+    if (m_genericService || !controller->services().contains(QBluetoothUuid(QBluetoothUuid::GenericAttribute))) {
+        return;
+    }
+    m_genericService = controller->createServiceObject(QBluetoothUuid::GenericAttribute, this);
+    if (!m_genericService) {
+        return;
+    }
+
+    connect(m_genericService, &QLowEnergyService::stateChanged, this, [this](const QLowEnergyService::ServiceState state) {
+        if (state != QLowEnergyService::ServiceDiscovered) {
+            return;
+        }
+        const QLowEnergyCharacteristic serviceChanged = m_genericService->characteristic(QBluetoothUuid::ServiceChanged);
+        const QLowEnergyDescriptor cccd = serviceChanged.descriptor(QBluetoothUuid::ClientCharacteristicConfiguration);
+        if (!cccd.isValid()) {
+            qDebug() << " - No service changed characteristic";
+            return;
+        }
+        m_genericService->writeDescriptor(cccd, QByteArray::fromHex("0200")); // indications
+    });
+    connect(m_genericService, &QLowEnergyService::characteristicChanged, this, [this](const QLowEnergyCharacteristic &characteristic) {
+        if (characteristic.uuid() != QBluetoothUuid(QBluetoothUuid::ServiceChanged)) {
+            return;
+        }
+        qWarning() << " ! Robot says its services changed, reconnect if it stops responding";
+    });
+
+    m_genericService->discoverDetails();
+}
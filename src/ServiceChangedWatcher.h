@@ -0,0 +1,25 @@
+#pragma once
+
+#include <QObject>
+#include <QPointer>
+
+class QLowEnergyController;
+class QLowEnergyService;
+
+/// Subscribes to the GATT "service changed" indication, so we at least hear
+/// about it when a robot's layout changes under us (e. g. after a firmware
+/// update) instead of wondering why writes go nowhere.
+class ServiceChangedWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ServiceChangedWatcher(QObject *parent) : QObject(parent) {}
+
+    /// Only if the robot has the Generic Attribute service.
+    /// Do it after we are ready, so it doesn't slow down connecting.
+    void watch(QLowEnergyController *controller);
+
+private:
+    QPointer<QLowEnergyService> m_genericService;
+};
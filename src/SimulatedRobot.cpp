@@ -0,0 +1,762 @@
+#include "SimulatedRobot.h"
+
+#include "sphero/Uuids.h"
+#include "sphero/v1/CommandPackets.h"
+#include "sphero/v1/ResponsePackets.h"
+#include "sphero/v1/SensorStream.h"
+#include "sphero/v2/Packets.h"
+#include "sphero/v2/SensorStream.h"
+#include "mousr/Uuids.h"
+
+#include <QDebug>
+#include <QtEndian>
+#include <QtMath>
+
+namespace {
+
+// Same as in MousrHandler
+namespace MousrCommand {
+enum : uint16_t {
+    Stop = 0,
+    Move = 2,
+    ConfigAutoMode = 15,
+    InitializeDevice = 28,
+};
+} // namespace MousrCommand
+
+namespace MousrResponse {
+enum : uint8_t {
+    AutoModeChanged = 15,
+    FirmwareVersion = 28,
+    DeviceOrientation = 48,
+    BatteryVoltage = 98,
+    RobotStopped = 99,
+    CommandCompleted = 255,
+};
+} // namespace MousrResponse
+
+static constexpr int MousrCommandSize = 15;
+static constexpr int MousrResponseSize = 20;
+
+static constexpr float MaxSpeed = 200.f; // cm/s, at speed 255
+
+template<typename T>
+void appendBigEndian(QByteArray *data, const T value)
+{
+    char buffer[sizeof(T)];
+    qToBigEndian(value, buffer);
+    data->append(buffer, int(sizeof(T)));
+}
+
+template<typename T>
+void appendRaw(QByteArray *data, const T value)
+{
+    data->append(reinterpret_cast<const char*>(&value), int(sizeof(T)));
+}
+
+} // namespace
+
+SimulatedRobot::SimulatedRobot(const Protocol protocol, QObject *parent) :
+    Transport(parent),
+    m_protocol(protocol)
+{
+    m_clock.start();
+
+    m_deliveryTimer.setSingleShot(true);
+    connect(&m_deliveryTimer, &QTimer::timeout, this, &SimulatedRobot::deliver);
+
+    connect(&m_sensorTimer, &QTimer::timeout, this, &SimulatedRobot::onSensorTimer);
+
+    switch(m_protocol) {
+    case SpheroV1:
+        break;
+    case SpheroV2:
+        m_batteryVoltage = 4.f;
+        break;
+    case Mousr:
+        // Streams by itself, not that fast
+        m_maxSensorRate = 10;
+        m_batteryVoltage = 4.f;
+        break;
+    }
+}
+
+QString SimulatedRobot::name() const
+{
+    switch(m_protocol) {
+    case SpheroV1:
+        return QStringLiteral("BB-0000");
+    case SpheroV2:
+        return QStringLiteral("SM-0000");
+    case Mousr:
+        return QStringLiteral("Mousr");
+    }
+    return QString();
+}
+
+void SimulatedRobot::close()
+{
+    if (!m_open) {
+        return;
+    }
+    m_open = false;
+    m_sensorTimer.stop();
+    m_deliveryTimer.stop();
+    m_events.clear();
+    emit closed();
+}
+
+bool SimulatedRobot::canWriteWithoutResponse(const QBluetoothUuid &characteristic) const
+{
+    switch(m_protocol) {
+    case SpheroV1:
+        return characteristic == sphero::Characteristics::Main::V1::commands;
+    case SpheroV2:
+        return characteristic == sphero::Characteristics::Main::V2::commands;
+    case Mousr:
+        return characteristic == mousr::Characteristics::write;
+    }
+    return false;
+}
+
+bool SimulatedRobot::requestConnectionUpdate(const QLowEnergyConnectionParameters &parameters)
+{
+    if (!m_open) {
+        return false;
+    }
+    m_stats.connectionUpdates++;
+
+    const double interval = qMax(parameters.minimumInterval(), m_minConnectionInterval);
+    QLowEnergyConnectionParameters negotiated;
+    negotiated.setIntervalRange(interval, interval);
+    negotiated.setLatency(parameters.latency());
+    negotiated.setSupervisionTimeout(parameters.supervisionTimeout());
+    m_connectionParameters = negotiated;
+
+    qDebug() << " - Simulated robot negotiated interval" << interval << "ms latency" << negotiated.latency();
+
+    // Takes a few connection events in reality, the latency is close enough
+    QTimer::singleShot(m_latency, this, [this, negotiated]() {
+        if (m_open) {
+            emit connectionUpdated(negotiated);
+        }
+    });
+    return true;
+}
+
+void SimulatedRobot::writeCharacteristic(const QBluetoothUuid &characteristic, const QByteArray &data, const QLowEnergyService::WriteMode mode)
+{
+    if (!m_open) {
+        qWarning() << "Simulated robot closed, can't write";
+        failWrite(characteristic, mode);
+        return;
+    }
+
+    m_stats.writes++;
+    m_stats.bytesWritten += uint64_t(data.size());
+
+    if (mode == QLowEnergyService::WriteWithResponse) {
+        schedule({0, false, characteristic, {}});
+    }
+
+    switch(m_protocol) {
+    case SpheroV1:
+        if (characteristic == sphero::Characteristics::Main::V1::commands) {
+            handleCommandV1(data);
+        }
+        break;
+    case SpheroV2:
+        if (characteristic == sphero::Characteristics::Main::V2::commands) {
+            m_decoderV2.feed(data.constData(), data.size(), [this](const sphero::v2::FrameDecoder::Frame &frame) {
+                handleCommandV2(frame);
+            });
+        }
+        break;
+    case Mousr:
+        if (characteristic == mousr::Characteristics::write) {
+            handleCommandMousr(data);
+        }
+        break;
+    }
+}
+
+void SimulatedRobot::handleCommandV1(const QByteArray &data)
+{
+    using sphero::v1::CommandPacketHeader;
+
+    static constexpr int HeaderSize = int(sizeof(CommandPacketHeader));
+
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(data.constData());
+    int position = 0;
+    while (data.size() - position > HeaderSize) {
+        const uint8_t *frame = bytes + position;
+        const int dataLength = frame[5]; // includes checksum
+        const int frameSize = HeaderSize + dataLength;
+        if (frame[0] != 0xFF || (frame[1] & 0xFE) != 0xFE || dataLength < 1 || data.size() - position < frameSize) {
+            m_stats.invalidCommands++;
+            return;
+        }
+
+        uint8_t checksum = 0;
+        for (int i=2; i<frameSize - 1; i++) {
+            checksum += frame[i];
+        }
+        if (uint8_t(checksum ^ 0xFF) != frame[frameSize - 1]) {
+            m_stats.invalidCommands++;
+            return;
+        }
+        position += frameSize;
+        m_stats.commands++;
+
+        const bool synchronous = frame[1] & CommandPacketHeader::Synchronous;
+        const uint8_t deviceId = frame[2];
+        const uint8_t commandId = frame[3];
+        const uint8_t sequenceNumber = frame[4];
+        const uint8_t *payload = frame + HeaderSize;
+        const int payloadSize = dataLength - 1;
+
+        uint8_t code = sphero::ResponsePacketHeader::Ack;
+        QByteArray contents;
+
+        switch(deviceId) {
+        case CommandPacketHeader::Internal:
+            switch(commandId) {
+            case CommandPacketHeader::GetPwrState: {
+                const uint8_t state = m_batteryVoltage > 7.f ? sphero::PowerStatePacket::BatteryOK : sphero::PowerStatePacket::BatteryLow;
+                contents.append(char(1)); // record version
+                contents.append(char(state));
+                appendBigEndian<uint16_t>(&contents, uint16_t(qRound(m_batteryVoltage * 100)));
+                appendBigEndian<uint16_t>(&contents, 0); // number of charges
+                appendBigEndian<uint16_t>(&contents, uint16_t(m_clock.elapsed() / 1000)); // seconds since charge
+                break;
+            }
+            case CommandPacketHeader::SetPwrNotify:
+                // Only tells when it changes, so just send the current one
+                if (payloadSize > 0 && payload[0]) {
+                    const uint8_t state = m_batteryVoltage > 7.f ? sphero::PowerStatePacket::BatteryOK : sphero::PowerStatePacket::BatteryLow;
+                    notifyV1(sphero::ResponsePacketHeader::PowerNotification, QByteArray(1, char(state)));
+                }
+                break;
+            default: // Ping and the rest
+                break;
+            }
+            break;
+
+        case CommandPacketHeader::HardwareControl:
+            switch(commandId) {
+            case CommandPacketHeader::GetLocatorData:
+                contents.append(char(sphero::LocatorPacket::Calibrated));
+                appendBigEndian<int16_t>(&contents, int16_t(qRound(m_x)));
+                appendBigEndian<int16_t>(&contents, int16_t(qRound(m_y)));
+                appendBigEndian<int16_t>(&contents, 0); // tilt
+                break;
+            case CommandPacketHeader::SetDataStreaming: {
+                // divisor, frames per packet, mask, packet count, and mask2 on newer firmware
+                if (payloadSize < 9) {
+                    code = sphero::ResponsePacketHeader::BadMessageFormat;
+                    break;
+                }
+                const uint16_t divisor = qFromBigEndian<uint16_t>(payload);
+                const uint32_t mask = qFromBigEndian<uint32_t>(payload + 4);
+                const uint8_t count = payload[8];
+                const uint32_t mask2 = payloadSize >= 13 ? qFromBigEndian<uint32_t>(payload + 9) : 0;
+
+                m_sensorSources = (uint64_t(mask) << 32) | mask2;
+                startSensorStream(400 / qMax<int>(1, divisor), count);
+                break;
+            }
+            case CommandPacketHeader::Roll:
+                if (payloadSize < 3) {
+                    code = sphero::ResponsePacketHeader::BadMessageFormat;
+                    break;
+                }
+                m_speed = payload[0] * MaxSpeed / 255.f;
+                m_heading = qFromBigEndian<uint16_t>(payload + 1) % 360;
+                break;
+            default:
+                break;
+            }
+            break;
+
+        default:
+            code = sphero::ResponsePacketHeader::UnknownDeviceId;
+            break;
+        }
+
+        if (synchronous) {
+            respondV1(code, sequenceNumber, contents);
+        }
+    }
+}
+
+void SimulatedRobot::handleCommandV2(const sphero::v2::FrameDecoder::Frame &frame)
+{
+    namespace v2 = sphero::v2;
+
+    v2::Packet header;
+    if (!frame.read(&header)) {
+        m_stats.invalidCommands++;
+        return;
+    }
+    m_stats.commands++;
+
+    const uint8_t *payload = frame.data + sizeof(v2::Packet);
+    const int payloadSize = frame.size - int(sizeof(v2::Packet));
+
+    v2::Packet::Error error = v2::Packet::Error::Success;
+    QByteArray contents;
+
+    switch(header.m_deviceID) {
+    case v2::Packet::PingPong:
+        contents = QByteArray(reinterpret_cast<const char*>(payload), payloadSize);
+        break;
+
+    case v2::Packet::MainSystem:
+        switch(header.m_commandID) {
+        case v2::Power::GetBatteryVoltage:
+            appendBigEndian<uint16_t>(&contents, uint16_t(qRound(m_batteryVoltage * 100)));
+            break;
+        case v2::Power::GetBatteryState:
+            contents.append(char(m_batteryVoltage > 3.5f ? 1 : 2)); // ok or low
+            break;
+        case v2::Power::GetBatteryPercent:
+            contents.append(char(qBound(0, qRound((m_batteryVoltage - 3.3f) * 100 / 0.9f), 100)));
+            break;
+        default:
+            break;
+        }
+        break;
+
+    case v2::Packet::Sensors:
+        switch(header.m_commandID) {
+        case v2::Sensors::SetSensorAppMask: {
+            if (payloadSize < 7) {
+                error = v2::Packet::Error::BadDataLength;
+                break;
+            }
+            const uint16_t interval = qFromBigEndian<uint16_t>(payload);
+            const uint8_t count = payload[2];
+            const uint32_t mask = qFromBigEndian<uint32_t>(payload + 3);
+
+            // Keep the extended part
+            m_sensorSources = (m_sensorSources & 0xFFFFFFFF00000000ull) | mask;
+            startSensorStream(1000 / qMax<int>(1, interval), count);
+            break;
+        }
+        case v2::Sensors::SetSensorAppMaskExtended:
+            if (payloadSize < 4) {
+                error = v2::Packet::Error::BadDataLength;
+                break;
+            }
+            m_sensorSources = (m_sensorSources & 0xFFFFFFFF) | (uint64_t(qFromBigEndian<uint32_t>(payload)) << 32);
+            if (!m_sensorSources) {
+                m_sensorTimer.stop();
+            }
+            break;
+        case v2::Sensors::GetSensorAppMask:
+            appendBigEndian<uint32_t>(&contents, uint32_t(m_sensorSources & 0xFFFFFFFF));
+            break;
+        case v2::Sensors::ResetLocator:
+            m_x = m_y = 0.f;
+            break;
+        default:
+            break;
+        }
+        break;
+
+    case v2::Packet::DrivingSystem:
+        if (header.m_commandID == v2::DrivePacket::id) {
+            if (payloadSize < 4) {
+                error = v2::Packet::Error::BadDataLength;
+                break;
+            }
+            m_speed = payload[0] * MaxSpeed / 255.f;
+            m_heading = qFromBigEndian<uint16_t>(payload + 1) % 360;
+            if (payload[3] & v2::DrivePacket::Reverse) {
+                m_speed = -m_speed;
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    if (header.m_flags & v2::Packet::Synchronous) {
+        respondV2(header.m_deviceID, header.m_commandID, header.m_sequenceNumber, uint8_t(error), contents);
+    }
+}
+
+void SimulatedRobot::handleCommandMousr(const QByteArray &data)
+{
+    if (data.size() != MousrCommandSize || uint8_t(data[0]) != 48) {
+        m_stats.invalidCommands++;
+        return;
+    }
+    m_stats.commands++;
+
+    const char *payload = data.constData() + 1;
+    uint16_t command;
+    memcpy(&command, data.constData() + 13, sizeof(command));
+
+    switch(command) {
+    case MousrCommand::InitializeDevice: {
+        QByteArray version;
+        version.append(char(2)); // stable firmware
+        version.append(char(1)); // major
+        appendRaw<uint16_t>(&version, 0); // minor
+        appendRaw<uint16_t>(&version, 0); // commit number
+        version.append("sim0", 4);
+        version.append(char(1)); // mousr version
+        appendRaw<uint32_t>(&version, 1); // hardware version
+        appendRaw<uint32_t>(&version, 1); // bootloader version
+        notifyMousr(MousrResponse::FirmwareVersion, version);
+
+        QByteArray result;
+        appendRaw<uint16_t>(&result, command);
+        result.append(char(0)); // result code
+        appendRaw<uint32_t>(&result, 3); // current api version
+        appendRaw<uint32_t>(&result, 1); // minimum
+        appendRaw<uint32_t>(&result, 3); // maximum
+        notifyMousr(MousrResponse::CommandCompleted, result);
+
+        startSensorStream(m_maxSensorRate, 0);
+        break;
+    }
+    case MousrCommand::Move: {
+        float speed, held, angle;
+        memcpy(&speed, payload, sizeof(float));
+        memcpy(&held, payload + 4, sizeof(float));
+        memcpy(&angle, payload + 8, sizeof(float));
+        m_speed = qFuzzyIsNull(held) ? 0.f : speed * MaxSpeed;
+        m_heading = angle;
+        break;
+    }
+    case MousrCommand::Stop:
+        m_speed = 0.f;
+        notifyMousr(MousrResponse::RobotStopped, {});
+        break;
+    case MousrCommand::ConfigAutoMode:
+        // Echo back the config
+        notifyMousr(MousrResponse::AutoModeChanged, QByteArray(payload, 10));
+        break;
+    default:
+        break;
+    }
+}
+
+void SimulatedRobot::startSensorStream(const int rate, const int count)
+{
+    m_samplesLeft = count > 0 ? count : -1;
+
+    if (m_protocol != Mousr && !m_sensorSources) {
+        m_sensorTimer.stop();
+        return;
+    }
+
+    m_sensorTimer.start(1000 / qBound(1, rate, m_maxSensorRate));
+}
+
+void SimulatedRobot::onSensorTimer()
+{
+    if (!m_samplesLeft) {
+        m_sensorTimer.stop();
+        return;
+    }
+    if (m_samplesLeft > 0) {
+        m_samplesLeft--;
+    }
+
+    // Fixed step instead of the real elapsed time, so it doesn't depend on how busy we are
+    advance(m_sensorTimer.interval() / 1000.f);
+    m_sampleCount++;
+    m_stats.sensorSamples++;
+
+    switch(m_protocol) {
+    case SpheroV1:
+        notifyV1(sphero::ResponsePacketHeader::SensorStream, sensorSampleV1());
+        break;
+    case SpheroV2:
+        notifyV2(sphero::v2::Packet::Sensors, sphero::v2::Sensors::Sensor, sensorSampleV2());
+        break;
+    case Mousr: {
+        QByteArray orientation;
+        appendRaw<float>(&orientation, 0.f);
+        appendRaw<float>(&orientation, 0.f);
+        appendRaw<float>(&orientation, m_heading);
+        orientation.append(char(0)); // flipped
+        orientation.append(char(m_sampleCount % 256)); // tail rotation
+        notifyMousr(MousrResponse::DeviceOrientation, orientation);
+
+        // Once a second
+        const int rate = qMax(1, 1000 / qMax(1, m_sensorTimer.interval()));
+        if (m_sampleCount % uint32_t(rate) == 1) {
+            QByteArray battery;
+            battery.append(char(qBound(0, qRound(m_batteryVoltage / 4.2f * 100), 100))); // it reports percent
+            battery.append(char(0)); // low
+            battery.append(char(0)); // charging
+            battery.append(char(0)); // fully charged
+            battery.append(char(0)); // auto mode
+            appendRaw<uint16_t>(&battery, 0); // memory
+            notifyMousr(MousrResponse::BatteryVoltage, battery);
+        }
+        break;
+    }
+    }
+}
+
+void SimulatedRobot::advance(const float seconds)
+{
+    const float radians = qDegreesToRadians(m_heading);
+    m_x += m_speed * qSin(radians) * seconds;
+    m_y += m_speed * qCos(radians) * seconds;
+}
+
+QByteArray SimulatedRobot::sensorSampleV1() const
+{
+    using sphero::v1::SensorSample;
+
+    const float radians = qDegreesToRadians(m_heading);
+    const int16_t wobble = int16_t(int(m_sampleCount % 16) - 8); // so not everything is constant
+
+    QByteArray data;
+    for (int i=0; i<SensorSample::FieldCount; i++) {
+        if (!(m_sensorSources & SensorSample::sourceBits[i])) {
+            continue;
+        }
+        int value = wobble;
+        switch(SensorSample::Field(i)) {
+        case SensorSample::AccelerometerZRaw:
+            value = 256;
+            break;
+        case SensorSample::AccelerometerZ:
+            value = 4096;
+            break;
+        case SensorSample::ImuYaw:
+            value = qRound(m_heading > 180 ? m_heading - 360 : m_heading);
+            break;
+        case SensorSample::LeftMotorBackEmf:
+        case SensorSample::RightMotorBackEmf:
+        case SensorSample::LeftMotorBackEmfRaw:
+        case SensorSample::RightMotorBackEmfRaw:
+            value = qRound(m_speed);
+            break;
+        case SensorSample::Quaternion0:
+            value = qRound(qCos(radians / 2) * 10000);
+            break;
+        case SensorSample::Quaternion3:
+            value = qRound(qSin(radians / 2) * 10000);
+            break;
+        case SensorSample::LocatorX:
+            value = qRound(m_x);
+            break;
+        case SensorSample::LocatorY:
+            value = qRound(m_y);
+            break;
+        case SensorSample::VelocityX:
+            value = qRound(m_speed * qSin(radians) * 10); // mm/s
+            break;
+        case SensorSample::VelocityY:
+            value = qRound(m_speed * qCos(radians) * 10);
+            break;
+        default:
+            break;
+        }
+        appendBigEndian<int16_t>(&data, int16_t(qBound(-32768, value, 32767)));
+    }
+    return data;
+}
+
+QByteArray SimulatedRobot::sensorSampleV2() const
+{
+    using sphero::v2::SensorSample;
+
+    const float radians = qDegreesToRadians(m_heading);
+    const float wobble = (int(m_sampleCount % 16) - 8) / 1000.f;
+
+    QByteArray data;
+    for (int i=0; i<SensorSample::FieldCount; i++) {
+        if (!(m_sensorSources & SensorSample::sourceBits[i])) {
+            continue;
+        }
+        float value = wobble;
+        switch(SensorSample::Field(i)) {
+        case SensorSample::QuaternionZ:
+            value = qSin(radians / 2);
+            break;
+        case SensorSample::QuaternionW:
+            value = qCos(radians / 2);
+            break;
+        case SensorSample::Yaw:
+            value = m_heading > 180 ? m_heading - 360 : m_heading;
+            break;
+        case SensorSample::AccelerometerZ:
+        case SensorSample::Acceleration:
+            value = 1.f + wobble;
+            break;
+        case SensorSample::Speed:
+            value = qAbs(m_speed);
+            break;
+        case SensorSample::LocatorX:
+            value = m_x;
+            break;
+        case SensorSample::LocatorY:
+            value = m_y;
+            break;
+        case SensorSample::VelocityX:
+            value = m_speed * qSin(radians);
+            break;
+        case SensorSample::VelocityY:
+            value = m_speed * qCos(radians);
+            break;
+        case SensorSample::NormalizedSpeed:
+            value = qAbs(m_speed) / MaxSpeed;
+            break;
+        default:
+            break;
+        }
+        appendBigEndian<float>(&data, value);
+    }
+    return data;
+}
+
+void SimulatedRobot::respondV1(const uint8_t code, const uint8_t sequenceNumber, const QByteArray &contents)
+{
+    if (m_dropResponses > 0) {
+        m_dropResponses--;
+        m_stats.droppedResponses++;
+        return;
+    }
+
+    QByteArray frame;
+    frame.reserve(6 + contents.size());
+    frame.append(char(0xFF));
+    frame.append(char(sphero::ResponsePacketHeader::Response));
+    frame.append(char(code));
+    frame.append(char(sequenceNumber));
+    frame.append(char(contents.size() + 1));
+    frame.append(contents);
+
+    uint8_t checksum = 0;
+    for (int i=2; i<frame.size(); i++) {
+        checksum += uint8_t(frame[i]);
+    }
+    frame.append(char(checksum ^ 0xFF));
+
+    m_stats.responses++;
+    notify(sphero::Characteristics::Main::V1::response, frame);
+}
+
+void SimulatedRobot::notifyV1(const uint8_t type, const QByteArray &contents)
+{
+    const int dataLength = contents.size() + 1;
+
+    QByteArray frame;
+    frame.reserve(6 + contents.size());
+    frame.append(char(0xFF));
+    frame.append(char(sphero::ResponsePacketHeader::Notification));
+    frame.append(char(type));
+    frame.append(char(dataLength >> 8));
+    frame.append(char(dataLength & 0xFF));
+    frame.append(contents);
+
+    uint8_t checksum = 0;
+    for (int i=2; i<frame.size(); i++) {
+        checksum += uint8_t(frame[i]);
+    }
+    frame.append(char(checksum ^ 0xFF));
+
+    notify(sphero::Characteristics::Main::V1::response, frame);
+}
+
+void SimulatedRobot::respondV2(const uint8_t deviceId, const uint8_t commandId, const uint8_t sequenceNumber, const uint8_t error, const QByteArray &contents)
+{
+    if (m_dropResponses > 0) {
+        m_dropResponses--;
+        m_stats.droppedResponses++;
+        return;
+    }
+
+    QByteArray raw;
+    raw.reserve(5 + contents.size());
+    raw.append(char(sphero::v2::Packet::HasErrorCode | sphero::v2::Packet::ResetTimeout));
+    raw.append(char(deviceId));
+    raw.append(char(commandId));
+    raw.append(char(sequenceNumber));
+    raw.append(char(error));
+    raw.append(contents);
+
+    QByteArray frame(2 * (raw.size() + 1) + 2, Qt::Uninitialized);
+    frame.resize(sphero::v2::encode(raw.constData(), raw.size(), frame.data()));
+
+    m_stats.responses++;
+    notify(sphero::Characteristics::Main::V2::commands, frame);
+}
+
+void SimulatedRobot::notifyV2(const uint8_t deviceId, const uint8_t commandId, const QByteArray &contents)
+{
+    QByteArray raw;
+    raw.reserve(4 + contents.size());
+    raw.append(char(sphero::v2::Packet::ResetTimeout));
+    raw.append(char(deviceId));
+    raw.append(char(commandId));
+    raw.append(char(0)); // sequence number
+    raw.append(contents);
+
+    QByteArray frame(2 * (raw.size() + 1) + 2, Qt::Uninitialized);
+    frame.resize(sphero::v2::encode(raw.constData(), raw.size(), frame.data()));
+
+    notify(sphero::Characteristics::Main::V2::commands, frame);
+}
+
+void SimulatedRobot::notifyMousr(const uint8_t type, const QByteArray &contents)
+{
+    // Always the same size, padded with zeros
+    QByteArray packet(MousrResponseSize, '\0');
+    packet[0] = char(type);
+    memcpy(packet.data() + 1, contents.constData(), size_t(qMin(contents.size(), MousrResponseSize - 1)));
+
+    notify(mousr::Characteristics::read, packet);
+}
+
+void SimulatedRobot::notify(const QBluetoothUuid &characteristic, const QByteArray &data)
+{
+    // ATT header takes 3 bytes
+    const int chunkSize = m_mtu - 3;
+    for (int offset = 0; offset < data.size(); offset += chunkSize) {
+        m_stats.notifications++;
+        m_stats.bytesNotified += uint64_t(qMin(chunkSize, data.size() - offset));
+        schedule({0, true, characteristic, data.mid(offset, chunkSize)});
+    }
+}
+
+void SimulatedRobot::schedule(Event event)
+{
+    event.due = m_clock.elapsed() + m_latency;
+    m_events.push_back(std::move(event));
+
+    if (!m_deliveryTimer.isActive()) {
+        m_deliveryTimer.start(int(qMax<int64_t>(0, m_events.front().due - m_clock.elapsed())));
+    }
+}
+
+void SimulatedRobot::deliver()
+{
+    const int64_t now = m_clock.elapsed();
+
+    // Handlers might write (and schedule more) while we emit, so don't hold on to anything in the queue
+    while (m_open && !m_events.empty() && m_events.front().due <= now) {
+        const Event event = std::move(m_events.front());
+        m_events.pop_front();
+
+        if (event.isNotification) {
+            emit received(event.characteristic, event.data);
+        } else {
+            emit written(event.characteristic);
+        }
+    }
+
+    if (!m_events.empty() && !m_deliveryTimer.isActive()) {
+        m_deliveryTimer.start(int(qMax<int64_t>(0, m_events.front().due - m_clock.elapsed())));
+    }
+}
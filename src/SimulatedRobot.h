@@ -0,0 +1,143 @@
+#pragma once
+
+#include "Transport.h"
+
+#include "sphero/v2/FrameDecoder.h"
+
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include <cstdint>
+#include <deque>
+
+/// In-process robot on the other end of a Transport, for running the
+/// handlers without Bluetooth (benchmarks, testing parser changes).
+/// Answers pings, power state and locator requests, and streams sensor data
+/// and orientation at the requested rate. Everything it sends is split into
+/// notifications of at most MTU - 3 bytes, and delivered in order after the
+/// configured latency. Sensor values only depend on the commands received
+/// and the number of samples sent, so runs are repeatable.
+class SimulatedRobot : public Transport
+{
+    Q_OBJECT
+
+public:
+    enum Protocol {
+        SpheroV1,
+        SpheroV2,
+        Mousr
+    };
+    Q_ENUM(Protocol)
+
+    struct Stats {
+        uint32_t writes = 0;
+        uint32_t commands = 0;
+        uint32_t invalidCommands = 0;
+        uint32_t responses = 0;
+        uint32_t droppedResponses = 0;
+        uint32_t notifications = 0; // BLE notifications, so after MTU splitting
+        uint32_t sensorSamples = 0;
+        uint64_t bytesWritten = 0;
+        uint64_t bytesNotified = 0;
+        uint32_t connectionUpdates = 0;
+    };
+
+    explicit SimulatedRobot(const Protocol protocol, QObject *parent = nullptr);
+
+    /// Robot name the handlers understand, e. g. for SpheroHandler::RobotType
+    QString name() const;
+    Protocol protocol() const { return m_protocol; }
+
+    void setMtu(const int mtu) { m_mtu = qMax(23, mtu); }
+    int mtu() const { return m_mtu; }
+
+    /// Milliseconds from a write until the response/acknowledgement is delivered, 0 is next event loop iteration
+    void setLatency(const int milliseconds) { m_latency = qMax(0, milliseconds); }
+
+    /// Maximum sensor stream rate in Hz, and the orientation/battery rate for Mousr
+    void setMaxSensorRate(const int hz) { m_maxSensorRate = qMax(1, hz); }
+
+    void setBatteryVoltage(const float voltage) { m_batteryVoltage = voltage; }
+
+    /// Doesn't respond to the next count synchronous commands (but still does them), for testing timeouts
+    void dropResponses(const int count) { m_dropResponses = qMax(0, count); }
+
+    /// The shortest connection interval it accepts in ms, like the real robots it takes
+    /// the shortest one it was offered that it supports
+    void setMinConnectionInterval(const double milliseconds) { m_minConnectionInterval = qBound(7.5, milliseconds, 4000.); }
+
+    /// What was negotiated with the last requestConnectionUpdate(), so the switching can be checked
+    const QLowEnergyConnectionParameters &connectionParameters() const { return m_connectionParameters; }
+
+    /// Simulates the robot going away
+    void close() override;
+
+    const Stats &stats() const { return m_stats; }
+
+    bool isOpen() const override { return m_open; }
+    bool canWriteWithoutResponse(const QBluetoothUuid &characteristic) const override;
+    bool requestConnectionUpdate(const QLowEnergyConnectionParameters &parameters) override;
+
+protected:
+    void writeCharacteristic(const QBluetoothUuid &characteristic, const QByteArray &data, const QLowEnergyService::WriteMode mode) override;
+
+private slots:
+    void deliver();
+    void onSensorTimer();
+
+private:
+    struct Event {
+        int64_t due; // milliseconds since we were created
+        bool isNotification;
+        QBluetoothUuid characteristic;
+        QByteArray data;
+    };
+
+    void handleCommandV1(const QByteArray &data);
+    void handleCommandV2(const sphero::v2::FrameDecoder::Frame &frame);
+    void handleCommandMousr(const QByteArray &data);
+
+    void respondV1(const uint8_t code, const uint8_t sequenceNumber, const QByteArray &contents = {});
+    void notifyV1(const uint8_t type, const QByteArray &contents);
+    void respondV2(const uint8_t deviceId, const uint8_t commandId, const uint8_t sequenceNumber, const uint8_t error, const QByteArray &contents = {});
+    void notifyV2(const uint8_t deviceId, const uint8_t commandId, const QByteArray &contents);
+    void notifyMousr(const uint8_t type, const QByteArray &contents);
+
+    void startSensorStream(const int rate, const int count);
+    void advance(const float seconds);
+    QByteArray sensorSampleV1() const;
+    QByteArray sensorSampleV2() const;
+
+    void notify(const QBluetoothUuid &characteristic, const QByteArray &data);
+    void schedule(Event event);
+
+    const Protocol m_protocol;
+
+    bool m_open = true;
+    int m_mtu = 23;
+    int m_latency = 0;
+    int m_maxSensorRate = 400;
+    float m_batteryVoltage = 7.8f; // BB-8 etc. have two cells
+    double m_minConnectionInterval = 7.5;
+    int m_dropResponses = 0;
+    QLowEnergyConnectionParameters m_connectionParameters;
+
+    QElapsedTimer m_clock;
+    QTimer m_deliveryTimer;
+    std::deque<Event> m_events;
+
+    // Sensor streaming
+    QTimer m_sensorTimer;
+    uint64_t m_sensorSources = 0;
+    int m_samplesLeft = 0; // < 0 means forever
+    uint32_t m_sampleCount = 0;
+
+    // What it is doing
+    float m_speed = 0.f; // cm/s
+    float m_heading = 0.f; // degrees
+    float m_x = 0.f, m_y = 0.f; // cm
+
+    sphero::v2::FrameDecoder m_decoderV2;
+
+    Stats m_stats;
+};
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <QByteArray>
+#include <QDebug>
+#include <QLowEnergyService>
+#include <QTimer>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+
+/// Everything written to a robot goes through here, so a burst of config or
+/// LED commands can't end up in front of a brake inside the BLE stack.
+/// Only a few acknowledged writes are handed to Qt at a time (tracked with
+/// characteristicWritten), the rest wait here, highest priority first.
+class TransmitQueue
+{
+public:
+    enum Priority {
+        Safety, // brake, stop
+        Motion, // only the latest setpoint matters
+        Config,
+        Cosmetic, // LEDs, sounds
+        PriorityCount
+    };
+
+    using Writer = std::function<void(const QByteArray &, QLowEnergyService::WriteMode)>;
+
+    struct Stats {
+        uint32_t written = 0;
+        uint32_t acknowledged = 0;
+        uint32_t failed = 0;
+        uint32_t stalls = 0;
+        std::array<uint32_t, PriorityCount> dropped{};
+
+        std::array<int, PriorityCount> depth{};
+        int maxDepth = 0; // all priorities together
+        int inFlight = 0;
+
+        // nanoseconds, from enqueue to handed to Qt, and from that to acknowledged
+        int64_t maxQueueLatency = 0;
+        int64_t averageQueueLatency = 0;
+        int64_t maxWriteLatency = 0;
+        int64_t averageWriteLatency = 0;
+    };
+
+    TransmitQueue() {
+        m_stallTimer.setSingleShot(true);
+        m_stallTimer.setInterval(1000);
+        QObject::connect(&m_stallTimer, &QTimer::timeout, &m_stallTimer, [this]() { onStalled(); });
+    }
+
+    // The timer connection captures this
+    TransmitQueue(const TransmitQueue &) = delete;
+    TransmitQueue &operator=(const TransmitQueue &) = delete;
+
+    void setWriter(Writer writer) { m_write = std::move(writer); }
+    void setMaxInFlight(const int count) { m_maxInFlight = qMax(1, count); }
+
+    /// Returns false if it was dropped
+    /// onWrite is called when it is handed to the writer
+    bool enqueue(const Priority priority, const QByteArray &frame, const QLowEnergyService::WriteMode mode = QLowEnergyService::WriteWithResponse,
+            std::function<void()> onWrite = {})
+    {
+        std::deque<Entry> &queue = m_queues[priority];
+        if (int(queue.size()) >= maxDepth(priority)) {
+            m_stats.dropped[priority]++;
+
+            // Config commands depend on each other, so keep the ones we already have
+            if (priority == Config) {
+                qWarning() << " ! Transmit queue full, dropping config write";
+                return false;
+            }
+            queue.pop_front();
+        }
+        queue.push_back({frame, mode, now(), std::move(onWrite)});
+        updateDepth();
+
+        pump();
+        return true;
+    }
+
+    /// Call when QLowEnergyService::characteristicWritten is emitted for our characteristic
+    void onWritten()
+    {
+        if (m_inFlight.empty()) {
+            return;
+        }
+        const int64_t latency = now() - m_inFlight.front();
+        m_inFlight.pop_front();
+        m_stats.acknowledged++;
+        updateLatency(latency, &m_stats.averageWriteLatency, &m_stats.maxWriteLatency);
+
+        // Got progress, so restart the stall detection
+        m_stallTimer.stop();
+        pump();
+    }
+
+    /// Call on QLowEnergyService::CharacteristicWriteError
+    void onWriteFailed()
+    {
+        if (m_inFlight.empty()) {
+            return;
+        }
+        m_inFlight.pop_front();
+        m_stats.failed++;
+
+        m_stallTimer.stop();
+        pump();
+    }
+
+    /// Called once when everything queued so far is written and acknowledged,
+    /// e. g. so the sleep command gets out before we disconnect
+    void whenDrained(std::function<void()> callback)
+    {
+        m_drained = std::move(callback);
+        checkDrained();
+    }
+
+    /// Hands everything waiting to the writer at once, for when there is no
+    /// time to wait for acknowledgements (e. g. when being destroyed)
+    void flush()
+    {
+        const int maxInFlight = m_maxInFlight;
+        m_maxInFlight = std::numeric_limits<int>::max();
+        pump();
+        m_maxInFlight = maxInFlight;
+    }
+
+    /// Drops everything waiting in this priority
+    void clear(const Priority priority)
+    {
+        m_queues[priority].clear();
+        updateDepth();
+    }
+
+    /// Forget everything, e. g. on disconnect
+    void reset()
+    {
+        for (std::deque<Entry> &queue : m_queues) {
+            queue.clear();
+        }
+        m_inFlight.clear();
+        m_stallTimer.stop();
+        m_drained = nullptr;
+        updateDepth();
+    }
+
+    const Stats &stats() const { return m_stats; }
+
+private:
+    struct Entry {
+        QByteArray frame;
+        QLowEnergyService::WriteMode mode;
+        int64_t enqueuedAt;
+        std::function<void()> onWrite;
+    };
+
+    static int maxDepth(const Priority priority) {
+        switch(priority) {
+        case Safety:
+            return 16;
+        case Motion:
+            return 1;
+        case Config:
+            return 64;
+        case Cosmetic:
+            return 8;
+        default:
+            return 0;
+        }
+    }
+
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static void updateLatency(const int64_t latency, int64_t *average, int64_t *max)
+    {
+        *max = qMax(*max, latency);
+        if (!*average) {
+            *average = latency;
+        } else {
+            *average += (latency - *average) / 8;
+        }
+    }
+
+    void pump()
+    {
+        // A writer or onWrite callback can end up back here (e. g. through
+        // onWriteFailed()), the loop below picks up whatever changed
+        if (m_pumping) {
+            return;
+        }
+        m_pumping = true;
+
+        while (int(m_inFlight.size()) < m_maxInFlight) {
+            std::deque<Entry> *queue = nullptr;
+            for (std::deque<Entry> &candidate : m_queues) {
+                if (!candidate.empty()) {
+                    queue = &candidate;
+                    break;
+                }
+            }
+            if (!queue) {
+                break;
+            }
+
+            const Entry entry = std::move(queue->front());
+            queue->pop_front();
+
+            const int64_t timestamp = now();
+            updateLatency(timestamp - entry.enqueuedAt, &m_stats.averageQueueLatency, &m_stats.maxQueueLatency);
+
+            if (entry.mode == QLowEnergyService::WriteWithResponse) {
+                m_inFlight.push_back(timestamp);
+            } else {
+                // Qt never tells us when these are done, so they are not in flight
+            }
+            m_stats.written++;
+
+            if (m_write) {
+                m_write(entry.frame, entry.mode);
+            }
+            if (entry.onWrite) {
+                entry.onWrite();
+            }
+        }
+
+        m_pumping = false;
+        updateDepth();
+
+        if (m_inFlight.empty()) {
+            m_stallTimer.stop();
+        } else if (!m_stallTimer.isActive()) {
+            m_stallTimer.start();
+        }
+
+        checkDrained();
+    }
+
+    void checkDrained()
+    {
+        if (!m_drained || !m_inFlight.empty()) {
+            return;
+        }
+        for (const std::deque<Entry> &queue : m_queues) {
+            if (!queue.empty()) {
+                return;
+            }
+        }
+
+        // It might queue more
+        const std::function<void()> callback = std::move(m_drained);
+        m_drained = nullptr;
+        callback();
+    }
+
+    void onStalled()
+    {
+        qWarning() << " ! No write confirmation for" << m_stallTimer.interval() << "ms, giving up on" << m_inFlight.size() << "writes";
+        m_stats.stalls++;
+        m_inFlight.clear();
+        pump();
+    }
+
+    void updateDepth()
+    {
+        int total = 0;
+        for (int i=0; i<PriorityCount; i++) {
+            m_stats.depth[i] = int(m_queues[i].size());
+            total += m_stats.depth[i];
+        }
+        m_stats.maxDepth = qMax(m_stats.maxDepth, total);
+        m_stats.inFlight = int(m_inFlight.size());
+    }
+
+    std::array<std::deque<Entry>, PriorityCount> m_queues;
+    std::deque<int64_t> m_inFlight; // when each was handed to Qt
+
+    QTimer m_stallTimer;
+    Writer m_write;
+    std::function<void()> m_drained;
+    int m_maxInFlight = 2;
+    bool m_pumping = false;
+
+    Stats m_stats;
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "capture/Recorder.h"
+
+#include <QObject>
+#include <QBluetoothUuid>
+#include <QByteArray>
+#include <QLowEnergyService>
+#include <QLowEnergyConnectionParameters>
+
+/// What the handlers read from and write to once the GATT services are set
+/// up, so the protocol code doesn't care if it is talking to a real robot
+/// (BleTransport) or an emulated one (SimulatedRobot).
+/// Characteristics are identified by UUID only.
+class Transport : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Transport(QObject *parent = nullptr) : QObject(parent) {
+        // Connected first, so it is recorded before the handlers do anything with it
+        connect(this, &Transport::received, this, [this](const QBluetoothUuid &characteristic, const QByteArray &data) {
+            if (m_recorder) {
+                m_recorder->record(capture::Notification, characteristic, data);
+            }
+        });
+        connect(this, &Transport::written, this, [this](const QBluetoothUuid &characteristic) {
+            if (m_recorder) {
+                m_recorder->record(capture::WriteAcknowledged, characteristic);
+            }
+        });
+        connect(this, &Transport::writeFailed, this, [this](const QBluetoothUuid &characteristic) {
+            if (m_recorder) {
+                m_recorder->record(capture::WriteFailed, characteristic);
+            }
+        });
+        connect(this, &Transport::closed, this, [this]() {
+            if (m_recorder) {
+                m_recorder->record(capture::Closed, QBluetoothUuid());
+            }
+        });
+    }
+
+    virtual bool isOpen() const = 0;
+
+    /// Hangs up, closed() is emitted when it is (e. g. when disconnecting from a simulated robot)
+    virtual void close() = 0;
+    virtual bool canWriteWithoutResponse(const QBluetoothUuid &characteristic) const = 0;
+
+    /// written() or writeFailed() is emitted when done, but only for
+    /// WriteWithResponse (same as Qt), and never from inside write()
+    void write(const QBluetoothUuid &characteristic, const QByteArray &data, const QLowEnergyService::WriteMode mode) {
+        if (m_recorder) {
+            m_recorder->record(mode == QLowEnergyService::WriteWithResponse ? capture::WriteWithResponse : capture::WriteWithoutResponse, characteristic, data);
+        }
+        writeCharacteristic(characteristic, data, mode);
+    }
+
+    /// Asks for other connection parameters (see LinkProfiles), connectionUpdated()
+    /// is emitted with what was negotiated. False if the transport can't.
+    virtual bool requestConnectionUpdate(const QLowEnergyConnectionParameters &parameters) {
+        Q_UNUSED(parameters);
+        return false;
+    }
+
+    /// Everything going through here is appended to the recorder, set to nullptr to stop
+    void setRecorder(capture::Recorder *recorder) { m_recorder = recorder; }
+
+signals:
+    void received(const QBluetoothUuid &characteristic, const QByteArray &data);
+    void written(const QBluetoothUuid &characteristic);
+    void writeFailed(const QBluetoothUuid &characteristic);
+    void closed();
+    void connectionUpdated(const QLowEnergyConnectionParameters &parameters);
+
+protected:
+    virtual void writeCharacteristic(const QBluetoothUuid &characteristic, const QByteArray &data, const QLowEnergyService::WriteMode mode) = 0;
+
+    /// For writes that can't even be started, queued so whoever is writing
+    /// isn't re-entered from inside write()
+    void failWrite(const QBluetoothUuid &characteristic, const QLowEnergyService::WriteMode mode) {
+        if (mode != QLowEnergyService::WriteWithResponse) {
+            return;
+        }
+        QMetaObject::invokeMethod(this, [this, characteristic]() {
+            emit writeFailed(characteristic);
+        }, Qt::QueuedConnection);
+    }
+
+private:
+    capture::Recorder *m_recorder = nullptr;
+};
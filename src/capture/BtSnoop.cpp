@@ -0,0 +1,387 @@
+#include "BtSnoop.h"
+#include "Recorder.h"
+
+#include "sphero/Uuids.h"
+#include "mousr/Uuids.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+namespace capture {
+
+static constexpr char btSnoopMagic[8] = { 'b', 't', 's', 'n', 'o', 'o', 'p', '\0' };
+static constexpr int fileHeaderSize = 16;
+static constexpr int recordHeaderSize = 24;
+
+// Datalink types
+static constexpr uint32_t hciUnencapsulated = 1001;
+static constexpr uint32_t hciUart = 1002; // H4
+static constexpr uint32_t linuxMonitor = 2001; // btmon
+
+// Linux monitor opcodes
+static constexpr uint16_t monitorEvent = 3;
+static constexpr uint16_t monitorAclSent = 4;
+static constexpr uint16_t monitorAclReceived = 5;
+
+// H4 packet types
+static constexpr uint8_t h4Acl = 0x02;
+static constexpr uint8_t h4Event = 0x04;
+
+static constexpr uint8_t disconnectionCompleteEvent = 0x05;
+
+static constexpr uint16_t attChannel = 0x0004;
+static constexpr uint16_t characteristicDeclaration = 0x2803;
+
+enum AttOpcode : uint8_t {
+    ErrorResponse = 0x01,
+    ReadByTypeRequest = 0x08,
+    ReadByTypeResponse = 0x09,
+    WriteRequest = 0x12,
+    WriteResponse = 0x13,
+    HandleValueNotification = 0x1B,
+    HandleValueIndication = 0x1D,
+    WriteCommand = 0x52
+};
+
+enum RobotKind : uint8_t {
+    SpheroV1 = 1 << 0,
+    SpheroV2 = 1 << 1,
+    Mousr = 1 << 2
+};
+
+static uint8_t robotKind(const QBluetoothUuid &characteristic)
+{
+    using namespace sphero::Characteristics;
+
+    static const QBluetoothUuid spheroV1Characteristics[] = {
+        Main::V1::commands, Main::V1::response,
+        Radio::V1::antiDos, Radio::V1::transmitPower, Radio::V1::rssi, Radio::V1::wake
+    };
+    static const QBluetoothUuid spheroV2Characteristics[] = {
+        Main::V2::commands, Main::V2::unknown1,
+        Radio::V2::write, Radio::V2::read, Radio::V2::antiDos
+    };
+    static const QBluetoothUuid mousrCharacteristics[] = {
+        mousr::Characteristics::write, mousr::Characteristics::read
+    };
+
+    if (std::find(std::begin(spheroV1Characteristics), std::end(spheroV1Characteristics), characteristic) != std::end(spheroV1Characteristics)) {
+        return SpheroV1;
+    }
+    if (std::find(std::begin(spheroV2Characteristics), std::end(spheroV2Characteristics), characteristic) != std::end(spheroV2Characteristics)) {
+        return SpheroV2;
+    }
+    if (std::find(std::begin(mousrCharacteristics), std::end(mousrCharacteristics), characteristic) != std::end(mousrCharacteristics)) {
+        return Mousr;
+    }
+    return 0;
+}
+
+bool BtSnoopImporter::isBtSnoop(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    return file.read(sizeof btSnoopMagic) == QByteArray(btSnoopMagic, sizeof btSnoopMagic);
+}
+
+bool BtSnoopImporter::convert(const QString &inputPath, const QString &outputPath)
+{
+    QFile file(inputPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed to open" << inputPath << file.errorString();
+        return false;
+    }
+    const qint64 fileSize = file.size();
+    const uchar *map = fileSize > fileHeaderSize ? file.map(0, fileSize) : nullptr;
+    if (!map) {
+        qWarning() << "Failed to map" << inputPath << file.errorString();
+        return false;
+    }
+
+    if (memcmp(map, btSnoopMagic, sizeof btSnoopMagic) != 0) {
+        qWarning() << inputPath << "is not a btsnoop file";
+        return false;
+    }
+    const uint32_t datalink = qFromBigEndian<uint32_t>(map + 12);
+    if (datalink != hciUnencapsulated && datalink != hciUart && datalink != linuxMonitor) {
+        qWarning() << "Unsupported btsnoop datalink type" << datalink;
+        return false;
+    }
+
+    Recorder recorder;
+    if (!recorder.open(outputPath, QString())) {
+        return false;
+    }
+    m_recorder = &recorder;
+    m_stats = {};
+    m_fragments.clear();
+    m_connections.clear();
+    m_robotsSeen = 0;
+
+    int64_t firstTimestamp = -1;
+    qint64 offset = fileHeaderSize;
+    while (offset + recordHeaderSize <= fileSize) {
+        const uchar *header = map + offset;
+        const uint32_t includedLength = qFromBigEndian<uint32_t>(header + 4);
+        const uint32_t flags = qFromBigEndian<uint32_t>(header + 8);
+        const int64_t timestamp = qFromBigEndian<int64_t>(header + 16); // microseconds since year 0
+
+        offset += recordHeaderSize;
+        if (uint64_t(offset) + includedLength > uint64_t(fileSize)) {
+            qWarning() << "Truncated btsnoop record at" << offset;
+            break;
+        }
+        const uint8_t *data = map + offset;
+        const int size = int(includedLength);
+        offset += includedLength;
+
+        if (firstTimestamp < 0) {
+            firstTimestamp = timestamp;
+        }
+        m_timestamp = uint64_t(qMax<int64_t>(0, timestamp - firstTimestamp));
+        m_stats.packets++;
+
+        switch(datalink) {
+        case hciUnencapsulated: {
+            const bool received = flags & 1;
+            const bool commandOrEvent = flags & 2;
+            if (!commandOrEvent) {
+                handleAcl(0, received ? Received : Sent, data, size);
+            } else if (received) {
+                handleEvent(0, data, size);
+            }
+            break;
+        }
+        case hciUart:
+            if (size < 1) {
+                break;
+            }
+            if (data[0] == h4Acl) {
+                handleAcl(0, (flags & 1) ? Received : Sent, data + 1, size - 1);
+            } else if (data[0] == h4Event) {
+                handleEvent(0, data + 1, size - 1);
+            }
+            break;
+        case linuxMonitor: {
+            const uint32_t controller = flags >> 16;
+            switch(flags & 0xFFFF) {
+            case monitorAclSent:
+                handleAcl(controller, Sent, data, size);
+                break;
+            case monitorAclReceived:
+                handleAcl(controller, Received, data, size);
+                break;
+            case monitorEvent:
+                handleEvent(controller, data, size);
+                break;
+            default:
+                break;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    // The handlers pick the protocol from the name
+    QString name;
+    if (m_robotsSeen & Mousr) {
+        name = QStringLiteral("Mousr");
+    } else if (m_robotsSeen & SpheroV2) {
+        name = QStringLiteral("SM-0000");
+    } else if (m_robotsSeen & SpheroV1) {
+        name = QStringLiteral("BB-0000");
+    }
+    recorder.setRobotName(name);
+    recorder.close();
+    m_recorder = nullptr;
+
+    qDebug() << " - Imported" << m_stats.packets << "HCI packets," << m_stats.attPdus << "ATT PDUs," << m_stats.notifications << "notifications and" << m_stats.writes << "writes for" << name;
+    if (m_stats.unknownHandles) {
+        qWarning() << " ! Ignored" << m_stats.unknownHandles << "ATT PDUs for unknown handles, is the GATT discovery missing from the capture?";
+    }
+
+    return !name.isEmpty();
+}
+
+void BtSnoopImporter::handleAcl(const uint32_t controller, const Direction direction, const uint8_t *data, const int size)
+{
+    if (size < 4) {
+        return;
+    }
+
+    const uint16_t header = qFromLittleEndian<uint16_t>(data);
+    const uint16_t handle = header & 0x0FFF;
+    const uint8_t packetBoundary = (header >> 12) & 0x3;
+    const int length = qMin<int>(qFromLittleEndian<uint16_t>(data + 2), size - 4);
+
+    const uint32_t connection = controller << 16 | handle;
+    QByteArray &l2cap = m_fragments[connection << 1 | direction];
+    if (packetBoundary == 0x1) {
+        // Continuation, without the start we don't know what it is
+        if (l2cap.isEmpty()) {
+            return;
+        }
+    } else {
+        l2cap.clear();
+    }
+    l2cap.append(reinterpret_cast<const char*>(data + 4), length);
+
+    if (l2cap.size() < 4) {
+        return;
+    }
+    const int l2capLength = qFromLittleEndian<uint16_t>(l2cap.constData());
+    if (l2cap.size() < 4 + l2capLength) {
+        return;
+    }
+
+    if (qFromLittleEndian<uint16_t>(l2cap.constData() + 2) == attChannel) {
+        handleAtt(connection, direction, reinterpret_cast<const uint8_t*>(l2cap.constData() + 4), l2capLength);
+    }
+    l2cap.clear();
+}
+
+void BtSnoopImporter::handleEvent(const uint32_t controller, const uint8_t *data, const int size)
+{
+    // code, parameter length, status, handle
+    if (size < 5 || data[0] != disconnectionCompleteEvent || data[2] != 0) {
+        return;
+    }
+
+    const uint32_t connection = controller << 16 | (qFromLittleEndian<uint16_t>(data + 3) & 0x0FFF);
+    if (!m_connections.contains(connection)) {
+        return;
+    }
+
+    // Handles get reused
+    const Connection state = m_connections.take(connection);
+    m_fragments.remove(connection << 1 | Sent);
+    m_fragments.remove(connection << 1 | Received);
+
+    if (state.used) {
+        m_recorder->recordAt(m_timestamp, Closed, QBluetoothUuid());
+    }
+}
+
+void BtSnoopImporter::handleAtt(const uint32_t connectionId, const Direction direction, const uint8_t *pdu, const int size)
+{
+    if (size < 1) {
+        return;
+    }
+    m_stats.attPdus++;
+
+    Connection &connection = m_connections[connectionId];
+    const uint8_t opcode = pdu[0];
+
+    // We're only interested in us as the client
+    if (direction == Sent) {
+        switch(opcode) {
+        case ReadByTypeRequest:
+            // start handle, end handle, 16 or 128 bit type
+            connection.readByTypeRequest = size == 7 ? qFromLittleEndian<uint16_t>(pdu + 5) : 0;
+            break;
+        case WriteRequest:
+        case WriteCommand: {
+            if (size < 3) {
+                break;
+            }
+            const QBluetoothUuid characteristic = connection.characteristics.value(qFromLittleEndian<uint16_t>(pdu + 1));
+            if (opcode == WriteRequest) {
+                connection.pendingWrite = characteristic;
+            }
+            if (characteristic.isNull()) {
+                m_stats.unknownHandles++;
+                break;
+            }
+            m_stats.writes++;
+            record(&connection, opcode == WriteRequest ? WriteWithResponse : WriteWithoutResponse, characteristic, pdu + 3, size - 3);
+            break;
+        }
+        default:
+            break;
+        }
+        return;
+    }
+
+    switch(opcode) {
+    case ReadByTypeResponse: {
+        if (connection.readByTypeRequest != characteristicDeclaration || size < 2) {
+            break;
+        }
+        // Each entry is: declaration handle, properties, value handle, 16 or 128 bit UUID
+        const int entrySize = pdu[1];
+        if (entrySize != 7 && entrySize != 21) {
+            break;
+        }
+        for (int position = 2; position + entrySize <= size; position += entrySize) {
+            const uint8_t *entry = pdu + position;
+            const uint16_t valueHandle = qFromLittleEndian<uint16_t>(entry + 3);
+            if (entrySize == 7) {
+                connection.characteristics[valueHandle] = QBluetoothUuid(qFromLittleEndian<uint16_t>(entry + 5));
+            } else {
+                // Little endian on the air, RFC 4122 is big endian
+                QByteArray uuid(reinterpret_cast<const char*>(entry + 5), 16);
+                std::reverse(uuid.begin(), uuid.end());
+                connection.characteristics[valueHandle] = QBluetoothUuid(QUuid::fromRfc4122(uuid));
+            }
+        }
+        break;
+    }
+    case ErrorResponse:
+        // request opcode, handle, error
+        if (size < 2) {
+            break;
+        }
+        if (pdu[1] == ReadByTypeRequest) {
+            // Usually just "attribute not found" at the end of the discovery
+            connection.readByTypeRequest = 0;
+        } else if (pdu[1] == WriteRequest && !connection.pendingWrite.isNull()) {
+            record(&connection, WriteFailed, connection.pendingWrite);
+            connection.pendingWrite = QBluetoothUuid();
+        }
+        break;
+    case WriteResponse:
+        if (!connection.pendingWrite.isNull()) {
+            record(&connection, WriteAcknowledged, connection.pendingWrite);
+            connection.pendingWrite = QBluetoothUuid();
+        }
+        break;
+    case HandleValueNotification:
+    case HandleValueIndication: {
+        if (size < 3) {
+            break;
+        }
+        const QBluetoothUuid characteristic = connection.characteristics.value(qFromLittleEndian<uint16_t>(pdu + 1));
+        if (characteristic.isNull()) {
+            m_stats.unknownHandles++;
+            break;
+        }
+        m_stats.notifications++;
+        record(&connection, Notification, characteristic, pdu + 3, size - 3);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void BtSnoopImporter::record(Connection *connection, const uint8_t type, const QBluetoothUuid &characteristic, const uint8_t *data, const int size)
+{
+    const uint8_t kind = robotKind(characteristic);
+    if (!kind) {
+        return;
+    }
+    m_robotsSeen |= kind;
+    connection->used = true;
+
+    m_recorder->recordAt(m_timestamp, RecordType(type), characteristic, reinterpret_cast<const char*>(data), size);
+}
+
+} // namespace capture
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <QBluetoothUuid>
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+#include <cstdint>
+
+namespace capture {
+
+class Recorder;
+
+/// Converts btsnoop files (from btmon -w, Android's HCI snoop log etc.) to our
+/// capture format, so they can be replayed into the handlers.
+/// ACL fragments are reassembled into ATT PDUs, and the attribute handles are
+/// mapped to characteristics from the GATT discovery in the capture, so the
+/// capture needs to include the connection setup. Only traffic to and from
+/// the Sphero and Mousr characteristics is kept.
+class BtSnoopImporter
+{
+public:
+    struct Stats {
+        uint32_t packets = 0;
+        uint32_t attPdus = 0;
+        uint32_t notifications = 0;
+        uint32_t writes = 0;
+        uint32_t unknownHandles = 0; // probably missing the GATT discovery
+    };
+
+    static bool isBtSnoop(const QString &path);
+
+    bool convert(const QString &inputPath, const QString &outputPath);
+
+    const Stats &stats() const { return m_stats; }
+
+private:
+    enum Direction {
+        Sent = 0,
+        Received = 1
+    };
+
+    struct Connection {
+        QHash<uint16_t, QBluetoothUuid> characteristics; // value handle -> uuid
+        uint16_t readByTypeRequest = 0; // attribute type we asked for
+        QBluetoothUuid pendingWrite;
+        bool used = false;
+    };
+
+    void handleAcl(const uint32_t controller, const Direction direction, const uint8_t *data, const int size);
+    void handleEvent(const uint32_t controller, const uint8_t *data, const int size);
+    void handleAtt(const uint32_t connection, const Direction direction, const uint8_t *pdu, const int size);
+
+    void record(Connection *connection, const uint8_t type, const QBluetoothUuid &characteristic, const uint8_t *data = nullptr, const int size = 0);
+
+    Recorder *m_recorder = nullptr;
+    uint64_t m_timestamp = 0;
+
+    QHash<uint32_t, QByteArray> m_fragments; // (connection << 1 | direction) -> L2CAP so far
+    QHash<uint32_t, Connection> m_connections; // (controller << 16 | handle)
+
+    uint8_t m_robotsSeen = 0; // which kinds of robots we've seen traffic for, to pick a name
+    Stats m_stats;
+};
+
+} // namespace capture
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+/// Session capture files, everything little endian:
+///
+///   FileHeader, then Records back to back until FileHeader::end.
+///
+/// Each Record is followed by size bytes of data. Characteristics are
+/// referred to by an index, defined by a DefineCharacteristic record (with
+/// the 16 byte RFC 4122 UUID as data) before first use.
+/// The file is written through a memory map that is larger than what is
+/// used, so readers should stop at FileHeader::end, which is kept up to date
+/// after every record (so the file is usable even if we crash).
+namespace capture {
+
+static constexpr char fileMagic[4] = { 'R', 'C', 'A', 'P' };
+static constexpr uint16_t fileVersion = 1;
+
+enum RecordType : uint8_t {
+    DefineCharacteristic = 0,
+    Notification = 1, // from the robot
+    WriteWithResponse = 2, // to the robot
+    WriteWithoutResponse = 3,
+    WriteAcknowledged = 4,
+    WriteFailed = 5,
+    Closed = 6,
+
+    RecordTypeCount
+};
+
+static constexpr uint8_t invalidCharacteristic = 0xFF;
+static constexpr int maxCharacteristics = invalidCharacteristic;
+static constexpr int maxNameLength = 40;
+
+#pragma pack(push,1)
+
+struct FileHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t headerSize;
+    uint64_t end; // offset of the first byte after the last complete record
+    int64_t startTime; // wall clock, ms since epoch, for humans
+    char name[maxNameLength]; // robot name, UTF-8, zero padded
+};
+static_assert(sizeof(FileHeader) == 64);
+
+struct Record {
+    uint64_t timestamp; // microseconds since the start of the capture, monotonic
+    uint8_t type;
+    uint8_t characteristic;
+    uint16_t size;
+};
+static_assert(sizeof(Record) == 12);
+
+#pragma pack(pop)
+
+} // namespace capture
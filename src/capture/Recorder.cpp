@@ -0,0 +1,212 @@
+#include "Recorder.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QDebug>
+#include <QtEndian>
+
+#include <cstddef>
+#include <cstring>
+
+namespace capture {
+
+// Plenty for a couple of minutes of streaming sensor data, doubled when full
+static constexpr uint64_t initialCapacity = 1024 * 1024;
+
+Recorder::~Recorder()
+{
+    close();
+}
+
+bool Recorder::openFromEnvironment(const QString &robotName)
+{
+    const QString directory = qEnvironmentVariable("ROBOT_CAPTURE_DIR");
+    if (directory.isEmpty()) {
+        return false;
+    }
+
+    QString fileName = robotName + QDateTime::currentDateTime().toString(QStringLiteral("-yyyyMMdd-hhmmss")) + QStringLiteral(".rcap");
+    fileName.replace(QLatin1Char('/'), QLatin1Char('_'));
+
+    if (!QDir().mkpath(directory)) {
+        qWarning() << "Failed to create capture directory" << directory;
+        return false;
+    }
+
+    return open(QDir(directory).filePath(fileName), robotName);
+}
+
+bool Recorder::open(const QString &path, const QString &robotName)
+{
+    close();
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+        qWarning() << "Failed to open capture file" << path << m_file.errorString();
+        return false;
+    }
+
+    m_used = 0;
+    m_characteristicCount = 0;
+    if (!reserve(sizeof(FileHeader))) {
+        m_file.close();
+        return false;
+    }
+
+    FileHeader header;
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, fileMagic, sizeof header.magic);
+    header.version = qToLittleEndian(fileVersion);
+    header.headerSize = qToLittleEndian<uint16_t>(sizeof(FileHeader));
+    header.end = qToLittleEndian<uint64_t>(sizeof(FileHeader));
+    header.startTime = qToLittleEndian<int64_t>(QDateTime::currentMSecsSinceEpoch());
+    const QByteArray name = robotName.toUtf8().left(maxNameLength - 1);
+    memcpy(header.name, name.constData(), size_t(name.size()));
+
+    memcpy(m_map, &header, sizeof header);
+    m_used = sizeof(FileHeader);
+
+    m_clock.start();
+
+    qDebug() << " - Recording session to" << path;
+
+    return true;
+}
+
+void Recorder::setRobotName(const QString &robotName)
+{
+    if (!m_map) {
+        return;
+    }
+
+    char name[maxNameLength] = {};
+    const QByteArray utf8 = robotName.toUtf8().left(maxNameLength - 1);
+    memcpy(name, utf8.constData(), size_t(utf8.size()));
+    memcpy(m_map + offsetof(FileHeader, name), name, sizeof name);
+}
+
+void Recorder::close()
+{
+    if (!m_file.isOpen()) {
+        return;
+    }
+
+    if (m_map) {
+        m_file.unmap(m_map);
+        m_map = nullptr;
+    }
+
+    // Drop the unused part of the map
+    m_file.resize(qint64(m_used));
+    m_file.close();
+
+    qDebug() << " - Recorded" << m_used << "bytes to" << m_file.fileName();
+
+    m_capacity = 0;
+    m_used = 0;
+}
+
+void Recorder::record(const RecordType type, const QBluetoothUuid &characteristic, const char *data, const int size)
+{
+    if (Q_UNLIKELY(!m_map)) {
+        return;
+    }
+
+    const uint64_t timestamp = uint64_t(m_clock.nsecsElapsed() / 1000);
+    append(timestamp, type, characteristicIndex(timestamp, characteristic), data, size);
+}
+
+void Recorder::recordAt(const uint64_t timestamp, const RecordType type, const QBluetoothUuid &characteristic, const char *data, const int size)
+{
+    if (!m_map) {
+        return;
+    }
+
+    append(timestamp, type, characteristicIndex(timestamp, characteristic), data, size);
+}
+
+uint8_t Recorder::characteristicIndex(const uint64_t timestamp, const QBluetoothUuid &characteristic)
+{
+    // There's only a handful, so this is faster than hashing
+    for (int i=0; i<m_characteristicCount; i++) {
+        if (m_characteristics[size_t(i)] == characteristic) {
+            return uint8_t(i);
+        }
+    }
+
+    if (m_characteristicCount >= maxCharacteristics) {
+        return invalidCharacteristic;
+    }
+
+    const uint8_t index = uint8_t(m_characteristicCount);
+    const QByteArray uuid = characteristic.toRfc4122();
+    if (!append(timestamp, DefineCharacteristic, index, uuid.constData(), uuid.size())) {
+        return invalidCharacteristic;
+    }
+
+    m_characteristics[size_t(index)] = characteristic;
+    m_characteristicCount++;
+
+    return index;
+}
+
+bool Recorder::append(const uint64_t timestamp, const uint8_t type, const uint8_t characteristic, const char *data, const int size)
+{
+    const uint16_t dataSize = uint16_t(qBound(0, size, 0xFFFF));
+    if (Q_UNLIKELY(!reserve(m_used + sizeof(Record) + dataSize))) {
+        return false;
+    }
+
+    Record record;
+    record.timestamp = qToLittleEndian(timestamp);
+    record.type = type;
+    record.characteristic = characteristic;
+    record.size = qToLittleEndian(dataSize);
+
+    uchar *target = m_map + m_used;
+    memcpy(target, &record, sizeof record);
+    if (dataSize) {
+        memcpy(target + sizeof record, data, dataSize);
+    }
+    m_used += sizeof(Record) + dataSize;
+
+    // Readers stop here, so only update when the record is complete
+    qToLittleEndian<uint64_t>(m_used, m_map + offsetof(FileHeader, end));
+
+    return true;
+}
+
+bool Recorder::reserve(const uint64_t size)
+{
+    if (Q_LIKELY(size <= m_capacity)) {
+        return true;
+    }
+
+    uint64_t capacity = qMax(m_capacity, initialCapacity);
+    while (capacity < size) {
+        capacity *= 2;
+    }
+
+    if (m_map) {
+        m_file.unmap(m_map);
+        m_map = nullptr;
+    }
+
+    if (!m_file.resize(qint64(capacity))) {
+        qWarning() << "Failed to grow capture file" << m_file.fileName() << m_file.errorString();
+        close();
+        return false;
+    }
+
+    m_map = m_file.map(0, qint64(capacity));
+    if (!m_map) {
+        qWarning() << "Failed to map capture file" << m_file.fileName() << m_file.errorString();
+        close();
+        return false;
+    }
+
+    m_capacity = capacity;
+    return true;
+}
+
+} // namespace capture
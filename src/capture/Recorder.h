@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Format.h"
+
+#include <QBluetoothUuid>
+#include <QElapsedTimer>
+#include <QFile>
+
+#include <array>
+
+namespace capture {
+
+/// Appends everything going over a Transport to a capture file (see
+/// Format.h), for replaying later with Replay.
+/// Recording is just a couple of memcpy()s into a memory map, the map is
+/// only grown (and remapped) when it runs out of space.
+class Recorder
+{
+public:
+    Recorder() = default;
+    ~Recorder();
+
+    /// Starts a new capture in the directory in $ROBOT_CAPTURE_DIR, if set
+    bool openFromEnvironment(const QString &robotName);
+
+    bool open(const QString &path, const QString &robotName);
+    void close();
+
+    /// If it isn't known when opening
+    void setRobotName(const QString &robotName);
+
+    bool isOpen() const { return m_map != nullptr; }
+
+    void record(const RecordType type, const QBluetoothUuid &characteristic, const char *data = nullptr, const int size = 0);
+    void record(const RecordType type, const QBluetoothUuid &characteristic, const QByteArray &data) {
+        record(type, characteristic, data.constData(), data.size());
+    }
+
+    /// For importing from other formats, timestamp in microseconds since the start.
+    /// Should not be mixed with record(), and should not go backwards.
+    void recordAt(const uint64_t timestamp, const RecordType type, const QBluetoothUuid &characteristic, const char *data = nullptr, const int size = 0);
+
+private:
+    Q_DISABLE_COPY(Recorder)
+
+    uint8_t characteristicIndex(const uint64_t timestamp, const QBluetoothUuid &characteristic);
+    bool append(const uint64_t timestamp, const uint8_t type, const uint8_t characteristic, const char *data, const int size);
+    bool reserve(const uint64_t size);
+
+    QFile m_file;
+    uchar *m_map = nullptr;
+    uint64_t m_capacity = 0;
+    uint64_t m_used = 0;
+
+    QElapsedTimer m_clock;
+
+    std::array<QBluetoothUuid, maxCharacteristics> m_characteristics;
+    int m_characteristicCount = 0;
+};
+
+} // namespace capture
@@ -0,0 +1,217 @@
+#include "Replay.h"
+
+#include <QDebug>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace capture {
+
+// When not replaying in realtime, how many records to handle before letting
+// the event loop run (queued connections, timers in the handlers etc.)
+static constexpr int batchSize = 256;
+
+Replay::Replay(QObject *parent) :
+    Transport(parent)
+{
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout, this, &Replay::step);
+}
+
+Replay::~Replay()
+{
+    if (m_map) {
+        m_file.unmap(const_cast<uchar*>(m_map));
+    }
+}
+
+bool Replay::open(const QString &path)
+{
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed to open capture" << path << m_file.errorString();
+        return false;
+    }
+
+    const uint64_t fileSize = uint64_t(m_file.size());
+    if (fileSize < sizeof(FileHeader)) {
+        qWarning() << "Capture too small" << path << fileSize;
+        return false;
+    }
+
+    m_map = m_file.map(0, qint64(fileSize));
+    if (!m_map) {
+        qWarning() << "Failed to map capture" << path << m_file.errorString();
+        return false;
+    }
+
+    FileHeader header;
+    memcpy(&header, m_map, sizeof header);
+    if (memcmp(header.magic, fileMagic, sizeof header.magic) != 0) {
+        qWarning() << "Not a capture file" << path;
+        return false;
+    }
+    if (qFromLittleEndian(header.version) != fileVersion) {
+        qWarning() << "Unsupported capture version" << qFromLittleEndian(header.version);
+        return false;
+    }
+
+    m_offset = qFromLittleEndian(header.headerSize);
+    m_end = qMin(qFromLittleEndian(header.end), fileSize);
+    m_robotName = QString::fromUtf8(header.name, int(strnlen(header.name, sizeof header.name)));
+
+    // Go through it once first, so we know it is valid and how the characteristics were used
+    Record record;
+    bool first = true;
+    for (uint64_t offset = m_offset; offset < m_end; offset += sizeof(Record) + record.size) {
+        if (!readRecord(offset, &record)) {
+            qWarning() << "Truncated capture at" << offset << "expected end" << m_end;
+            m_end = offset;
+            break;
+        }
+        if (first) {
+            m_firstTimestamp = record.timestamp;
+            first = false;
+        }
+        if (record.type == DefineCharacteristic && record.characteristic != invalidCharacteristic) {
+            const QByteArray uuid(reinterpret_cast<const char*>(m_map + offset + sizeof(Record)), record.size);
+            m_characteristics[record.characteristic] = QBluetoothUuid(QUuid::fromRfc4122(uuid));
+        } else if (record.type == WriteWithoutResponse && record.characteristic != invalidCharacteristic) {
+            m_writtenWithoutResponse.insert(m_characteristics[record.characteristic]);
+        }
+    }
+
+    qDebug() << " - Opened capture of" << m_robotName << "with" << (m_end - m_offset) << "bytes of records";
+
+    m_open = true;
+    return true;
+}
+
+void Replay::start()
+{
+    if (!m_open) {
+        qWarning() << "Can't start replay, no capture open";
+        return;
+    }
+
+    m_records = 0;
+    m_writes = 0;
+    m_decodeStats.reset();
+    m_running = true;
+    m_clock.start();
+    m_timer.start(0);
+}
+
+bool Replay::canWriteWithoutResponse(const QBluetoothUuid &characteristic) const
+{
+    return m_writtenWithoutResponse.contains(characteristic);
+}
+
+void Replay::writeCharacteristic(const QBluetoothUuid &characteristic, const QByteArray &data, const QLowEnergyService::WriteMode mode)
+{
+    Q_UNUSED(characteristic);
+    Q_UNUSED(data);
+    Q_UNUSED(mode);
+
+    // The responses are in the capture already
+    m_writes++;
+}
+
+void Replay::step()
+{
+    int handled = 0;
+    Record record;
+    while (m_running && m_offset < m_end) {
+        if (!readRecord(m_offset, &record)) {
+            break;
+        }
+
+        if (m_realtime) {
+            const uint64_t due = record.timestamp - m_firstTimestamp;
+            const uint64_t now = uint64_t(m_clock.nsecsElapsed() / 1000);
+            if (due > now) {
+                m_timer.start(int((due - now + 999) / 1000));
+                return;
+            }
+        } else if (handled++ >= batchSize) {
+            m_timer.start(0);
+            return;
+        }
+
+        const char *data = reinterpret_cast<const char*>(m_map + m_offset + sizeof(Record));
+        m_offset += sizeof(Record) + record.size;
+        m_records++;
+
+        const QBluetoothUuid characteristic = record.characteristic != invalidCharacteristic ? m_characteristics[record.characteristic] : QBluetoothUuid();
+
+        switch (record.type) {
+        case Notification:
+            emit received(characteristic, QByteArray(data, record.size));
+            break;
+        case WriteAcknowledged:
+            emit written(characteristic);
+            break;
+        case WriteFailed:
+            emit writeFailed(characteristic);
+            break;
+        case Closed:
+            finish();
+            m_open = false;
+            emit closed();
+            return;
+        default:
+            // Definitions are already handled, and we don't care what was written
+            break;
+        }
+    }
+
+    finish();
+}
+
+bool Replay::readRecord(const uint64_t offset, Record *record) const
+{
+    if (offset + sizeof(Record) > m_end) {
+        return false;
+    }
+
+    memcpy(record, m_map + offset, sizeof(Record));
+    record->timestamp = qFromLittleEndian(record->timestamp);
+    record->size = qFromLittleEndian(record->size);
+
+    if (record->type >= RecordTypeCount) {
+        return false;
+    }
+
+    return offset + sizeof(Record) + record->size <= m_end;
+}
+
+void Replay::close()
+{
+    if (!m_open) {
+        return;
+    }
+    finish();
+    m_open = false;
+    emit closed();
+}
+
+void Replay::finish()
+{
+    if (!m_running) {
+        return;
+    }
+    m_running = false;
+    m_timer.stop();
+
+    const qint64 elapsed = m_clock.nsecsElapsed();
+    qDebug() << " - Replay finished," << m_records << "records in" << (elapsed / 1000000.) << "ms"
+             << "(" << (elapsed ? m_records * 1000000000. / elapsed : 0.) << "records/s )," << m_writes << "writes from handler";
+
+    if (m_decodeStats.frames() || m_decodeStats.failures()) {
+        qDebug().noquote() << m_decodeStats.report(elapsed);
+    }
+
+    emit finished();
+}
+
+} // namespace capture
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Transport.h"
+#include "DecodeStats.h"
+#include "Format.h"
+
+#include <QFile>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QSet>
+
+#include <array>
+
+namespace capture {
+
+/// Plays back a file from Recorder to whatever handler uses it as a
+/// Transport, either with the recorded timing or as fast as possible (for
+/// benchmarking the parsing and state handling).
+/// Notifications and write acknowledgements come from the capture, what the
+/// handler writes is only counted.
+class Replay : public Transport
+{
+    Q_OBJECT
+
+public:
+    explicit Replay(QObject *parent = nullptr);
+    ~Replay();
+
+    bool open(const QString &path);
+
+    /// Name of the robot that was recorded
+    QString robotName() const { return m_robotName; }
+
+    void setRealtime(const bool realtime) { m_realtime = realtime; }
+
+    /// For the handler to fill in, reported when done
+    DecodeStats *decodeStats() { return &m_decodeStats; }
+
+    /// Call after the handler is set up, starts from the next event loop iteration.
+    /// The transport stays open after the end, unless the robot disconnected during the capture.
+    void start();
+
+    bool isOpen() const override { return m_open; }
+    void close() override;
+    bool canWriteWithoutResponse(const QBluetoothUuid &characteristic) const override;
+
+signals:
+    void finished();
+
+protected:
+    void writeCharacteristic(const QBluetoothUuid &characteristic, const QByteArray &data, const QLowEnergyService::WriteMode mode) override;
+
+private slots:
+    void step();
+
+private:
+    bool readRecord(uint64_t offset, Record *record) const;
+    void finish();
+
+    QFile m_file;
+    const uchar *m_map = nullptr;
+    uint64_t m_end = 0;
+    uint64_t m_offset = 0;
+
+    QString m_robotName;
+    bool m_open = false;
+    bool m_running = false;
+    bool m_realtime = true;
+
+    std::array<QBluetoothUuid, maxCharacteristics> m_characteristics;
+    QSet<QBluetoothUuid> m_writtenWithoutResponse;
+
+    QTimer m_timer;
+    QElapsedTimer m_clock;
+    uint64_t m_firstTimestamp = 0;
+
+    uint64_t m_records = 0;
+    uint64_t m_writes = 0;
+
+    DecodeStats m_decodeStats;
+};
+
+} // namespace capture
@@ -2,25 +2,50 @@
 
 #include "mousr/MousrHandler.h"
 #include "sphero/SpheroHandler.h"
+#include "capture/Replay.h"
+#include "capture/BtSnoop.h"
+#include "SimulatedRobot.h"
+#include "LinkProfiles.h"
+#include "IoThread.h"
+#include "Logging.h"
+#include "Application.h"
 
 #include <QBluetoothDeviceDiscoveryAgent>
 #include <QDebug>
 #include <QQmlEngine>
 
+#include <ctime>
+
+static int64_t processCpuTime()
+{
+    return int64_t(std::clock()) * (1000000000 / CLOCKS_PER_SEC);
+}
+
 DeviceDiscoverer::DeviceDiscoverer(QObject *parent) :
     QObject(parent),
     m_scanning(false)
 {
+    m_statusTimeoutTimer.setSingleShot(true);
+    m_statusTimeoutTimer.setInterval(statusTimeout);
+    connect(&m_statusTimeoutTimer, &QTimer::timeout, this, &DeviceDiscoverer::updateStatus);
+
+    if (lcLoad().isInfoEnabled()) {
+        m_adapterCallsTimer.setInterval(1000);
+        connect(&m_adapterCallsTimer, &QTimer::timeout, this, &DeviceDiscoverer::reportAdapterCalls);
+        m_adapterCallsTimer.start();
+    }
+
     QMetaObject::invokeMethod(this, &DeviceDiscoverer::init);
 }
 
 void DeviceDiscoverer::init()
 {
     m_adapter = new QBluetoothLocalDevice(this);
-    m_adapter->setHostMode(QBluetoothLocalDevice::HostPoweredOff); // we need to do this because bluez is crap
+    m_knownRobots.load();
 
     connect(m_adapter, &QBluetoothLocalDevice::error, this, &DeviceDiscoverer::onAdapterError);
-    connect(this, &DeviceDiscoverer::availableDevicesChanged, this, &DeviceDiscoverer::statusStringChanged);
+    connect(m_adapter, &QBluetoothLocalDevice::hostModeStateChanged, this, &DeviceDiscoverer::onHostModeChanged);
+    connect(&m_availableDevices, &AvailableDevices::countChanged, this, &DeviceDiscoverer::updateStatus);
 
     // I hate these overload things..
     m_discoveryAgent = new QBluetoothDeviceDiscoveryAgent(this);
@@ -30,19 +55,70 @@ void DeviceDiscoverer::init()
 
     m_discoveryAgent->setLowEnergyDiscoveryTimeout(0);
 
-    if (m_adapter->hostMode() == QBluetoothLocalDevice::HostPoweredOff) {
-        connect(m_adapter, &QBluetoothLocalDevice::hostModeStateChanged, this, &DeviceDiscoverer::startScanning);
+    updateAdapterState();
+
+    // Bluez is crap, but we only power cycle it if the scan doesn't work, that takes a couple of seconds
+    if (!m_adapterValid) {
+        qWarning() << "No usable bluetooth adapter";
+    } else if (m_hostMode == QBluetoothLocalDevice::HostPoweredOff) {
+        qDebug() << "Adapter is off, powering on";
         m_adapter->powerOn();
+        m_adapterCalls++;
     } else {
         QMetaObject::invokeMethod(this, &DeviceDiscoverer::startScanning);
     }
 }
 
+void DeviceDiscoverer::powerCycle()
+{
+    if (m_powerCycling) {
+        return;
+    }
+    if (m_powerCycles >= maxPowerCycles) {
+        qWarning() << "Power cycled the adapter" << m_powerCycles << "times already, giving up";
+        return;
+    }
+    qDebug() << "Power cycling the adapter";
+
+    m_powerCycles++;
+    m_powerCycling = true;
+    stopScanning();
+    m_adapter->setHostMode(QBluetoothLocalDevice::HostPoweredOff);
+    m_adapterCalls++;
+}
+
+void DeviceDiscoverer::onHostModeChanged(const QBluetoothLocalDevice::HostMode mode)
+{
+    qDebug() << "Host mode changed" << mode;
+    updateAdapterState();
+
+    if (mode == QBluetoothLocalDevice::HostPoweredOff) {
+        if (m_powerCycling) {
+            m_adapter->powerOn();
+            m_adapterCalls++;
+        }
+        return;
+    }
+
+    m_powerCycling = false;
+    startScanning();
+}
+
 DeviceDiscoverer::~DeviceDiscoverer()
 {
     stopScanning();
-    if (m_device) {
-        m_device->deleteLater();
+
+    // Their threads won't get to deleteLater() when we are shutting down
+    for (DeviceProxy *device : m_connectedDevices.devices()) {
+        QObject *handler = device->handler();
+        device->detach();
+        IoThread *thread = qobject_cast<IoThread*>(handler->thread());
+        if (thread) {
+            thread->invoke([handler]() { delete handler; });
+            thread->wait();
+        } else {
+            delete handler;
+        }
     }
 }
 
@@ -51,14 +127,122 @@ QObject *DeviceDiscoverer::device()
     return m_device.data();
 }
 
-QString DeviceDiscoverer::statusString()
+void DeviceDiscoverer::setDevice(QObject *device)
+{
+    if (device == m_device) {
+        return;
+    }
+    if (device && m_connectedDevices.address(device).isEmpty()) {
+        qWarning() << "Not connected to" << device;
+        return;
+    }
+    m_device = device;
+    emit deviceChanged();
+}
+
+DeviceProxy *DeviceDiscoverer::startSession(const QString &address, const std::function<QObject*()> &factory)
+{
+    QObject *handler = nullptr;
+    if (m_ioThreads) {
+        IoThread *thread = new IoThread(address);
+        handler = thread->create(factory);
+        if (!handler) {
+            delete thread;
+        }
+    } else {
+        handler = factory();
+    }
+    if (!handler) {
+        return nullptr;
+    }
+
+    DeviceProxy *proxy = new DeviceProxy(handler, this);
+    QQmlEngine::setObjectOwnership(proxy, QQmlEngine::CppOwnership);
+
+    connect(proxy, &DeviceProxy::updated, this, [this, proxy, address](const QStringList &keys) {
+        if (keys.contains(QStringLiteral("isConnected")) && proxy->value(QStringLiteral("isConnected")).toBool()) {
+            onSessionConnected(address);
+        }
+    });
+    if (proxy->value(QStringLiteral("isConnected")).toBool()) { // already in the first snapshot
+        onSessionConnected(address);
+    }
+    m_connectedDevices.add(proxy, address);
+
+    // Show the first one, switching between them is up to the user
+    if (!m_device) {
+        m_device = proxy;
+        emit deviceChanged();
+    }
+
+    return proxy;
+}
+
+void DeviceDiscoverer::updateAdapterState()
+{
+    if (!m_adapter) {
+        return;
+    }
+
+    m_adapterValid = m_adapter->isValid();
+    m_hostMode = m_adapter->hostMode();
+    m_hasAdapters = !QBluetoothLocalDevice::allDevices().isEmpty();
+    m_adapterCalls += 3;
+
+    updateStatus();
+}
+
+void DeviceDiscoverer::updateStatus()
+{
+    const QString status = currentStatus();
+    const bool isError = m_adapterError != QBluetoothLocalDevice::NoError || !m_hasAdapters;
+    if (status == m_statusString && isError == m_isError && m_scanning == m_reportedScanning) {
+        return;
+    }
+
+    m_statusString = status;
+    m_isError = isError;
+    m_reportedScanning = m_scanning;
+    emit statusStringChanged();
+}
+
+void DeviceDiscoverer::reportAdapterCalls()
+{
+    qCInfo(lcLoad) << "Adapter D-Bus calls:" << m_adapterCalls << "/s";
+    m_adapterCalls = 0;
+}
+
+void DeviceDiscoverer::onSessionConnected(const QString &address)
+{
+    if (m_connectedSessions.contains(address)) {
+        return;
+    }
+    m_connectedSessions.insert(address);
+
+    if (!m_seenConnection) {
+        qInfo().noquote() << QStringLiteral("First robot connected %1 ms after startup").arg(Application::msecsSinceStartup());
+        m_seenConnection = true;
+    }
+
+    if (m_directConnects.contains(address)) {
+        qInfo().noquote() << QStringLiteral("Reconnected directly to %1 in %2 ms").arg(address).arg(m_directConnects.take(address).elapsed());
+        if (m_directConnects.isEmpty()) {
+            startScanning();
+        }
+    }
+}
+
+QString DeviceDiscoverer::currentStatus() const
 {
     if (m_lastDeviceStatusTimer.isValid() && m_lastDeviceStatusTimer.elapsed() < statusTimeout) {
         if (!m_lastDeviceStatus.isEmpty()) {
             return m_lastDeviceStatus;
         }
     }
-    if (!m_adapter->isValid()) {
+    if (!m_adapter) { // not initialized yet
+        return QString();
+    }
+    if (!m_adapterValid) {
         return tr("No bluetooth adaptors available\nPlease start BlueZ if on Linux.");
     }
 
@@ -73,7 +257,7 @@ QString DeviceDiscoverer::statusString()
             break;
         }
     }
-    if (m_adapter->hostMode() == QBluetoothLocalDevice::HostPoweredOff) {
+    if (m_hostMode == QBluetoothLocalDevice::HostPoweredOff) {
         return tr("Bluetooth turned off");
     }
 
@@ -92,15 +276,10 @@ QString DeviceDiscoverer::statusString()
     return QString();
 }
 
-QStringList DeviceDiscoverer::availableDevices() const
-{
-    return m_availableDevices.keys();
-}
-
 void DeviceDiscoverer::connectDevice(const QString &name)
 {
-    if (m_device) {
-        qWarning() << "already have device, not connecting to" << name;
+    if (m_connectedDevices.contains(name)) {
+        qWarning() << "already connected to" << name;
         return;
     }
 
@@ -109,53 +288,269 @@ void DeviceDiscoverer::connectDevice(const QString &name)
         return;
     }
 
-    stopScanning();
-
-    const QBluetoothDeviceInfo &device = m_availableDevices[name];
+    // We keep scanning, so more robots can be connected
+    const QBluetoothDeviceInfo device = m_availableDevices.take(name);
 
     const RobotType type = robotType(device);
     if (type == Mousr) {
-        mousr::MousrHandler *handler = new mousr::MousrHandler(device, this);
-        connect(handler, &mousr::MousrHandler::disconnected, this, &DeviceDiscoverer::onDeviceDisconnected);
-//        connect(handler, &mousr::MousrHandler::connectedChanged, this, &DeviceDiscoverer::onRobotStatusChanged); todo
-        m_device = handler;
+        m_knownRobots.remember({name, mousr::MousrHandler::deviceType(), device.name(), device.rssi()});
+    } else if (type == Sphero) {
+        m_knownRobots.remember({name, sphero::SpheroHandler::deviceType(), device.name(), device.rssi()});
+    }
+
+    connectTo(device, type);
+}
+
+void DeviceDiscoverer::disconnectDevice(QObject *device)
+{
+    DeviceProxy *proxy = qobject_cast<DeviceProxy*>(device);
+    const QString address = m_connectedDevices.address(proxy);
+    if (address.isEmpty()) {
+        qWarning() << "Not connected to" << device;
+        return;
+    }
+    m_disconnecting.insert(address);
+    proxy->call(QStringLiteral("disconnectFromRobot"));
+}
+
+bool DeviceDiscoverer::connectKnown(const QString &address)
+{
+    const KnownRobots::Robot *robot = m_knownRobots.find(address);
+    if (!robot || m_connectedDevices.contains(address)) {
+        return false;
+    }
+
+    const RobotType type = robot->deviceType == mousr::MousrHandler::deviceType() ? Mousr :
+                           robot->deviceType == sphero::SpheroHandler::deviceType() ? Sphero : Unknown;
+    if (type == Unknown) {
+        qWarning() << "Unknown type of known robot" << address << robot->deviceType;
+        return false;
+    }
+
+    qDebug() << "Connecting directly to" << robot->name << address;
+    if (!m_directConnects.contains(address)) {
+        m_directConnects[address].start();
+    }
+    m_reconnectWhenSeen.remove(address);
+    if (m_availableDevices.contains(address)) {
+        m_availableDevices.take(address);
+    }
+
+    // BlueZ can take a long time to give up
+    QTimer::singleShot(directConnectTimeout, this, &DeviceDiscoverer::startScanning);
+
+    connectTo(KnownRobots::deviceInfo(*robot), type);
+    return true;
+}
+
+void DeviceDiscoverer::connectTo(const QBluetoothDeviceInfo &device, const RobotType type)
+{
+    const QString address = device.address().toString();
+    if (type == Mousr) {
+        startSession(address, [this, device]() -> QObject* {
+            mousr::MousrHandler *handler = new mousr::MousrHandler(device, nullptr);
+            connect(handler, &mousr::MousrHandler::disconnected, this, &DeviceDiscoverer::onDeviceDisconnected);
+//            connect(handler, &mousr::MousrHandler::connectedChanged, this, &DeviceDiscoverer::onRobotStatusChanged); todo
+            return handler;
+        });
     } else if (type == Sphero) {
         qDebug() << "Found BB8";
 
-        sphero::SpheroHandler *handler = new sphero::SpheroHandler(device, this);
-        connect(handler, &sphero::SpheroHandler::disconnected, this, &DeviceDiscoverer::onDeviceDisconnected);
-        connect(handler, &sphero::SpheroHandler::statusMessageChanged, this, &DeviceDiscoverer::onRobotStatusChanged);
-        m_device = handler;
+        startSession(address, [this, device]() -> QObject* {
+            sphero::SpheroHandler *handler = new sphero::SpheroHandler(device, nullptr);
+            connect(handler, &sphero::SpheroHandler::disconnected, this, &DeviceDiscoverer::onDeviceDisconnected);
+            connect(handler, &sphero::SpheroHandler::statusMessageChanged, this, &DeviceDiscoverer::onRobotStatusChanged);
+            return handler;
+        });
     } else {
         qWarning() << "unknown device!" << device.name();
         Q_ASSERT(false);
-        return;
+    }
+}
+
+bool DeviceDiscoverer::replay(const QString &path, const bool realtime)
+{
+    if (m_connectedDevices.contains(path)) {
+        qWarning() << "already replaying" << path;
+        return false;
+    }
+    m_offline = true;
+
+    QString capturePath = path;
+    if (capture::BtSnoopImporter::isBtSnoop(path)) {
+        capturePath = path + QStringLiteral(".rcap");
+        capture::BtSnoopImporter importer;
+        if (!importer.convert(path, capturePath)) {
+            qWarning() << "Failed to import" << path;
+            return false;
+        }
     }
 
-    QQmlEngine::setObjectOwnership(m_device, QQmlEngine::CppOwnership);
-    emit deviceChanged();
+    // The replay timers need to be on the same thread as the handler
+    return startSession(path, [this, capturePath, realtime]() -> QObject* {
+        capture::Replay *capture = new capture::Replay;
+        if (!capture->open(capturePath)) {
+            delete capture;
+            return nullptr;
+        }
+        capture->setRealtime(realtime);
+
+        // We don't have the address or manufacturer data, so only the name to go by
+        const QString name = capture->robotName();
+        const RobotType type = sphero::typeFromName(name) != sphero::RobotType::Unknown ? Sphero :
+                               name.contains(QLatin1String("Mousr")) ? Mousr : Unknown;
+        QObject *ret = nullptr;
+        if (type == Mousr) {
+            mousr::MousrHandler *handler = new mousr::MousrHandler(capture, capture->robotName(), nullptr);
+            handler->setDecodeStats(capture->decodeStats());
+            connect(handler, &mousr::MousrHandler::disconnected, this, &DeviceDiscoverer::onDeviceDisconnected);
+            ret = handler;
+        } else if (type == Sphero) {
+            sphero::SpheroHandler *handler = new sphero::SpheroHandler(capture, capture->robotName(), nullptr);
+            handler->setDecodeStats(capture->decodeStats());
+            connect(handler, &sphero::SpheroHandler::disconnected, this, &DeviceDiscoverer::onDeviceDisconnected);
+            connect(handler, &sphero::SpheroHandler::statusMessageChanged, this, &DeviceDiscoverer::onRobotStatusChanged);
+            ret = handler;
+        } else {
+            qWarning() << "Unknown robot in capture" << capture->robotName();
+            delete capture;
+            return nullptr;
+        }
+
+        capture->start();
+
+        return ret;
+    }) != nullptr;
+}
+
+bool DeviceDiscoverer::simulate(const int count, const int sensorRate)
+{
+    if (count <= 0) {
+        qWarning() << "Invalid number of simulated robots" << count;
+        return false;
+    }
+    m_offline = true;
+
+    for (int i=0; i<count; i++) {
+        const SimulatedRobot::Protocol protocol = SimulatedRobot::Protocol(i % 3);
+
+        startSession(QStringLiteral("simulated-%1").arg(i), [this, protocol, sensorRate]() -> QObject* {
+            SimulatedRobot *robot = new SimulatedRobot(protocol);
+            robot->setMaxSensorRate(sensorRate);
+
+            if (protocol == SimulatedRobot::Mousr) {
+                // Streams orientation and battery at the max sensor rate by itself
+                mousr::MousrHandler *handler = new mousr::MousrHandler(robot, robot->name(), nullptr);
+                connect(handler, &mousr::MousrHandler::disconnected, this, &DeviceDiscoverer::onDeviceDisconnected);
+                return handler;
+            }
+
+            sphero::SpheroHandler *handler = new sphero::SpheroHandler(robot, robot->name(), nullptr);
+            connect(handler, &sphero::SpheroHandler::disconnected, this, &DeviceDiscoverer::onDeviceDisconnected);
+
+            // Queued after initializeRobot(), which sets up its own stream
+            QTimer::singleShot(0, handler, [handler, protocol, sensorRate]() {
+                const uint64_t sources = protocol == SimulatedRobot::SpheroV1 ?
+                            uint64_t(sphero::v1::SensorSource::AccelerometerAll | sphero::v1::SensorSource::GyroAll | sphero::v1::SensorSource::ImuAll) :
+                            uint64_t(sphero::v2::SensorSource::Accelerometer | sphero::v2::SensorSource::Gyro | sphero::v2::SensorSource::Attitude);
+                handler->setSensorStreaming(sources, sensorRate);
+            });
+            return handler;
+        });
+    }
+
+    m_simulationTimer.setInterval(5000);
+    connect(&m_simulationTimer, &QTimer::timeout, this, &DeviceDiscoverer::reportSimulation, Qt::UniqueConnection);
+    m_simulationTimer.start();
+    m_simulationClock.start();
+    m_simulationCpuTime = processCpuTime();
+    m_simulationFrames = 0;
+
+    return true;
+}
 
-    m_availableDevices.clear();
-    m_displayNames.clear();
-    emit availableDevicesChanged();
+void DeviceDiscoverer::reportSimulation()
+{
+    // From the snapshots, the handlers are busy on their own threads
+    uint64_t frames = 0;
+    int driving = 0, idle = 0; // what the simulated robots negotiated
+    for (const DeviceProxy *device : m_connectedDevices.devices()) {
+        const QVariantMap stats = device->value(QStringLiteral("linkStats")).toMap();
+        frames += stats.value(QStringLiteral("framesIn")).toULongLong() + stats.value(QStringLiteral("framesOut")).toULongLong();
+
+        const QString profile = stats.value(QStringLiteral("linkProfile")).toString();
+        if (profile == QLatin1String(LinkProfiles::name(LinkProfiles::Drive))) {
+            driving++;
+        } else if (profile == QLatin1String(LinkProfiles::name(LinkProfiles::Idle))) {
+            idle++;
+        }
+    }
 
+    const int64_t cpuTime = processCpuTime();
+    const int64_t elapsed = m_simulationClock.nsecsElapsed();
+    const uint64_t newFrames = frames > m_simulationFrames ? frames - m_simulationFrames : 0;
+    const int64_t newCpuTime = cpuTime - m_simulationCpuTime;
+    const int robots = qMax(m_connectedDevices.count(), 1);
+
+    qInfo().noquote() << QStringLiteral("%1 robots on %2: %3 frames/s, %4% CPU (%5% per robot), %6 µs CPU per frame, %7 driving %8 idle links")
+            .arg(robots)
+            .arg(m_ioThreads ? QStringLiteral("I/O threads") : QStringLiteral("the GUI thread"))
+            .arg(elapsed > 0 ? newFrames * 1000000000. / elapsed : 0., 0, 'f', 0)
+            .arg(elapsed > 0 ? newCpuTime * 100. / elapsed : 0., 0, 'f', 1)
+            .arg(elapsed > 0 ? newCpuTime * 100. / elapsed / robots : 0., 0, 'f', 2)
+            .arg(newFrames ? newCpuTime / 1000. / newFrames : 0., 0, 'f', 2)
+            .arg(driving)
+            .arg(idle);
+
+    m_simulationClock.restart();
+    m_simulationCpuTime = cpuTime;
+    m_simulationFrames = frames;
 }
 
 void DeviceDiscoverer::startScanning()
 {
+    if (m_offline) {
+        qDebug() << "Not using bluetooth, not scanning";
+        return;
+    }
     if (m_scanning) {
         qDebug() << "Already scanning";
         return;
     }
 
+    if (m_powerCycling) {
+        qDebug() << "Waiting for the adapter to power on";
+        return;
+    }
+
+    // Scanning is only a fallback for robots we already know, and slows down connecting
+    if (m_tryKnownRobots) {
+        m_tryKnownRobots = false;
+        for (const KnownRobots::Robot &robot : m_knownRobots.robots()) {
+            connectKnown(robot.address);
+        }
+    }
+    for (const QElapsedTimer &timer : qAsConst(m_directConnects)) {
+        if (timer.elapsed() < directConnectTimeout) {
+            qDebug() << "Waiting for direct connections before scanning" << m_directConnects.keys();
+            return;
+        }
+    }
+
     m_scanning = true;
-    disconnect(m_adapter, &QBluetoothLocalDevice::hostModeStateChanged, this, &DeviceDiscoverer::startScanning);
 
     qDebug() << "Starting scan";
     // This might immediately lead to the other things getting called, just fyi
     m_discoveryAgent->start(QBluetoothDeviceDiscoveryAgent::LowEnergyMethod);
 
-    emit statusStringChanged();
+    // Errors are handled in onAgentError, but sometimes it just silently doesn't start
+    if (m_scanning && !m_discoveryAgent->isActive() && m_discoveryAgent->error() == QBluetoothDeviceDiscoveryAgent::NoError) {
+        qWarning() << "Scan didn't start";
+        m_scanning = false;
+        powerCycle();
+    }
+
+    updateStatus();
 }
 
 void DeviceDiscoverer::stopScanning()
@@ -164,7 +559,7 @@ void DeviceDiscoverer::stopScanning()
 
     m_scanning = false;
     m_discoveryAgent->stop();
-    emit statusStringChanged();
+    updateStatus();
 }
 
 inline void debugVisibleDevices(const QBluetoothDeviceInfo &device)
@@ -209,38 +604,45 @@ inline void debugVisibleDevices(const QBluetoothDeviceInfo &device)
 
 void DeviceDiscoverer::onDeviceDiscovered(const QBluetoothDeviceInfo &device)
 {
-    if (m_device) {
-        qWarning() << "already have device, not checkking" << device.name();
+    m_powerCycles = 0; // the adapter works
+
+    const QString deviceAddress = device.address().toString();
+    if (m_connectedDevices.contains(deviceAddress)) {
         return;
     }
 
-    QString deviceName = device.name();
-    const QString deviceAddress = device.address().toString();
+    // Lost it and couldn't connect directly, so it was probably out of range
+    if (m_reconnectWhenSeen.contains(deviceAddress)) {
+        qDebug() << "Lost robot is back" << deviceAddress;
+        connectKnown(deviceAddress);
+        return;
+    }
 
+    QString deviceName = device.name();
+    QString deviceType;
 
     switch(DeviceDiscoverer::robotType(device)) {
     case Sphero:
         deviceName = sphero::displayName(deviceName);
+        deviceType = sphero::SpheroHandler::deviceType();
         break;
     case Mousr:
         // TODO: figure out how to get the Real™ name
+        deviceType = mousr::MousrHandler::deviceType();
         break;
     case Unknown:
         return;
     }
 
-    if (m_displayNames.value(deviceAddress) == deviceName) {
-        qDebug() << "Already had" << m_displayNames.value(deviceAddress) << deviceName;
-        emit signalStrengthChanged(deviceAddress, rssiToStrength(device.rssi()));
-        return;
+    if (!m_seenAdvert) {
+        qInfo().noquote() << QStringLiteral("First robot advert %1 ms after startup").arg(Application::msecsSinceStartup());
+        m_seenAdvert = true;
     }
 
-    m_displayNames[deviceAddress] = deviceName;
-
-    m_availableDevices[deviceAddress] = device;
-    emit availableDevicesChanged();
-
-    emit signalStrengthChanged(deviceAddress, rssiToStrength(device.rssi()));
+    // Only new ones get a row, the rest just update the ones they have
+    if (!m_availableDevices.update(device, deviceName, deviceType)) {
+        return;
+    }
 
 #ifndef NDEBUG
     debugVisibleDevices(device);
@@ -260,32 +662,75 @@ void DeviceDiscoverer::onDeviceUpdated(const QBluetoothDeviceInfo &device, QBlue
     }
     qDebug() << "device updated" << device.name() << device.address().toString() << device.rssi() << fields;
 
+    // We keep scanning while connected, so robots that disconnected only show up as updates
+    const QString deviceAddress = device.address().toString();
+    if (!m_availableDevices.contains(deviceAddress) && !m_connectedDevices.contains(deviceAddress)) {
+        onDeviceDiscovered(device);
+        return;
+    }
+
     if (fields & QBluetoothDeviceInfo::Field::RSSI) {
-        emit signalStrengthChanged(device.address().toString(), rssiToStrength(device.rssi()));
+        m_availableDevices.updateRssi(deviceAddress, device.rssi());
     }
 }
 
 void DeviceDiscoverer::onDeviceDisconnected()
 {
-    qDebug() << "device disconnected";
+    QObject *handler = sender();
+    DeviceProxy *proxy = m_connectedDevices.proxyFor(handler);
+    const QString address = m_connectedDevices.address(proxy);
+    qDebug() << "device disconnected" << address;
+
+    if (!proxy) {
+        qWarning() << "device disconnected, but we don't know it?";
+        return;
+    }
 
-    if (m_device) {
-        m_device->deleteLater();
-        disconnect(m_device, nullptr, this, nullptr);
-        m_device = nullptr;
+    disconnect(handler, nullptr, this, nullptr);
+    m_connectedDevices.remove(proxy);
+    if (m_device == proxy) {
+        m_device = m_connectedDevices.at(0);
         emit deviceChanged();
-    } else {
-        qWarning() << "device disconnected, but is not set?";
     }
 
-    m_availableDevices.clear();
-    emit availableDevicesChanged();
+    // QML might still have it for a bit, so it needs to stop touching the handler first
+    proxy->detach();
+    proxy->deleteLater();
+    handler->deleteLater();
+
+    const bool wasConnected = m_connectedSessions.remove(address);
+    const bool wasDirect = m_directConnects.contains(address);
+    const bool expected = m_disconnecting.remove(address);
+    if (expected) {
+        qDebug() << "Disconnected on purpose";
+        m_directConnects.remove(address);
+        QMetaObject::invokeMethod(this, &DeviceDiscoverer::startScanning);
+        return;
+    }
 
     if (m_lastDeviceStatus.isEmpty() || !m_lastDeviceStatusTimer.isValid() || m_lastDeviceStatusTimer.elapsed() > deviceStatusTimeout) {
         m_lastDeviceStatus = tr("Unexpected disconnect from device");
         m_lastDeviceStatusTimer.restart();
+        m_statusTimeoutTimer.start();
+    }
+    updateStatus();
+
+    if (wasConnected && m_knownRobots.contains(address)) {
+        // Straight back, without waiting for it to show up in a scan
+        m_directConnects[address].start();
+        QMetaObject::invokeMethod(this, [this, address]() {
+            if (!connectKnown(address)) {
+                m_directConnects.remove(address);
+                startScanning();
+            }
+        }, Qt::QueuedConnection);
+        return;
+    }
+
+    if (wasDirect) {
+        qDebug() << "Direct connection to" << address << "failed after" << m_directConnects.take(address).elapsed() << "ms, scanning for it";
+        m_reconnectWhenSeen.insert(address);
     }
-    emit statusStringChanged();
 
     QMetaObject::invokeMethod(this, &DeviceDiscoverer::startScanning); // otherwise we might loop, because qbluetooth-crap caches
 }
@@ -294,48 +739,40 @@ void DeviceDiscoverer::onAgentError()
 {
     qDebug() << "agent error" << m_discoveryAgent->errorString();
 
-    if (m_discoveryAgent->error() == QBluetoothDeviceDiscoveryAgent::PoweredOffError && m_adapterError != QBluetoothLocalDevice::NoError) {
+    // It stops on errors
+    m_scanning = false;
+
+    switch(m_discoveryAgent->error()) {
+    case QBluetoothDeviceDiscoveryAgent::PoweredOffError:
         qDebug() << "Device powered off, trying to power on";
         m_adapter->powerOn();
+        m_adapterCalls++;
+        break;
+    case QBluetoothDeviceDiscoveryAgent::InputOutputError:
+    case QBluetoothDeviceDiscoveryAgent::UnknownError:
+        powerCycle();
+        break;
+    default:
+        break;
     }
 
-    emit statusStringChanged();
+    // Might be because the adapter went away
+    updateAdapterState();
 }
 
 void DeviceDiscoverer::onAdapterError(const QBluetoothLocalDevice::Error error)
 {
     qWarning() << "adapter error" << error;
     m_adapterError = error;
-    emit statusStringChanged();
+    updateAdapterState();
 }
 
 void DeviceDiscoverer::onRobotStatusChanged(const QString &message)
 {
     m_lastDeviceStatus = message;
     m_lastDeviceStatusTimer.restart();
-}
-
-float DeviceDiscoverer::signalStrength(const QString &name)
-{
-    if (!m_availableDevices.contains(name)) {
-        qWarning() << "Unknown device" << name;
-        return 0;
-    }
-    return rssiToStrength(m_availableDevices[name].rssi());
-}
-
-QColor DeviceDiscoverer::displayColor(const QString &name)
-{
-    static constexpr int maxHue = 360;
-    return QColor::fromHsv(uint16_t(qHash(name)) % maxHue, 255, 255, 32);
-}
-
-QString DeviceDiscoverer::displayName(const QString &name)
-{
-    if (!m_displayNames.contains(name)) {
-        return name;
-    }
-    return m_displayNames[name];
+    m_statusTimeoutTimer.start();
+    updateStatus();
 }
 
 DeviceDiscoverer::RobotType DeviceDiscoverer::robotType(const QBluetoothDeviceInfo &device)
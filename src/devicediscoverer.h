@@ -1,6 +1,10 @@
 #ifndef DEVICEDISCOVERER_H
 #define DEVICEDISCOVERER_H
 
+#include "AvailableDevices.h"
+#include "ConnectedDevices.h"
+#include "KnownRobots.h"
+
 #include <QObject>
 #include <QBluetoothLocalDevice>
 #include <QBluetoothDeviceInfo>
@@ -8,6 +12,9 @@
 #include <QTimer>
 #include <QElapsedTimer>
 #include <QColor>
+#include <QSet>
+
+#include <functional>
 
 namespace mousr {
 class MousrHandler;
@@ -22,12 +29,15 @@ class DeviceDiscoverer : public QObject
 {
     Q_OBJECT
     Q_PROPERTY(QString statusString READ statusString NOTIFY statusStringChanged)
-    Q_PROPERTY(QObject* device READ device NOTIFY deviceChanged)
+    Q_PROPERTY(QObject* device READ device WRITE setDevice NOTIFY deviceChanged) // the one being shown
+    Q_PROPERTY(QAbstractItemModel* connectedDevices READ connectedDevices CONSTANT)
     Q_PROPERTY(bool isError READ isError NOTIFY statusStringChanged) // yeye
     Q_PROPERTY(bool isScanning READ isScanning NOTIFY statusStringChanged) // yeye
-    Q_PROPERTY(QStringList availableDevices READ availableDevices NOTIFY availableDevicesChanged)
+    Q_PROPERTY(QAbstractItemModel* availableDevices READ availableDevices CONSTANT)
 
     static constexpr int statusTimeout = 5000;
+    static constexpr int maxPowerCycles = 2; // in a row, without seeing anything
+    static constexpr int directConnectTimeout = 5000; // before we start scanning anyways
     static constexpr int deviceStatusTimeout = 20000;
 public:
     enum RobotType {
@@ -39,28 +49,40 @@ public:
     ~DeviceDiscoverer();
 
     QObject *device();
+    void setDevice(QObject *device);
 
-    QString statusString();
+    ConnectedDevices *connectedDevices() { return &m_connectedDevices; }
 
-    bool isError() const { return m_adapterError != QBluetoothLocalDevice::NoError || QBluetoothLocalDevice::allDevices().isEmpty(); }
+    // Cached, QML reads these a lot and asking BlueZ means a D-Bus round trip
+    QString statusString() const { return m_statusString; }
+    bool isError() const { return m_isError; }
 
-    QStringList availableDevices() const;
+    AvailableDevices *availableDevices() { return &m_availableDevices; }
 
     bool isScanning() const { return m_scanning; }
 
     static RobotType robotType(const QBluetoothDeviceInfo &device);
 
+    /// Run the handlers on the GUI thread instead of their own, to compare
+    void setIoThreads(const bool enabled) { m_ioThreads = enabled; }
+
 public slots:
     void connectDevice(const QString &name);
-    float signalStrength(const QString &name);
-    QString displayName(const QString &name);
-    static QColor displayColor(const QString &name);
+
+    /// So we know not to reconnect automatically
+    void disconnectDevice(QObject *device);
+
+    /// Uses a capture from capture::Recorder instead of a real robot
+    bool replay(const QString &path, const bool realtime);
+
+    /// Connects to this many SimulatedRobots (Sphero V1, V2 and Mousr in turn)
+    /// streaming sensor data, and logs the CPU use per robot every few seconds
+    bool simulate(const int count, const int sensorRate);
+    static QColor displayColor(const QString &address) { return AvailableDevices::displayColor(address); }
 
 signals:
     void statusStringChanged();
     void deviceChanged();
-    void availableDevicesChanged();
-    void signalStrengthChanged(const QString &deviceName, float strength);
 
 private slots:
     void init();
@@ -77,21 +99,70 @@ private slots:
 
     void onRobotStatusChanged(const QString &message);
 
+    void onHostModeChanged(const QBluetoothLocalDevice::HostMode mode);
+    void updateAdapterState(); // the only place that asks the adapter, when it tells us something changed
+    void updateStatus();
+    void reportAdapterCalls();
+
+    void reportSimulation();
+
 private:
+    /// Creates the handler (and transport) with the factory on a new IoThread
+    DeviceProxy *startSession(const QString &address, const std::function<QObject*()> &factory);
+
+    QString currentStatus() const;
+
+    void connectTo(const QBluetoothDeviceInfo &device, const RobotType type);
+
+    /// Connects by address without waiting for an advert, returns false if it isn't known
+    bool connectKnown(const QString &address);
+    void onSessionConnected(const QString &address);
+
+    /// Only when it seems broken, it takes a couple of seconds
+    void powerCycle();
+
     QPointer<QObject> m_device;
+    ConnectedDevices m_connectedDevices;
+    bool m_offline = false; // replaying or simulating, so no scanning
+    bool m_ioThreads = true;
+
+    QTimer m_simulationTimer;
+    QElapsedTimer m_simulationClock;
+    int64_t m_simulationCpuTime = 0;
+    uint64_t m_simulationFrames = 0;
 
     QPointer<QBluetoothDeviceDiscoveryAgent> m_discoveryAgent;
     QPointer<QBluetoothLocalDevice> m_adapter;
     QBluetoothLocalDevice::Error m_adapterError = QBluetoothLocalDevice::NoError;
+    QBluetoothLocalDevice::HostMode m_hostMode = QBluetoothLocalDevice::HostPoweredOff;
+    bool m_adapterValid = false;
+    bool m_hasAdapters = false;
+    uint32_t m_adapterCalls = 0; // that go to BlueZ, for robot.load
+    QTimer m_adapterCallsTimer;
+    bool m_powerCycling = false;
+    int m_powerCycles = 0;
+    bool m_seenAdvert = false; // since startup, for the startup timing
+    bool m_seenConnection = false;
     bool m_adapterPoweredOn = false;
     bool m_attemptingScan = false;
     bool m_hasDevices = false;
     bool m_scanning = false;
-    QHash<QString, QBluetoothDeviceInfo> m_availableDevices;
-    QHash<QString, QString> m_displayNames;
+    AvailableDevices m_availableDevices;
+
+    KnownRobots m_knownRobots;
+    bool m_tryKnownRobots = true; // on startup, before scanning
+    QHash<QString, QElapsedTimer> m_directConnects; // scanning waits for these, timed from when we lost it (or startup)
+    QSet<QString> m_reconnectWhenSeen; // lost, and the direct connection failed
+    QSet<QString> m_connectedSessions; // reached isConnected
+    QSet<QString> m_disconnecting; // on purpose
 
     QString m_lastDeviceStatus;
     QElapsedTimer m_lastDeviceStatusTimer;
+    QTimer m_statusTimeoutTimer;
+
+    QString m_statusString;
+    bool m_isError = false;
+    bool m_reportedScanning = false;
 };
 
 #endif // DEVICEDISCOVERER_H
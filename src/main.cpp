@@ -2,20 +2,55 @@
 #include "mousr/MousrHandler.h"
 #include "sphero/SpheroHandler.h"
 #include "Cursor.h"
+#include "Application.h"
 
-#include <QGuiApplication>
+#include <QCommandLineParser>
 #include <QQmlApplicationEngine>
 
 int main(int argc, char *argv[])
 {
-    QGuiApplication app(argc, argv);
+    Application app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    const QCommandLineOption replayOption("replay", "Replay a session recorded with $ROBOT_CAPTURE_DIR set, or a btsnoop file (e. g. from btmon -w), instead of connecting to a robot.", "file");
+    const QCommandLineOption fastOption("fast", "Replay as fast as possible instead of with the recorded timing.");
+    const QCommandLineOption simulateOption("simulate", "Connect to this many simulated robots instead of real ones, and log the CPU use per robot.", "count");
+    const QCommandLineOption sensorRateOption("sensor-rate", "Sensor streaming rate in Hz for the simulated robots.", "hz", "100");
+    const QCommandLineOption guiThreadOption("gui-thread-io", "Handle the robots on the GUI thread instead of one thread each, for comparing (see robot.load).");
+    parser.addOption(replayOption);
+    parser.addOption(fastOption);
+    parser.addOption(simulateOption);
+    parser.addOption(sensorRateOption);
+    parser.addOption(guiThreadOption);
+    parser.process(app);
+
+    // Static so the singleton callback can get to them
+    static QString replayFile;
+    static bool replayRealtime;
+    static int simulatedRobots;
+    static int sensorRate;
+    static bool ioThreads;
+    replayFile = parser.value(replayOption);
+    replayRealtime = !parser.isSet(fastOption);
+    simulatedRobots = parser.value(simulateOption).toInt();
+    sensorRate = parser.value(sensorRateOption).toInt();
+    ioThreads = !parser.isSet(guiThreadOption);
 
     qmlRegisterUncreatableType<mousr::MousrHandler>("com.iskrembilen", 1, 0, "MousrHandler", "Only valid when discovered");
     qmlRegisterUncreatableType<mousr::AutoplayConfig>("com.iskrembilen", 1, 0, "AutoplayConfig", "Only for enums and stuff");
     qmlRegisterUncreatableType<sphero::SpheroHandler>("com.iskrembilen", 1, 0, "SpheroHandler", "Only valid when discovered");
 
     qmlRegisterSingletonType<DeviceDiscoverer>("com.iskrembilen", 1, 0, "DeviceDiscoverer", [](QQmlEngine *, QJSEngine*) -> QObject* {
-        return new DeviceDiscoverer;
+        DeviceDiscoverer *discoverer = new DeviceDiscoverer;
+        discoverer->setIoThreads(ioThreads);
+        if (!replayFile.isEmpty()) {
+            discoverer->replay(replayFile, replayRealtime);
+        }
+        if (simulatedRobots > 0) {
+            discoverer->simulate(simulatedRobots, sensorRate);
+        }
+        return discoverer;
     });
     qmlRegisterSingletonType<Cursor>("com.iskrembilen", 1, 0, "Cursor", [](QQmlEngine *, QJSEngine *) -> QObject * {
         return new Cursor;
@@ -79,6 +79,13 @@ public:
         };
     }
 
+    static QStringList drivingModeNames() {
+        return {
+            "Straight",
+            "Snaking"
+        };
+    }
+
     ///////////////////////
     /// Actual contents ///
     ///////////////////////
@@ -2,7 +2,10 @@
 #include <QDebug>
 
 #include "MousrHandler.h"
+#include "Uuids.h"
+#include "BleTransport.h"
 #include "utils.h"
+#include "Logging.h"
 
 #include <QLowEnergyController>
 #include <QLowEnergyConnectionParameters>
@@ -11,26 +14,31 @@
 #include <QQmlEngine>
 #include <QSettings>
 
+#include <cstddef>
+#include <cstring>
+#include <optional>
+#include <chrono>
+
 namespace mousr {
 
-bool MousrHandler::sendCommandPacket(const CommandPacket &packet)
+bool MousrHandler::sendCommandPacket(const CommandPacket &packet, const TransmitQueue::Priority priority)
 {
-    qDebug() << " + Sending packet" << packet.m_command;
+    TRACE(lcMousrTx) << " + Sending packet" << packet.m_command;
     if (!isConnected()) {
         qWarning() << "trying to send when unconnected";
         return false;
     }
     const QByteArray buffer(reinterpret_cast<const char*>(&packet), sizeof(CommandPacket));
 
-    qDebug() << "  - Writing" << buffer.toHex(':');
-    m_service->writeCharacteristic(m_writeCharacteristic, buffer);
+    TRACE(lcMousrTx) << "  - Writing" << HexDump(buffer);
+    m_transmitQueue.enqueue(priority, buffer);
 
     return true;
 }
 
 bool MousrHandler::sendCommand(const CommandType command, const float arg1, const float arg2, const float arg3)
 {
-    qDebug() << " + Sending command with float args" << command;
+    TRACE(lcMousrTx) << " + Sending command with float args" << command;
     if (!isConnected()) {
         qWarning() << "trying to send when unconnected";
         return false;
@@ -47,7 +55,7 @@ bool MousrHandler::sendCommand(const CommandType command, const float arg1, cons
 
 bool MousrHandler::sendCommand(const CommandType command, const uint32_t arg1, const uint32_t arg2)
 {
-    qDebug() << " + Sending command with int args" << command;
+    TRACE(lcMousrTx) << " + Sending command with int args" << command;
     if (!isConnected()) {
         qWarning() << "trying to send when unconnected";
         return false;
@@ -63,7 +71,7 @@ bool MousrHandler::sendCommand(const CommandType command, const uint32_t arg1, c
 
 bool MousrHandler::sendCommand(const CommandType command)
 {
-    qDebug() << " + Sending" << command;
+    TRACE(lcMousrTx) << " + Sending" << command;
     if (!isConnected()) {
         qWarning() << "trying to send when unconnected";
         return false;
@@ -116,27 +124,24 @@ void MousrHandler::sendInput()
     const bool speedChanged = !qFuzzyCompare(m_currentInput.speed, m_newInput.speed);
     const bool heldChanged = !qFuzzyCompare(m_currentInput.held, m_newInput.held);
     if (!angleChanged && !speedChanged && !heldChanged) {
-        qDebug() << " ! Nothing in the input changed";
+        TRACE(lcMousrTx) << " ! Nothing in the input changed";
         return;
     }
 
-    if (1) {
-        qDebug() << " + Sending updated input";
-        qDebug() << "  - Previous:";
-        if (angleChanged) qDebug() << "   - angle:" << m_currentInput.angle;
-        if (speedChanged) qDebug() << "   - speed:" << m_currentInput.speed;
-        if (heldChanged) qDebug() << "   - held:" << m_currentInput.held;
+    TRACE(lcMousrTx) << " + Sending updated input, angle:" << m_currentInput.angle << "->" << m_newInput.angle
+                     << "speed:" << m_currentInput.speed << "->" << m_newInput.speed
+                     << "held:" << m_currentInput.held << "->" << m_newInput.held;
 
-        qDebug() << "  - New:";
-        if (angleChanged) qDebug() << "   - angle:" << m_newInput.angle;
-        if (speedChanged) qDebug() << "   - speed:" << m_newInput.speed;
-        if (heldChanged) qDebug() << "   - held:" << m_newInput.held;
+    if (!isConnected()) {
+        qWarning() << "trying to send input when unconnected";
+        return;
     }
 
     CommandPacket packet(CommandType::Move);
     packet.input = m_newInput;
     m_currentInput = m_newInput;
-    sendCommandPacket(packet);
+    m_linkProfiles.onActivity();
+    m_motionWriter.write(QByteArray(reinterpret_cast<const char*>(&packet), sizeof(CommandPacket)));
 }
 
 void MousrHandler::sendAutoplay()
@@ -156,6 +161,7 @@ void MousrHandler::sendDriverAssistConfig()
 void MousrHandler::resetHeading()
 {
     m_sendInputTimer.stop();
+    m_motionWriter.clear();
     m_currentInput.reset();
     m_newInput.reset();
 
@@ -167,20 +173,29 @@ void MousrHandler::resetHeading()
 void MousrHandler::stop()
 {
     m_sendInputTimer.stop();
+    m_motionWriter.clear();
 
     m_newInput.speed = 0.f;
 
     m_currentInput = m_newInput;
+    m_transmitQueue.clear(TransmitQueue::Motion);
 
     CommandPacket packet(CommandType::Stop);
     packet.input = m_newInput;
-    sendCommandPacket(packet);
+    sendCommandPacket(packet, TransmitQueue::Safety);
 
     emit inputChanged();
 }
 
 void MousrHandler::onInitComplete()
 {
+    if (m_serviceChangedWatcher) {
+        qInfo().noquote() << QStringLiteral("%1 ready to drive %2 ms after connecting").arg(m_name).arg(m_connectTimer.elapsed());
+        m_serviceChangedWatcher->watch(m_deviceController);
+    }
+
+    m_linkProfiles.start();
+
     // We can't read this from the device, so make sure we are in sync by always settings it
     if (!sendCommand(CommandType::SoundVolume, m_volume)) {
         qWarning() << "Failed to set sound volume";
@@ -206,6 +221,7 @@ void MousrHandler::flip()
 void MousrHandler::flickTail()
 {
     m_sendInputTimer.stop();
+    m_motionWriter.clear();
     m_currentInput.reset();
     m_newInput.reset();
 
@@ -218,23 +234,10 @@ MousrHandler::MousrHandler(const QBluetoothDeviceInfo &deviceInfo, QObject *pare
     QObject(parent),
     m_name(deviceInfo.name())
 {
-    QSettings settings;
-    settings.beginGroup("mousr");
-    m_volume = settings.value("volume", 25).toInt();
+    setup();
 
-    m_newAutoConfig = AutoplayConfig::createConfig(AutoplayConfig::OpenWanderAggressive);
-    qDebug() << m_newAutoConfig;
-    // In case the UI asks us to update more than 100 times a second
-    m_sendInputTimer.setInterval(10);
-    m_sendInputTimer.setSingleShot(true);
-    connect(this, &MousrHandler::inputChanged, &m_sendInputTimer, [this]() {
-        if (!m_sendInputTimer.isActive()) {
-            m_sendInputTimer.start();
-        }
-    });
-    connect(&m_sendInputTimer, &QTimer::timeout, this, &MousrHandler::sendInput);
-
-    connect(this, &MousrHandler::driverAssistChanged, this, &MousrHandler::sendDriverAssistConfig);
+    m_connectTimer.start();
+    m_serviceChangedWatcher = new ServiceChangedWatcher(this);
 
     m_deviceController = QLowEnergyController::createCentral(deviceInfo, this);
 
@@ -256,18 +259,152 @@ MousrHandler::MousrHandler(const QBluetoothDeviceInfo &deviceInfo, QObject *pare
     connect(m_deviceController, QOverload<QLowEnergyController::Error>::of(&QLowEnergyController::error), this, &MousrHandler::onControllerError);
 
     connect(m_deviceController, &QLowEnergyController::stateChanged, this, &MousrHandler::onControllerStateChanged);
+
+    m_deviceController->connectToDevice();
+
+    if (m_deviceController->error() != QLowEnergyController::NoError) {
+        qDebug() << "controller error when starting:" << m_deviceController->error() << m_deviceController->errorString();
+    }
+}
+
+MousrHandler::MousrHandler(Transport *transport, const QString &name, QObject *parent) :
+    QObject(parent),
+    m_name(name)
+{
+    setup();
+
+    transport->setParent(this);
+    setTransport(transport);
+
+    // Nothing else is going to tell us
+    connect(transport, &Transport::closed, this, [this]() {
+        onControllerStateChanged(QLowEnergyController::UnconnectedState);
+    });
+
+    // Give whoever created us a chance to connect to our signals first
+    QMetaObject::invokeMethod(this, &MousrHandler::initializeRobot, Qt::QueuedConnection);
+}
+
+void MousrHandler::setup()
+{
+    QSettings settings;
+    settings.beginGroup("mousr");
+    m_volume = settings.value("volume", 25).toInt();
+
+    m_newAutoConfig = AutoplayConfig::createConfig(AutoplayConfig::OpenWanderAggressive);
+    qDebug() << m_newAutoConfig;
+    // In case the UI asks us to update more than 100 times a second
+    m_sendInputTimer.setInterval(10);
+    m_sendInputTimer.setSingleShot(true);
+    connect(this, &MousrHandler::inputChanged, &m_sendInputTimer, [this]() {
+        if (!m_sendInputTimer.isActive()) {
+            m_sendInputTimer.start();
+        }
+    });
+    connect(&m_sendInputTimer, &QTimer::timeout, this, &MousrHandler::sendInput);
+
+    m_writeClock.start();
+    m_latencyTimer.setInterval(1000);
+    m_latencyTimer.setSingleShot(true);
+    connect(&m_latencyTimer, &QTimer::timeout, this, &MousrHandler::latenciesChanged);
+
+    m_linkStatsTimer.setInterval(1000);
+    connect(&m_linkStatsTimer, &QTimer::timeout, this, &MousrHandler::onLinkStatsTimer);
+
+    m_transmitQueue.setWriter([this](const QByteArray &buffer, const QLowEnergyService::WriteMode mode) {
+        if (!m_transport) {
+            return;
+        }
+        if (mode == QLowEnergyService::WriteWithResponse && buffer.size() >= int(sizeof(CommandPacket))) {
+            // Shouldn't happen, but don't grow forever if the acknowledgements never arrive
+            if (m_pendingWrites.size() >= 64) {
+                m_pendingWrites.pop_front();
+            }
+            CommandType command;
+            memcpy(&command, buffer.constData() + offsetof(CommandPacket, m_command), sizeof command);
+            m_pendingWrites.push_back({uint16_t(command), m_writeClock.nsecsElapsed()});
+        }
+        m_linkStats.traffic.bytesOut += uint64_t(buffer.size());
+        m_linkStats.traffic.framesOut++;
+        m_transport->write(Characteristics::write, buffer, mode);
+    });
+    m_motionWriter.setWriter([this](const QByteArray &buffer) {
+        const QLowEnergyService::WriteMode mode = (m_transport && m_transport->canWriteWithoutResponse(Characteristics::write)) ?
+                    QLowEnergyService::WriteWithoutResponse : QLowEnergyService::WriteWithResponse;
+        m_transmitQueue.enqueue(TransmitQueue::Motion, buffer, mode);
+    });
+
+    connect(this, &MousrHandler::driverAssistChanged, this, &MousrHandler::sendDriverAssistConfig);
+
     connect(this, &MousrHandler::initComplete, this, &MousrHandler::resetHeading);
     connect(this, &MousrHandler::initComplete, this, &MousrHandler::sendDriverAssistConfig);
     connect(this, &MousrHandler::initComplete, this, &MousrHandler::resetTail);
     connect(this, &MousrHandler::initComplete, this, &MousrHandler::onInitComplete);
 
-    m_deviceController->connectToDevice();
+    // Everything that is in the RobotState
+    connect(this, &MousrHandler::connectedChanged, this, &MousrHandler::publishState);
+    connect(this, &MousrHandler::powerChanged, this, &MousrHandler::publishState);
+    connect(this, &MousrHandler::autoRunningChanged, this, &MousrHandler::publishState);
+    connect(this, &MousrHandler::orientationChanged, this, &MousrHandler::publishState);
+    connect(this, &MousrHandler::sensorDirtyChanged, this, &MousrHandler::publishState);
+    connect(this, &MousrHandler::stuckChanged, this, &MousrHandler::publishState);
+    connect(this, &MousrHandler::inputChanged, this, &MousrHandler::publishState);
+}
 
-    if (m_deviceController->error() != QLowEnergyController::NoError) {
-        qDebug() << "controller error when starting:" << m_deviceController->error() << m_deviceController->errorString();
+void MousrHandler::publishState()
+{
+    RobotState state;
+    state.version = ++m_stateVersion;
+    state.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    // Same as the views use them
+    state.orientation.pitch = m_rotation.y;
+    state.orientation.roll = m_rotation.x;
+    state.orientation.yaw = m_rotation.z;
+    state.tailRotation = tailRotation();
+
+    state.speed = m_newInput.speed;
+    state.heading = m_newInput.angle;
+    state.voltage = m_voltage;
+
+    state.set(RobotState::Connected, isConnected());
+    state.set(RobotState::Charging, m_charging);
+    state.set(RobotState::BatteryLow, m_batteryLow);
+    state.set(RobotState::FullyCharged, m_fullyCharged);
+    state.set(RobotState::Flipped, m_isFlipped);
+    state.set(RobotState::AutoRunning, m_isAutoActive);
+    state.set(RobotState::Stuck, m_isStuck);
+    state.set(RobotState::SensorDirty, m_sensorDirty);
+
+    m_state.store(state);
+}
+
+void MousrHandler::setDecodeStats(DecodeStats *stats)
+{
+    m_decodeStats = stats;
+    if (stats) {
+        stats->setTypeNames([](const uint16_t type) {
+            return type == DecodeStats::InvalidType ? QStringLiteral("Invalid") : EnumHelper::toString(ResponseType(type));
+        });
     }
 }
 
+void MousrHandler::setTransport(Transport *transport)
+{
+    m_transport = transport;
+    if (m_recorder.isOpen() || m_recorder.openFromEnvironment(m_name)) {
+        transport->setRecorder(&m_recorder);
+    }
+    connect(transport, &Transport::received, this, &MousrHandler::onCharacteristicChanged);
+    connect(transport, &Transport::written, this, &MousrHandler::onCharacteristicWritten);
+    connect(transport, &Transport::writeFailed, this, &MousrHandler::onWriteFailed);
+    connect(transport, &Transport::closed, &m_linkStatsTimer, &QTimer::stop);
+    m_linkProfiles.setPacingCallback([this](const int milliseconds) { m_motionWriter.setMinimumInterval(milliseconds); });
+    m_linkProfiles.setTransport(transport);
+
+    m_linkStatsTimer.start();
+}
+
 MousrHandler::~MousrHandler()
 {
     qDebug() << "mousr handler dead";
@@ -277,14 +414,28 @@ MousrHandler::~MousrHandler()
 
     if (m_deviceController) {
         m_deviceController->disconnectFromDevice();
-    } else {
+    } else if (!m_transport) {
         qWarning() << "no controller";
     }
+
+    // The transport is deleted after us
+    if (m_transport) {
+        m_transport->setRecorder(nullptr);
+    }
 }
 
 bool MousrHandler::isConnected()
 {
-    return m_deviceController && m_deviceController->state() != QLowEnergyController::UnconnectedState &&
+    if (!m_transport || !m_transport->isOpen()) {
+        return false;
+    }
+
+    // Not using bluetooth
+    if (!m_deviceController) {
+        return true;
+    }
+
+    return m_deviceController->state() != QLowEnergyController::UnconnectedState &&
             m_service && m_writeCharacteristic.isValid() && m_readCharacteristic.isValid();
 
 }
@@ -304,24 +455,18 @@ QString MousrHandler::statusString()
 
 void MousrHandler::onServiceDiscovered(const QBluetoothUuid &newService)
 {
-    static const QBluetoothUuid genericServiceUuid = QUuid("{00001801-0000-1000-8000-00805f9b34fb}");
-    static const QBluetoothUuid dfuServiceUuid     = QUuid("{0000fe59-0000-1000-8000-00805f9b34fb}");
-    static const QBluetoothUuid serviceUuid        = QUuid("{6e400001-b5a3-f393-e0a9-e50e24dcca9e}");
-
-    if (newService == genericServiceUuid) {
+    if (newService == Services::generic) {
         qDebug() << "Got generic service uuid, for when services change, should probably connect to this to update our connections or something" << newService;
         return;
     }
 
-    if (newService == dfuServiceUuid) {
-        // Read:         8ec90001-f315-4f60-9fb8-838830daea50
-        // Write:        8ec90002-f315-4f60-9fb8-838830daea50
+    if (newService == Services::dfu) {
         qDebug() << "TODO: firmware update mode";
         return;
     }
 
-    if (newService != serviceUuid) {
-        qWarning() << "discovered unhandled service" << newService << "expected" << serviceUuid;
+    if (newService != Services::main) {
+        qWarning() << "discovered unhandled service" << newService << "expected" << Services::main;
         return;
     }
 
@@ -333,19 +478,22 @@ void MousrHandler::onServiceDiscovered(const QBluetoothUuid &newService)
     m_service = m_deviceController->createServiceObject(newService, this);
     //qDebug() << "got service:"  << m_service->serviceName() << m_service->serviceUuid();
 
-    connect(m_service, &QLowEnergyService::characteristicChanged, this, &MousrHandler::onCharacteristicChanged);
-
     connect(m_service, QOverload<QLowEnergyService::ServiceError>::of(&QLowEnergyService::error), this, &MousrHandler::onServiceError);
     connect(m_service, &QLowEnergyService::stateChanged, this, &MousrHandler::onServiceStateChanged);
 
+    if (m_transport) {
+        m_transport->deleteLater();
+    }
+    BleTransport *transport = new BleTransport(this);
+    transport->addService(m_service);
+    transport->setController(m_deviceController);
+    setTransport(transport);
+
     m_service->discoverDetails();
 }
 
 void MousrHandler::onServiceStateChanged(QLowEnergyService::ServiceState newState)
 {
-    static const QUuid writeUuid = "{6e400002-b5a3-f393-e0a9-e50e24dcca9e}";
-    static const QUuid readUuid  = "{6e400003-b5a3-f393-e0a9-e50e24dcca9e}";
-
     if (newState == QLowEnergyService::InvalidService) {
         qWarning() << "Got invalid service";
         emit disconnected();
@@ -366,8 +514,8 @@ void MousrHandler::onServiceStateChanged(QLowEnergyService::ServiceState newStat
 //        qDebug() << "characteristic available:" << c.name() << c.uuid() << c.properties();
 //    }
 
-    m_readCharacteristic = m_service->characteristic(readUuid);
-    m_writeCharacteristic = m_service->characteristic(writeUuid);
+    m_readCharacteristic = m_service->characteristic(Characteristics::read);
+    m_writeCharacteristic = m_service->characteristic(Characteristics::write);
     if (!m_readCharacteristic.descriptors().isEmpty()) {
         m_readDescriptor = m_readCharacteristic.descriptors().first();
     } else {
@@ -380,12 +528,17 @@ void MousrHandler::onServiceStateChanged(QLowEnergyService::ServiceState newStat
         return;
     }
 
-    qDebug() << "Successfully connected";
-
     // Who the _fuck_ designed this API, requiring me to write magic bytes to a
     // fucking read descriptor to get characteristicChanged to work?
     m_service->writeDescriptor(m_readDescriptor, QByteArray::fromHex("0100"));
 
+    initializeRobot();
+}
+
+void MousrHandler::initializeRobot()
+{
+    qDebug() << "Successfully connected";
+
     if (!sendCommand(CommandType::InitializeDevice, mbApiVersion, quint32(QDateTime::currentSecsSinceEpoch()))) {
         qWarning() << "Failed to send init command";
     }
@@ -396,14 +549,19 @@ void MousrHandler::onServiceStateChanged(QLowEnergyService::ServiceState newStat
 void MousrHandler::chirp()
 {
     const int soundClip = 6; // todo: discover if there are more clips stored
-    if (!sendCommand(CommandType::Chirp, 0, soundClip)) {
+    CommandPacket packet(CommandType::Chirp);
+    packet.vector2D.x = 0;
+    packet.vector2D.y = soundClip;
+    if (!sendCommandPacket(packet, TransmitQueue::Cosmetic)) {
         qWarning() << "Failed to request chirp";
     }
 }
 
 void MousrHandler::pause()
 {
-    if (!sendCommandPacket(CommandPacket(CommandType::Stop))) {
+    m_motionWriter.clear();
+    m_transmitQueue.clear(TransmitQueue::Motion);
+    if (!sendCommandPacket(CommandPacket(CommandType::Stop), TransmitQueue::Safety)) {
         qWarning() << "Failed to request stop";
     }
 }
@@ -444,6 +602,9 @@ void MousrHandler::onControllerStateChanged(QLowEnergyController::ControllerStat
 {
     if (state == QLowEnergyController::UnconnectedState) {
         qWarning() << "Disconnected";
+        m_motionWriter.clear();
+        m_linkProfiles.stop();
+        m_transmitQueue.reset();
         emit disconnected();
     }
 
@@ -467,31 +628,127 @@ void MousrHandler::onServiceError(QLowEnergyService::ServiceError error)
     if (error == QLowEnergyService::NoError) {
         return;
     }
-
     emit disconnected();
 }
 
-void MousrHandler::onCharacteristicChanged(const QLowEnergyCharacteristic &characteristic, const QByteArray &data)
+void MousrHandler::onCharacteristicWritten(const QBluetoothUuid &characteristic)
+{
+    if (characteristic == Characteristics::write) {
+        if (!m_pendingWrites.empty()) {
+            const PendingWrite &write = m_pendingWrites.front();
+            m_latencies.record(write.command, m_writeClock.nsecsElapsed() - write.sentAt);
+            m_pendingWrites.pop_front();
+            if (!m_latencyTimer.isActive()) {
+                m_latencyTimer.start();
+            }
+        }
+        m_transmitQueue.onWritten();
+    }
+}
+
+void MousrHandler::onWriteFailed(const QBluetoothUuid &characteristic)
+{
+    qWarning() << "Writing to" << characteristic << "failed";
+    if (characteristic == Characteristics::write) {
+        if (!m_pendingWrites.empty()) {
+            m_pendingWrites.pop_front();
+        }
+        m_transmitQueue.onWriteFailed();
+    }
+}
+
+QVariantMap MousrHandler::latencies() const
+{
+    return m_latencies.toVariantMap([](const uint16_t command) { return EnumHelper::toString(CommandType(command)); });
+}
+
+bool MousrHandler::dumpLatencies(const QString &path)
+{
+    const QString header = QStringLiteral("%1 %2, write acknowledgements").arg(m_name, QDateTime::currentDateTime().toString(Qt::ISODate));
+    return m_latencies.dump(path, header, [](const uint16_t command) { return EnumHelper::toString(CommandType(command)); });
+}
+
+LinkStats MousrHandler::linkStats() const
+{
+    // No framing, one notification is one packet, so only the queue has anything to add
+    LinkStats stats = m_linkStats;
+    const TransmitQueue::Stats &transmit = m_transmitQueue.stats();
+    stats.writeFailures = transmit.failed;
+    for (const uint32_t dropped : transmit.dropped) {
+        stats.droppedWrites += dropped;
+    }
+
+    const LinkProfiles::Stats &profiles = m_linkProfiles.stats();
+    stats.linkProfile = QString::fromLatin1(LinkProfiles::name(profiles.profile));
+    stats.connectionInterval = profiles.interval;
+    stats.connectionLatency = profiles.latency;
+    stats.profileSwitches = profiles.switches;
+    return stats;
+}
+
+QVariantMap MousrHandler::linkStatsMap() const
+{
+    return linkStats().toVariantMap([](const uint16_t type) { return EnumHelper::toString(ResponseType(type)); });
+}
+
+QString MousrHandler::linkStatsText() const
+{
+    return linkStats().toString([](const uint16_t type) { return EnumHelper::toString(ResponseType(type)); });
+}
+
+void MousrHandler::onLinkStatsTimer()
 {
-    if (characteristic != m_readCharacteristic) {
-        qWarning() << "changed from unexpected characteristic" << characteristic.uuid() << data;
+    emit linkStatsChanged();
+
+    if (++m_linkStatsTicks % 10 == 0 && lcLinkStats().isInfoEnabled()) {
+        qCInfo(lcLinkStats).noquote() << m_name << linkStatsText();
+    }
+}
+
+void MousrHandler::resetLatencies()
+{
+    m_latencies.clear();
+    emit latenciesChanged();
+}
+
+void MousrHandler::onCharacteristicChanged(const QBluetoothUuid &characteristic, const QByteArray &data)
+{
+    if (characteristic != Characteristics::read) {
+        qWarning() << "changed from unexpected characteristic" << characteristic << data;
         return;
     }
+    m_linkStats.traffic.bytesIn += uint64_t(data.size());
+    m_linkStats.traffic.notifications++;
 
     if (data.size() != sizeof(ResponsePacket)) {
         qWarning() << "invalid packet size" << data.size() << "expected" << sizeof(ResponsePacket);
+        m_linkStats.invalidFrames++;
+        if (m_decodeStats) {
+            m_decodeStats->addFailure();
+        }
         return;
     }
 
 
     ResponsePacket response;
     memcpy(&response, data.data(), sizeof(response));
+    m_linkStats.traffic.framesIn++;
+    m_linkStats.frameTypes[response.type]++;
+
+    std::optional<DecodeStats::Timer> timer;
+    if (m_decodeStats) {
+        timer.emplace(m_decodeStats, response.type);
+    }
 
     const QString responseName = EnumHelper::toString(ResponseType(response.type));
 
     if (responseName.isEmpty()) {
         qDebug() << "Unknown command";
         qDebug() << response.type << data;
+        m_linkStats.invalidFrames++;
+        if (m_decodeStats) {
+            m_decodeStats->addFailure(response.type);
+        }
         return;
     }
     //qDebug() << "Got response" << ResponseType(response.type);
@@ -501,7 +758,7 @@ void MousrHandler::onCharacteristicChanged(const QLowEnergyCharacteristic &chara
     case DeviceOrientation: {
         for (int i=0; i<4; i++) {
             if (response.orientation.padding[i]) {
-                qDebug() << "orientation padding" << i << int(response.orientation.padding[i]);
+                TRACE(lcMousrRx) << "orientation padding" << i << int(response.orientation.padding[i]);
             }
         }
         m_waitingForOrientationChange = false;
@@ -1,6 +1,15 @@
 #pragma once
 
 #include "AutoplayConfig.h"
+#include "MotionWriter.h"
+#include "TransmitQueue.h"
+#include "Transport.h"
+#include "DecodeStats.h"
+#include "LatencyHistogram.h"
+#include "LinkStats.h"
+#include "LinkProfiles.h"
+#include "RobotState.h"
+#include "ServiceChangedWatcher.h"
 
 #include <QObject>
 #include <QPointer>
@@ -10,6 +19,8 @@
 #include <QTimer>
 #include <QElapsedTimer>
 
+#include <deque>
+
 class QLowEnergyController;
 class QBluetoothDeviceInfo;
 class QBluetoothUuid;
@@ -86,6 +97,11 @@ class MousrHandler : public QObject
     Q_PROPERTY(mousr::AutoplayConfig::TailType autoplayTailType READ autoplayTailType WRITE setAutoplayTailType NOTIFY autoPlayChanged)
     Q_PROPERTY(mousr::AutoplayConfig::GameMode autoplayGameMode READ autoplayGameMode WRITE setAutoplayGameMode NOTIFY autoPlayChanged)
     Q_PROPERTY(int autoplayPauseTime READ autoplayPauseTime WRITE setAutoplayPauseTime NOTIFY autoPlayChanged)
+    Q_PROPERTY(mousr::AutoplayConfig::DrivingMode autoplayDrivingMode READ autoplayDrivingMode WRITE setAutoplayDrivingMode NOTIFY autoPlayChanged)
+
+    // Constant, so they are in the first snapshot and QML doesn't have to ask the handler's thread
+    Q_PROPERTY(QStringList autoplayGameModeNames READ autoplayGameModeNames CONSTANT)
+    Q_PROPERTY(QStringList autoplayDrivingModeNames READ autoplayDrivingModeNames CONSTANT)
 
     Q_PROPERTY(float xRotation READ xRotation NOTIFY orientationChanged)
     Q_PROPERTY(float yRotation READ yRotation NOTIFY orientationChanged)
@@ -98,6 +114,10 @@ class MousrHandler : public QObject
 
     Q_PROPERTY(int soundVolume READ soundVolume WRITE setSoundVolume NOTIFY soundVolumeChanged)
 
+    Q_PROPERTY(QVariantMap latencies READ latencies NOTIFY latenciesChanged)
+    Q_PROPERTY(QVariantMap linkStats READ linkStatsMap NOTIFY linkStatsChanged)
+    Q_PROPERTY(QString linkStatsText READ linkStatsText NOTIFY linkStatsChanged)
+
 public:
     AutoplayConfig::Surface autoplaySurface() const { return m_currentAutoConfig.getSurface(); }
     AutoplayConfig::TailType autoplayTailType() const { return m_currentAutoConfig.tailType(); }
@@ -105,7 +125,11 @@ public:
 
     AutoplayConfig::GameMode autoplayGameMode() const { return m_currentAutoConfig.getGameMode(); }
     void setAutoplayGameMode(const AutoplayConfig::GameMode mode) { m_newAutoConfig.setGameMode(mode); emit autoPlayChanged(); sendAutoplay(); }
-    Q_INVOKABLE QStringList autoplayGameModeNames() const { return AutoplayConfig::gameModeNames(); }
+    QStringList autoplayGameModeNames() const { return AutoplayConfig::gameModeNames(); }
+
+    AutoplayConfig::DrivingMode autoplayDrivingMode() const { return m_currentAutoConfig.drivingMode(); }
+    void setAutoplayDrivingMode(const AutoplayConfig::DrivingMode mode) { m_newAutoConfig.setDrivingMode(mode); emit autoPlayChanged(); sendAutoplay(); }
+    QStringList autoplayDrivingModeNames() const { return AutoplayConfig::drivingModeNames(); }
 
     void setAutoplaySurface(const AutoplayConfig::Surface surface) { m_newAutoConfig.setSurface(surface); emit autoPlayChanged(); sendAutoplay(); }
     void setAutoplayTailType(const AutoplayConfig::TailType tailType) { m_newAutoConfig.setTailType(tailType); emit autoPlayChanged(); sendAutoplay(); }
@@ -291,6 +315,12 @@ public:
     const uint32_t mbApiVersion = 3u;
 
     explicit MousrHandler(const QBluetoothDeviceInfo &deviceInfo, QObject *parent);
+
+    // Without Bluetooth, e. g. with a SimulatedRobot, takes ownership of the transport
+    MousrHandler(Transport *transport, const QString &name, QObject *parent);
+
+    /// Times and counts every received packet, nullptr to stop
+    void setDecodeStats(DecodeStats *stats);
     ~MousrHandler();
 
     bool isConnected();
@@ -301,6 +331,17 @@ public:
     int soundVolume() { return m_volume; }
     void setSoundVolume(const int volumePercent);
 
+    /// The robot doesn't answer commands, so this is from a write until it is acknowledged, in ms
+    QVariantMap latencies() const;
+
+    /// Snapshot of the protocol counters, linkStatsChanged() is emitted every second while connected
+    LinkStats linkStats() const;
+    QVariantMap linkStatsMap() const;
+    QString linkStatsText() const;
+
+    /// Safe to call from any thread, unlike everything else here
+    RobotState state() const { return m_state.load(); }
+
 signals:
     void connectedChanged();
     void disconnected(); // TODO
@@ -315,6 +356,8 @@ signals:
     void driverAssistChanged();
     void initComplete();
     void tailFailed();
+    void latenciesChanged();
+    void linkStatsChanged();
 
 public slots:
     void chirp();
@@ -326,6 +369,9 @@ public slots:
     void flickTail();
     void flip();
 
+    bool dumpLatencies(const QString &path);
+    void resetLatencies();
+
 private slots:
     void onControllerStateChanged(QLowEnergyController::ControllerState state);
     void onControllerError(QLowEnergyController::Error newError);
@@ -334,14 +380,22 @@ private slots:
     void onServiceStateChanged(QLowEnergyService::ServiceState newState);
     void onServiceError(QLowEnergyService::ServiceError error);
 
-    void onCharacteristicChanged(const QLowEnergyCharacteristic &characteristic, const QByteArray &newValue);
+    void onCharacteristicChanged(const QBluetoothUuid &characteristic, const QByteArray &newValue);
+    void onCharacteristicWritten(const QBluetoothUuid &characteristic);
+    void onWriteFailed(const QBluetoothUuid &characteristic);
 
     void sendInput();
     void sendDriverAssistConfig();
 
     void onInitComplete();
+    void onLinkStatsTimer();
+    void publishState();
 
 private:
+    void setup();
+    void setTransport(Transport *transport);
+    void initializeRobot(); // when the service is ready
+
     bool sendCommand(const CommandType command, float arg1, const float arg2, const float arg3);
     bool sendCommand(const CommandType command, const uint32_t arg1, const uint32_t arg2 = 0);
     bool sendCommand(const CommandType command);
@@ -506,9 +560,12 @@ private:
 
     #pragma pack(pop)
 
-    bool sendCommandPacket(const CommandPacket &packet);
+    bool sendCommandPacket(const CommandPacket &packet, const TransmitQueue::Priority priority = TransmitQueue::Config);
 
     QPointer<QLowEnergyController> m_deviceController;
+    QPointer<Transport> m_transport;
+    DecodeStats *m_decodeStats = nullptr;
+    capture::Recorder m_recorder; // only if $ROBOT_CAPTURE_DIR is set
 
     QLowEnergyCharacteristic m_readCharacteristic;
     QLowEnergyCharacteristic m_writeCharacteristic;
@@ -516,6 +573,9 @@ private:
 
     QPointer<QLowEnergyService> m_service;
 
+    ServiceChangedWatcher *m_serviceChangedWatcher = nullptr; // only with bluetooth
+    QElapsedTimer m_connectTimer;
+
     int m_voltage = 0, m_memory = 0;
     int m_volume = 0;
     bool m_batteryLow = false, m_charging = false, m_fullyCharged = false;
@@ -537,9 +597,28 @@ private:
     bool m_isAutoActive = false;
     Version m_version;
     QTimer m_sendInputTimer; // so we can batch up input updates
+
+    struct PendingWrite {
+        uint16_t command;
+        int64_t sentAt;
+    };
+    std::deque<PendingWrite> m_pendingWrites; // written with response, not acknowledged yet
+    QElapsedTimer m_writeClock;
+    LatencyStats m_latencies;
+    QTimer m_latencyTimer; // so QML isn't updated for every write
+
+    LinkStats m_linkStats;
+    QTimer m_linkStatsTimer;
+    int m_linkStatsTicks = 0;
+    MotionWriter m_motionWriter; // and not queue them up if the link is slow
+    LinkProfiles m_linkProfiles; // drive or idle connection parameters
+    TransmitQueue m_transmitQueue;
     DriverAssistMode m_driverAssistMode;
     QElapsedTimer m_lastRotationTimer;
     bool m_waitingForOrientationChange = true;
+
+    SeqLock<RobotState> m_state;
+    uint64_t m_stateVersion = 0;
 };
 
 QDebug operator<<(QDebug debug, const AutoplayConfig &c);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <QBluetoothUuid>
+
+namespace mousr {
+
+namespace Services {
+    static const QBluetoothUuid main(QStringLiteral("{6e400001-b5a3-f393-e0a9-e50e24dcca9e}"));
+    static const QBluetoothUuid generic(QStringLiteral("{00001801-0000-1000-8000-00805f9b34fb}"));
+    static const QBluetoothUuid dfu(QStringLiteral("{0000fe59-0000-1000-8000-00805f9b34fb}"));
+} // namespace Services
+
+namespace Characteristics {
+    static const QBluetoothUuid write(QStringLiteral("{6e400002-b5a3-f393-e0a9-e50e24dcca9e}"));
+    static const QBluetoothUuid read(QStringLiteral("{6e400003-b5a3-f393-e0a9-e50e24dcca9e}"));
+
+    namespace Dfu {
+        static const QBluetoothUuid read(QStringLiteral("{8ec90001-f315-4f60-9fb8-838830daea50}"));
+        static const QBluetoothUuid write(QStringLiteral("{8ec90002-f315-4f60-9fb8-838830daea50}"));
+    } // namespace Dfu
+} // namespace Characteristics
+
+} // namespace mousr
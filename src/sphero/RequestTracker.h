@@ -0,0 +1,373 @@
+#pragma once
+
+#include "LatencyHistogram.h"
+
+#include <QByteArray>
+#include <QDebug>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+namespace sphero {
+
+/// Keeps track of synchronous requests, for both V1 and V2 (both have an
+/// 8 bit sequence number that is echoed back in the response).
+/// Up to pipelineDepth requests are in flight at once, the rest are queued.
+/// Requests that don't get a response before the deadline are resent with
+/// the same sequence number, and reported as timed out when out of retries.
+/// The deadline starts when the frame is actually written (see onWritten()),
+/// not while it waits behind other traffic in the transmit queue.
+class RequestTracker
+{
+public:
+    enum class Status {
+        Success,
+        Failed, // robot responded with an error, see Response::code
+        TimedOut,
+        Cancelled, // disconnected or queue full
+    };
+
+    struct Response {
+        Status status = Status::Cancelled;
+        uint8_t code = 0; // response code (V1) or error code (V2)
+        uint8_t deviceId = 0;
+        uint8_t commandId = 0;
+        QByteArray contents; // only valid inside the callback
+        int64_t roundTrip = 0; // nanoseconds
+    };
+
+    using Callback = std::function<void(const Response &)>;
+    using Encoder = std::function<QByteArray(uint8_t sequenceNumber)>;
+    using Writer = std::function<void(const QByteArray &, int priority, uint8_t sequenceNumber)>;
+
+    /// Whether a request can be resent, false for things the robot shouldn't do twice (sleep, boost)
+    using RetryPolicy = std::function<bool(uint8_t deviceId, uint8_t commandId)>;
+
+    struct Stats {
+        uint32_t sent = 0;
+        uint32_t completed = 0;
+        uint32_t failed = 0;
+        uint32_t retries = 0;
+        uint32_t timeouts = 0;
+        uint32_t unexpected = 0;
+
+        int inFlight = 0;
+        int maxInFlight = 0;
+        int queued = 0;
+
+        // nanoseconds, only from requests that weren't resent
+        int64_t lastRoundTrip = 0;
+        int64_t minRoundTrip = 0;
+        int64_t maxRoundTrip = 0;
+        int64_t averageRoundTrip = 0; // exponential moving average
+    };
+
+    static constexpr int MaxQueued = 64;
+
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void setWriter(Writer writer) { m_write = std::move(writer); }
+
+    void setPipelineDepth(const int depth) { m_pipelineDepth = qBound(1, depth, 255); }
+    int pipelineDepth() const { return m_pipelineDepth; }
+
+    void setTimeout(const int milliseconds) { m_timeout = int64_t(qMax(1, milliseconds)) * 1000000; }
+    void setMaxRetries(const int retries) { m_maxRetries = qMax(0, retries); }
+    void setRetryPolicy(RetryPolicy policy) { m_canRetry = std::move(policy); }
+
+    const Stats &stats() const { return m_stats; }
+
+    /// Round trips per (device id << 8 | command id), not for resent requests
+    const LatencyStats &latencies() const { return m_latencies; }
+    void clearLatencies() { m_latencies.clear(); }
+
+    /// Encodes and sends it if there is room in the pipeline, otherwise queues it.
+    /// The priority is just passed on to the writer.
+    bool submit(const uint8_t deviceId, const uint8_t commandId, Encoder encoder, Callback callback = {}, const int priority = 0)
+    {
+        if (m_stats.inFlight < m_pipelineDepth && m_queue.empty()) {
+            return send({deviceId, commandId, priority, std::move(encoder), std::move(callback)});
+        }
+
+        if (m_queue.size() >= MaxQueued) {
+            qWarning() << " ! Request queue full, dropping" << deviceId << commandId;
+            cancel(deviceId, commandId, callback);
+            return false;
+        }
+
+        m_queue.push_back({deviceId, commandId, priority, std::move(encoder), std::move(callback)});
+        m_stats.queued = int(m_queue.size());
+        return true;
+    }
+
+    /// Call when the frame for it is handed to the transport, starts the deadline
+    void onWritten(const uint8_t sequenceNumber)
+    {
+        Slot &slot = m_slots[sequenceNumber];
+        if (!slot.active || slot.written) {
+            return;
+        }
+        slot.written = true;
+        slot.sentAt = now();
+        slot.deadline = slot.sentAt + m_timeout;
+    }
+
+    /// Returns false if we weren't waiting for this sequence number.
+    /// deviceId and commandId are set to what the response is for.
+    bool complete(const uint8_t sequenceNumber, const bool success, const uint8_t code, const QByteArray &contents, uint8_t *deviceId, uint8_t *commandId)
+    {
+        Slot &slot = m_slots[sequenceNumber];
+        if (!slot.active) {
+            m_stats.unexpected++;
+            return false;
+        }
+
+        Response response;
+        response.status = success ? Status::Success : Status::Failed;
+        response.code = code;
+        response.deviceId = slot.deviceId;
+        response.commandId = slot.commandId;
+        response.contents = contents;
+        response.roundTrip = now() - slot.sentAt;
+
+        if (!slot.resent) {
+            updateRoundTrip(response.roundTrip);
+            m_latencies.record(uint16_t(slot.deviceId << 8 | slot.commandId), response.roundTrip);
+        }
+
+        *deviceId = slot.deviceId;
+        *commandId = slot.commandId;
+
+        m_stats.completed++;
+        if (!success) {
+            m_stats.failed++;
+        }
+
+        // Release it before calling anything, the callback might send more
+        const Callback callback = std::move(slot.callback);
+        release(slot);
+
+        if (callback) {
+            callback(response);
+        }
+
+        sendQueued();
+        return true;
+    }
+
+    /// Resends or times out everything past its deadline
+    void expire(const int64_t timestamp)
+    {
+        for (int sequenceNumber=0; sequenceNumber<256; sequenceNumber++) {
+            Slot &slot = m_slots[sequenceNumber];
+            if (!slot.active || !slot.written || slot.deadline > timestamp) {
+                continue;
+            }
+
+            if (slot.retriesLeft > 0) {
+                slot.retriesLeft--;
+                slot.resent = true;
+                slot.written = false;
+                m_stats.retries++;
+                qDebug() << " - resending" << slot.deviceId << slot.commandId << "sequence" << sequenceNumber;
+                write(slot);
+                continue;
+            }
+
+            qWarning() << " ! Request timed out" << slot.deviceId << slot.commandId << "sequence" << sequenceNumber;
+            m_stats.timeouts++;
+
+            Response response;
+            response.status = Status::TimedOut;
+            response.deviceId = slot.deviceId;
+            response.commandId = slot.commandId;
+            response.roundTrip = timestamp - slot.sentAt;
+
+            const Callback callback = std::move(slot.callback);
+            release(slot);
+            if (callback) {
+                callback(response);
+            }
+        }
+
+        sendQueued();
+    }
+
+    /// When the next request times out, or -1 if nothing is written and waiting for a response
+    int64_t nextDeadline() const
+    {
+        if (!m_stats.inFlight) {
+            return -1;
+        }
+        int64_t deadline = -1;
+        for (const Slot &slot : m_slots) {
+            if (slot.active && slot.written && (deadline < 0 || slot.deadline < deadline)) {
+                deadline = slot.deadline;
+            }
+        }
+        return deadline;
+    }
+
+    /// Fails everything in flight and in the queue, e. g. when disconnected
+    void cancelAll()
+    {
+        std::deque<Queued> queue;
+        queue.swap(m_queue);
+        m_stats.queued = 0;
+
+        for (Slot &slot : m_slots) {
+            if (!slot.active) {
+                continue;
+            }
+            const uint8_t deviceId = slot.deviceId;
+            const uint8_t commandId = slot.commandId;
+            const Callback callback = std::move(slot.callback);
+            release(slot);
+            cancel(deviceId, commandId, callback);
+        }
+        for (const Queued &queued : queue) {
+            cancel(queued.deviceId, queued.commandId, queued.callback);
+        }
+    }
+
+private:
+    struct Slot {
+        bool active = false;
+        bool written = false; // the deadline only counts after this
+        bool resent = false;
+        uint8_t deviceId = 0;
+        uint8_t commandId = 0;
+        int priority = 0;
+        int retriesLeft = 0;
+        int64_t sentAt = 0;
+        int64_t deadline = 0;
+        QByteArray frame; // for resending
+        Callback callback;
+    };
+
+    struct Queued {
+        uint8_t deviceId;
+        uint8_t commandId;
+        int priority;
+        Encoder encoder;
+        Callback callback;
+    };
+
+    bool send(Queued request)
+    {
+        const uint8_t deviceId = request.deviceId;
+        const uint8_t commandId = request.commandId;
+
+        // 0 is reserved for asynchronous commands
+        int sequenceNumber = -1;
+        for (int i=0; i<256; i++) {
+            const uint8_t candidate = uint8_t(m_nextSequenceNumber + i);
+            if (candidate != 0 && !m_slots[candidate].active) {
+                sequenceNumber = candidate;
+                break;
+            }
+        }
+        if (sequenceNumber < 0) {
+            qWarning() << " ! No free sequence numbers";
+            cancel(deviceId, commandId, request.callback);
+            return false;
+        }
+        m_nextSequenceNumber = uint8_t(sequenceNumber + 1);
+
+        Slot &slot = m_slots[sequenceNumber];
+        slot.frame = request.encoder(uint8_t(sequenceNumber));
+        if (slot.frame.isEmpty()) {
+            qWarning() << " ! Encoding packet failed" << deviceId << commandId;
+            cancel(deviceId, commandId, request.callback);
+            return false;
+        }
+        slot.active = true;
+        slot.written = false;
+        slot.resent = false;
+        slot.deviceId = deviceId;
+        slot.commandId = commandId;
+        slot.priority = request.priority;
+        slot.retriesLeft = (!m_canRetry || m_canRetry(deviceId, commandId)) ? m_maxRetries : 0;
+        slot.callback = std::move(request.callback);
+        slot.sentAt = now();
+        slot.deadline = 0;
+
+        m_stats.sent++;
+        m_stats.inFlight++;
+        m_stats.maxInFlight = qMax(m_stats.maxInFlight, m_stats.inFlight);
+
+        write(slot);
+        return true;
+    }
+
+    static void cancel(const uint8_t deviceId, const uint8_t commandId, const Callback &callback)
+    {
+        if (!callback) {
+            return;
+        }
+        Response response;
+        response.deviceId = deviceId;
+        response.commandId = commandId;
+        callback(response);
+    }
+
+    void sendQueued()
+    {
+        while (!m_queue.empty() && m_stats.inFlight < m_pipelineDepth) {
+            Queued queued = std::move(m_queue.front());
+            m_queue.pop_front();
+            send(std::move(queued));
+        }
+        m_stats.queued = int(m_queue.size());
+    }
+
+    void release(Slot &slot)
+    {
+        slot.active = false;
+        slot.frame.clear();
+        slot.callback = nullptr;
+        m_stats.inFlight--;
+    }
+
+    void updateRoundTrip(const int64_t roundTrip)
+    {
+        m_stats.lastRoundTrip = roundTrip;
+        if (!m_stats.averageRoundTrip) {
+            m_stats.minRoundTrip = roundTrip;
+            m_stats.maxRoundTrip = roundTrip;
+            m_stats.averageRoundTrip = roundTrip;
+            return;
+        }
+        m_stats.minRoundTrip = qMin(m_stats.minRoundTrip, roundTrip);
+        m_stats.maxRoundTrip = qMax(m_stats.maxRoundTrip, roundTrip);
+        m_stats.averageRoundTrip += (roundTrip - m_stats.averageRoundTrip) / 8;
+    }
+
+    void write(const Slot &slot)
+    {
+        if (m_write) {
+            m_write(slot.frame, slot.priority, uint8_t(&slot - m_slots.data()));
+        }
+    }
+
+    std::array<Slot, 256> m_slots{};
+    std::deque<Queued> m_queue;
+
+    Writer m_write;
+    RetryPolicy m_canRetry;
+
+    int m_pipelineDepth = 4;
+    int64_t m_timeout = 500 * 1000000ll; // nanoseconds
+    int m_maxRetries = 1;
+    uint8_t m_nextSequenceNumber = 1;
+
+    Stats m_stats;
+    LatencyStats m_latencies;
+};
+
+} // namespace sphero
@@ -2,7 +2,9 @@
 #include <QDebug>
 
 #include "SpheroHandler.h"
+#include "BleTransport.h"
 #include "utils.h"
+#include "Logging.h"
 #include "Uuids.h"
 
 #include "v1/ResponsePackets.h"
@@ -17,6 +19,8 @@
 #include <QtEndian>
 #include <QCoreApplication>
 
+#include <chrono>
+
 namespace sphero {
 
 RobotType typeFromName(const QString &name)
@@ -128,10 +132,15 @@ SpheroHandler::SpheroHandler(const QBluetoothDeviceInfo &deviceInfo, QObject *pa
     m_robotType = typeFromName(m_name);
     qDebug() << "Connecting to" << deviceInfo.address().toString();
 
-    qDebug() << sizeof(SensorStreamPacket);
+    setupWriters();
+
+    m_connectTimer.start();
+    m_serviceChangedWatcher = new ServiceChangedWatcher(this);
+
     m_deviceController = QLowEnergyController::createCentral(deviceInfo, this);
 
     connect(m_deviceController, &QLowEnergyController::connected, m_deviceController, &QLowEnergyController::discoverServices);
+    connect(m_deviceController, &QLowEnergyController::serviceDiscovered, this, &SpheroHandler::onServiceDiscovered);
     connect(m_deviceController, &QLowEnergyController::discoveryFinished, this, &SpheroHandler::onServiceDiscoveryFinished);
 
     connect(m_deviceController, &QLowEnergyController::connectionUpdated, this, [](const QLowEnergyConnectionParameters &parms) {
@@ -159,14 +168,220 @@ SpheroHandler::SpheroHandler(const QBluetoothDeviceInfo &deviceInfo, QObject *pa
     qDebug() << " - Created handler";
 }
 
+SpheroHandler::SpheroHandler(Transport *transport, const QString &name, QObject *parent) :
+    QObject(parent),
+    m_name(name),
+    m_robot(typeFromName(name))
+{
+    m_robotType = typeFromName(m_name);
+    qDebug() << "Using transport for" << m_name;
+
+    setupWriters();
+
+    transport->setParent(this);
+    setTransport(transport);
+
+    // Nothing else is going to tell us
+    connect(transport, &Transport::closed, this, [this]() {
+        onControllerStateChanged(QLowEnergyController::UnconnectedState);
+    });
+
+    // Give whoever created us a chance to connect to our signals first
+    QMetaObject::invokeMethod(this, &SpheroHandler::initializeRobot, Qt::QueuedConnection);
+}
+
+void SpheroHandler::setupWriters()
+{
+    m_transmitQueue.setWriter([this](const QByteArray &frame, const QLowEnergyService::WriteMode mode) {
+        if (!m_transport) {
+            qWarning() << "Can't send without transport";
+            return;
+        }
+        m_linkStats.traffic.bytesOut += uint64_t(frame.size());
+        m_linkStats.traffic.framesOut++;
+        m_transport->write(m_robot.commandsCharacteristic, frame, mode);
+    });
+    m_requests.setWriter([this](const QByteArray &frame, const int priority, const uint8_t sequenceNumber) {
+        // The deadline only starts when it is written, not while it waits behind other traffic
+        const std::function<void()> onWrite = [this, sequenceNumber]() {
+            m_requests.onWritten(sequenceNumber);
+            scheduleRequestTimeout();
+        };
+        if (!m_transmitQueue.enqueue(TransmitQueue::Priority(priority), frame, QLowEnergyService::WriteWithResponse, onWrite)) {
+            // Dropped, so let it time out and be resent like a lost write
+            onWrite();
+        }
+    });
+    m_requests.setRetryPolicy([this](const uint8_t deviceId, const uint8_t commandId) {
+        return !isNonIdempotent(m_robot.api, deviceId, commandId);
+    });
+    m_motionWriter.setWriter([this](const QByteArray &frame) {
+        const QLowEnergyService::WriteMode mode = (m_transport && m_transport->canWriteWithoutResponse(m_robot.commandsCharacteristic)) ?
+                    QLowEnergyService::WriteWithoutResponse : QLowEnergyService::WriteWithResponse;
+        m_transmitQueue.enqueue(TransmitQueue::Motion, frame, mode);
+    });
+    m_requestTimer.setSingleShot(true);
+    connect(&m_requestTimer, &QTimer::timeout, this, &SpheroHandler::onRequestTimeout);
+
+    m_latencyTimer.setSingleShot(true);
+    m_latencyTimer.setInterval(1000);
+    connect(&m_latencyTimer, &QTimer::timeout, this, &SpheroHandler::latenciesChanged);
+
+    m_linkStatsTimer.setInterval(1000);
+    connect(&m_linkStatsTimer, &QTimer::timeout, this, &SpheroHandler::onLinkStatsTimer);
+
+    // Everything that is in the RobotState, the attitude is published by the sensor stream
+    connect(this, &SpheroHandler::connectedChanged, this, &SpheroHandler::publishState);
+    connect(this, &SpheroHandler::powerChanged, this, &SpheroHandler::publishState);
+    connect(this, &SpheroHandler::colorChanged, this, &SpheroHandler::publishState);
+    connect(this, &SpheroHandler::speedChanged, this, &SpheroHandler::publishState);
+    connect(this, &SpheroHandler::angleChanged, this, &SpheroHandler::publishState);
+}
+
+void SpheroHandler::publishState()
+{
+    RobotState state;
+    state.version = ++m_stateVersion;
+    state.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    state.orientation = m_attitude;
+    state.speed = m_speed / 255.f;
+    state.heading = m_angle;
+    state.color = m_color.isValid() ? (m_color.rgb() & 0xFFFFFF) : 0;
+
+    state.set(RobotState::Connected, isConnected());
+    state.set(RobotState::Charging, m_powerState == BatteryCharging);
+    state.set(RobotState::BatteryLow, m_powerState == BatteryLow || m_powerState == BatteryCritical);
+
+    m_state.store(state);
+}
+
+void SpheroHandler::setDecodeStats(DecodeStats *stats)
+{
+    m_decodeStats = stats;
+    if (!stats) {
+        return;
+    }
+
+    const RobotDefinition::APIVersion api = m_robot.api;
+    stats->setTypeNames([api](const uint16_t type) {
+        return packetTypeName(api, type);
+    });
+}
+
+QString SpheroHandler::packetTypeName(const RobotDefinition::APIVersion api, const uint16_t type)
+{
+    if (type == DecodeStats::InvalidType) {
+        return QStringLiteral("Invalid");
+    }
+    const uint8_t high = type >> 8;
+    const uint8_t low = type & 0xFF;
+    if (api == RobotDefinition::V1) {
+        if (high == ResponsePacketHeader::Notification) {
+            return QStringLiteral("Notification ") + EnumHelper::toString(ResponsePacketHeader::NotificationType(low));
+        }
+        return QStringLiteral("Response ") + EnumHelper::toString(ResponsePacketHeader::PacketType(low));
+    }
+    return EnumHelper::toString(v2::Packet::CommandTarget(high)) + QStringLiteral(" 0x") + QString::number(low, 16);
+}
+
+LinkStats SpheroHandler::linkStats() const
+{
+    LinkStats stats = m_linkStats;
+
+    if (m_robot.api == RobotDefinition::V1) {
+        const v1::FrameReassembler::Stats &decoder = m_frameReassemblerV1.stats();
+        stats.traffic.framesIn = decoder.frames;
+        stats.checksumErrors = decoder.checksumErrors;
+        stats.resyncs = decoder.resyncs;
+        stats.overflows = decoder.overflows;
+        stats.droppedBytes = decoder.droppedBytes;
+    } else {
+        const v2::FrameDecoder::Stats &decoder = m_frameDecoderV2.stats();
+        stats.traffic.framesIn = decoder.frames;
+        stats.checksumErrors = decoder.checksumErrors;
+        stats.escapeErrors = decoder.escapeErrors;
+        stats.overflows = decoder.overflows;
+        stats.droppedBytes = decoder.discardedBytes;
+    }
+
+    const TransmitQueue::Stats &transmit = m_transmitQueue.stats();
+    stats.writeFailures = transmit.failed;
+    for (const uint32_t dropped : transmit.dropped) {
+        stats.droppedWrites += dropped;
+    }
+
+    const RequestTracker::Stats &requests = m_requests.stats();
+    stats.timeouts = requests.timeouts;
+    stats.unexpectedResponses = requests.unexpected;
+
+    const LinkProfiles::Stats &profiles = m_linkProfiles.stats();
+    stats.linkProfile = QString::fromLatin1(LinkProfiles::name(profiles.profile));
+    stats.connectionInterval = profiles.interval;
+    stats.connectionLatency = profiles.latency;
+    stats.profileSwitches = profiles.switches;
+
+    return stats;
+}
+
+QVariantMap SpheroHandler::linkStatsMap() const
+{
+    const RobotDefinition::APIVersion api = m_robot.api;
+    return linkStats().toVariantMap([api](const uint16_t type) { return packetTypeName(api, type); });
+}
+
+QString SpheroHandler::linkStatsText() const
+{
+    const RobotDefinition::APIVersion api = m_robot.api;
+    return linkStats().toString([api](const uint16_t type) { return packetTypeName(api, type); });
+}
+
+void SpheroHandler::onLinkStatsTimer()
+{
+    emit linkStatsChanged();
+
+    // Every ten seconds is plenty for correlating with what the logs say
+    if (++m_linkStatsTicks % 10 == 0 && lcLinkStats().isInfoEnabled()) {
+        qCInfo(lcLinkStats).noquote() << m_name << linkStatsText();
+    }
+}
+
+void SpheroHandler::setTransport(Transport *transport)
+{
+    m_transport = transport;
+    if (m_recorder.isOpen() || m_recorder.openFromEnvironment(m_name)) {
+        transport->setRecorder(&m_recorder);
+    }
+    connect(transport, &Transport::received, this, &SpheroHandler::onCharacteristicChanged);
+    connect(transport, &Transport::written, this, &SpheroHandler::onCharacteristicWritten);
+    connect(transport, &Transport::writeFailed, this, &SpheroHandler::onWriteFailed);
+    connect(transport, &Transport::closed, &m_linkStatsTimer, &QTimer::stop);
+    m_linkProfiles.setPacingCallback([this](const int milliseconds) { m_motionWriter.setMinimumInterval(milliseconds); });
+    m_linkProfiles.setTransport(transport);
+
+    m_linkStatsTimer.start();
+}
+
 SpheroHandler::~SpheroHandler()
 {
     qDebug() << " - sphero handler dead";
-    if (m_deviceController) {
-        disconnectFromRobot();
+    if (m_deviceController || m_transport) {
+        // No time to wait for the transmit queue, so hand it all to Qt at once
+        if (isConnected()) {
+            stopRobot();
+            m_transmitQueue.flush();
+            if (m_deviceController) {
+                closeConnection();
+            }
+        }
     } else {
         qWarning() << "no controller";
     }
+
+    // The transport is deleted after us
+    if (m_transport) {
+        m_transport->setRecorder(nullptr);
+    }
 }
 
 void SpheroHandler::disconnectFromRobot()
@@ -176,15 +391,48 @@ void SpheroHandler::disconnectFromRobot()
         return;
     }
 
+    stopRobot();
+
+    // These go through the transmit queue, which only has a couple of writes
+    // in flight, so let them get out before the services are gone
+    m_transmitQueue.whenDrained([this]() { closeConnection(); });
+    QTimer::singleShot(disconnectTimeout, this, &SpheroHandler::closeConnection);
+}
+
+void SpheroHandler::stopRobot()
+{
     setAutoStabilize(false);
     brake();
     goToSleep();
+}
+
+void SpheroHandler::closeConnection()
+{
+    // Not using bluetooth, closed() ends up in onControllerStateChanged() like a real disconnect
+    if (!m_deviceController) {
+        if (m_transport && m_transport->isOpen()) {
+            m_transport->close();
+        }
+        return;
+    }
+    if (m_deviceController->state() == QLowEnergyController::UnconnectedState || m_deviceController->state() == QLowEnergyController::ClosingState) {
+        return;
+    }
 
     // Disconnect from device invalidates
-    disconnect(m_mainService, nullptr, this, nullptr);
-    m_mainService->deleteLater();
-    disconnect(m_radioService, nullptr, this, nullptr);
-    m_radioService->deleteLater();
+    m_transmitQueue.reset();
+    if (m_mainService) {
+        disconnect(m_mainService, nullptr, this, nullptr);
+        m_mainService->deleteLater();
+    }
+    if (m_radioService) {
+        disconnect(m_radioService, nullptr, this, nullptr);
+        m_radioService->deleteLater();
+    }
+    if (m_batteryService) {
+        disconnect(m_batteryService, nullptr, this, nullptr);
+        m_batteryService->deleteLater();
+    }
 
     m_deviceController->disconnectFromDevice();
 
@@ -194,10 +442,18 @@ void SpheroHandler::disconnectFromRobot()
 
 bool SpheroHandler::isConnected()
 {
-    return m_deviceController && m_deviceController->state() != QLowEnergyController::UnconnectedState &&
+    if (!m_transport || !m_transport->isOpen()) {
+        return false;
+    }
+
+    // Not using bluetooth
+    if (!m_deviceController) {
+        return true;
+    }
+
+    return m_deviceController->state() != QLowEnergyController::UnconnectedState &&
             m_mainService && m_mainService->state() == QLowEnergyService::ServiceDiscovered &&
-            m_radioService && m_radioService->state() == QLowEnergyService::ServiceDiscovered &&
-            m_commandsCharacteristic.isValid();
+            m_radioService && m_radioService->state() == QLowEnergyService::ServiceDiscovered;
 }
 
 QString SpheroHandler::statusString()
@@ -217,7 +473,7 @@ void SpheroHandler::setColor(const int r, const int g, const int b)
 {
     switch(m_robot.api) {
     case RobotDefinition::V1:
-        sendCommandV1(v1::SetColorsCommandPacket(r, g, b, v1::SetColorsCommandPacket::Temporary));
+        sendCommandV1(v1::SetColorsCommandPacket(r, g, b, v1::SetColorsCommandPacket::Temporary), {}, TransmitQueue::Cosmetic);
         break;
     case RobotDefinition::V2: {
         v2::ColorLED bodyLED = v2::InvalidLED;
@@ -236,7 +492,9 @@ void SpheroHandler::setColor(const int r, const int g, const int b)
 
         if (bodyLED != v2::InvalidLED) {
             // Set the body to green
-            m_mainService->writeCharacteristic(m_commandsCharacteristic, v2::encode(v2::SetLED(bodyLED, r, g, b)));
+            v2::SetLED packet(bodyLED, r, g, b);
+            packet.m_flags &= ~v2::Packet::Synchronous; // nothing waits for it
+            sendCommandV2(packet, {}, TransmitQueue::Cosmetic);
         }
         break;
     }
@@ -266,13 +524,13 @@ void SpheroHandler::setSpeedAndAngle(int speed, int angle)
 
     switch(m_robot.api) {
     case RobotDefinition::V1:
-        sendCommandV1(v1::RollCommandPacket({uint8_t(speed), qbswap<quint16>(uint16_t(angle)), v1::RollCommandPacket::Roll}));
+        sendMotionV1(v1::RollCommandPacket({uint8_t(speed), qbswap<quint16>(uint16_t(angle)), v1::RollCommandPacket::Roll}));
         break;
     default:
         if (m_robotType == RobotType::BB9E) {
             speed *= 0.75;
         }
-        m_mainService->writeCharacteristic(m_commandsCharacteristic, v2::encode(v2::DrivePacket(speed, angle)));
+        sendMotionV2(v2::DrivePacket(speed, angle));
         break;
     }
 
@@ -306,7 +564,7 @@ void SpheroHandler::setAngle(int angle)
         angle += 360;
     }
     angle %= 360;
-    qDebug() << "Setting angle to" << angle;
+    TRACE(lcSpheroTx) << " - Setting angle to" << angle;
 
     if (angle == m_angle) {
         return;
@@ -315,10 +573,10 @@ void SpheroHandler::setAngle(int angle)
     // why the fuck do I need to swap the angle bytes?
     switch(m_robot.api) {
     case RobotDefinition::V1:
-        sendCommandV1(v1::RollCommandPacket({uint8_t(m_speed), qbswap<quint16>(uint16_t(angle)), v1::RollCommandPacket::Brake}));
+        sendMotionV1(v1::RollCommandPacket({uint8_t(m_speed), qbswap<quint16>(uint16_t(angle)), v1::RollCommandPacket::Brake}));
         break;
     default:
-        m_mainService->writeCharacteristic(m_commandsCharacteristic, v2::encode(v2::DrivePacket(0, angle, v2::DrivePacket::FastTurn)));
+        sendMotionV2(v2::DrivePacket(0, angle, v2::DrivePacket::FastTurn));
         qWarning() << "TODO setangle";
         break;
     }
@@ -329,13 +587,21 @@ void SpheroHandler::setAngle(int angle)
 
 void SpheroHandler::brake()
 {
+    // Don't let an old setpoint go out after this
+    m_motionWriter.clear();
+    m_transmitQueue.clear(TransmitQueue::Motion);
+
     switch(m_robot.api) {
     case RobotDefinition::V1:
-        sendCommandV1(v1::RollCommandPacket({uint8_t(0), uint16_t(0), v1::RollCommandPacket::Brake}));
+        sendCommandV1(v1::RollCommandPacket({uint8_t(0), uint16_t(0), v1::RollCommandPacket::Brake}), {}, TransmitQueue::Safety);
         break;
-    case RobotDefinition::V2:
-        m_mainService->writeCharacteristic(m_commandsCharacteristic, v2::encode(v2::DrivePacket(0, 0)));
+    case RobotDefinition::V2: {
+        // Asynchronous so it doesn't have to wait for room in the request pipeline
+        v2::DrivePacket packet(0, 0);
+        packet.m_flags &= ~v2::Packet::Synchronous;
+        sendCommandV2(packet, {}, TransmitQueue::Safety);
         break;
+    }
     default:
         qWarning() << "TODO brake";
         break;
@@ -414,7 +680,7 @@ void SpheroHandler::goToSleep()
         sendCommandV1(v1::GoToSleepPacket());
         break;
     case RobotDefinition::V2:
-        m_mainService->writeCharacteristic(m_commandsCharacteristic, v2::encode(v2::GoToLightSleep()));
+        sendCommandV2(v2::GoToLightSleep());
         break;
     default:
         qWarning() << "TODO gotosleep";
@@ -482,8 +748,137 @@ void SpheroHandler::boost(int angle, int duration)
     }
 }
 
+void SpheroHandler::setSensorStreaming(const uint64_t sources, const int rate, const int packetCount)
+{
+    switch(m_robot.api) {
+    case RobotDefinition::V1:
+        m_sensorSources = sources;
+        sendCommandV1(v1::CommandPacketHeader::HardwareControl, v1::CommandPacketHeader::SetDataStreaming,
+                v1::DataStreamingCommandPacket::create(
+                    qBound(0, packetCount, 255),
+                    uint16_t(400 / qBound(1, rate, 400)),
+                    1, // frames per packet, more just adds latency
+                    uint32_t(sources >> 32),
+                    uint32_t(sources & 0xFFFFFFFF)
+                    )
+                );
+        break;
+    case RobotDefinition::V2: {
+        if (sources & ~uint64_t(v2::SensorSource::Supported)) {
+            qWarning() << "Unsupported sensor sources" << QByteArray::number(qulonglong(sources & ~uint64_t(v2::SensorSource::Supported)), 16);
+        }
+        // Notifications are decoded with this, and reset if the robot refuses it
+        m_sensorSources = sources & v2::SensorSource::Supported;
+
+        const uint16_t interval = uint16_t(1000 / qBound(1, rate, 1000));
+        const RequestTracker::Callback onResponse = [this](const RequestTracker::Response &response) {
+            if (response.status == RequestTracker::Status::Success) {
+                return;
+            }
+            qWarning() << "Robot refused sensor mask" << QByteArray::number(qulonglong(m_sensorSources), 16) << "error" << v2::Packet::Error(response.code);
+            m_sensorSources = 0;
+        };
+        sendCommandV2(v2::SetSensorAppMaskPacket(interval, uint8_t(qBound(0, packetCount, 255)), v2::SensorSource::appMask(m_sensorSources)), onResponse);
+        sendCommandV2(v2::SetSensorAppMaskExtendedPacket(v2::SensorSource::extendedMask(m_sensorSources)), onResponse);
+        break;
+    }
+    }
+}
+
+template<typename SAMPLE, typename BUFFER>
+static QVariantList samplesToVariantList(BUFFER &buffer, int remaining)
+{
+    static constexpr int batchSize = 64;
+    SAMPLE samples[batchSize];
+
+    QVariantList ret;
+    while (remaining > 0) {
+        const int count = int(buffer.pop(samples, size_t(qMin(remaining, batchSize))));
+        if (!count) {
+            break;
+        }
+        for (int i=0; i<count; i++) {
+            const SAMPLE &sample = samples[i];
+
+            QVariantMap values;
+            values["timestamp"] = qint64(sample.timestamp);
+            for (int field=0; field<SAMPLE::FieldCount; field++) {
+                if (sample.has(typename SAMPLE::Field(field))) {
+                    values[SAMPLE::fieldName(typename SAMPLE::Field(field))] = double(sample.values[field]);
+                }
+            }
+            ret.append(values);
+        }
+        remaining -= count;
+    }
+
+    return ret;
+}
+
+QVariantList SpheroHandler::takeSensorSamples(const int maxCount)
+{
+    switch(m_robot.api) {
+    case RobotDefinition::V1:
+        return samplesToVariantList<v1::SensorSample>(m_sensorSamples, maxCount);
+    case RobotDefinition::V2:
+        return samplesToVariantList<v2::SensorSample>(m_sensorSamplesV2, maxCount);
+    default:
+        return {};
+    }
+}
+
+void SpheroHandler::onServiceDiscovered(const QBluetoothUuid &service)
+{
+    // We went ahead without it, but it isn't needed to drive anyways
+    if (m_radioService && service == m_robot.batteryService && !m_batteryService) {
+        qDebug() << " - Battery service showed up after setting up";
+        createBatteryService();
+        if (m_batteryService) {
+            m_batteryService->discoverDetails();
+        }
+        return;
+    }
+
+    if (m_radioService) {
+        return;
+    }
+
+    // These are all we need to drive, so don't wait for the rest
+    const QList<QBluetoothUuid> services = m_deviceController->services();
+    if (!services.contains(m_robot.radioService) || !services.contains(m_robot.mainService)) {
+        return;
+    }
+    qDebug() << " - Have the services we need, not waiting for the rest";
+    onServiceDiscoveryFinished();
+}
+
+void SpheroHandler::createBatteryService()
+{
+    m_batteryService = m_deviceController->createServiceObject(m_robot.batteryService, this);
+    if (!m_batteryService) {
+        return;
+    }
+
+    connect(m_batteryService, &QLowEnergyService::stateChanged, this, &SpheroHandler::onBatteryServiceChanged);
+    connect(m_batteryService, QOverload<QLowEnergyService::ServiceError>::of(&QLowEnergyService::error), this, [this](QLowEnergyService::ServiceError error) {
+        qWarning() << " ! Battery service error" << error;
+        if (!m_connectSequence.isFinished("battery service")) {
+            m_connectSequence.finish("battery service");
+        }
+    });
+    connect(m_batteryService, &QLowEnergyService::characteristicChanged, this, [](const QLowEnergyCharacteristic &characteristic, const QByteArray &value) {
+        if (characteristic.uuid() == QBluetoothUuid::BatteryLevel && !value.isEmpty()) {
+            qDebug() << " - Battery level" << uint8_t(value[0]) << "%";
+        }
+    });
+}
+
 void SpheroHandler::onServiceDiscoveryFinished()
 {
+    if (m_radioService) {
+        qDebug() << " - Discovery finished, already set up";
+        return;
+    }
     qDebug() << " - Discovered services";
 
 #if 0 // for dumping all services and all their characteristics
@@ -522,15 +917,9 @@ void SpheroHandler::onServiceDiscoveryFinished()
     }
     qDebug() << " - Got radio service";
 
-    connect(m_radioService, &QLowEnergyService::characteristicChanged, this, &SpheroHandler::onCharacteristicChanged);
     connect(m_radioService, &QLowEnergyService::stateChanged, this, &SpheroHandler::onRadioServiceChanged);
     connect(m_radioService, QOverload<QLowEnergyService::ServiceError>::of(&QLowEnergyService::error), this, &SpheroHandler::onServiceError);
 
-    connect(m_radioService, &QLowEnergyService::characteristicWritten, this, [](const QLowEnergyCharacteristic &c, const QByteArray &v) {
-        qDebug() << " - " << c.uuid() << "radio written" << v;
-    });
-
-
     if (m_mainService) {
         qWarning() << " ! main service already exists!";
         return;
@@ -549,14 +938,69 @@ void SpheroHandler::onServiceDiscoveryFinished()
         qDebug() << "main descriptor read" << value;
     });
 
-    connect(m_mainService, &QLowEnergyService::characteristicChanged, this, &SpheroHandler::onCharacteristicChanged);
     connect(m_mainService, QOverload<QLowEnergyService::ServiceError>::of(&QLowEnergyService::error), this, &SpheroHandler::onServiceError);
-    connect(m_mainService, &QLowEnergyService::characteristicWritten, this, [](const QLowEnergyCharacteristic &info, const QByteArray &value) {
-        qDebug() << " - main written" << info.uuid() << value.toHex(':');
-    });
     connect(m_mainService, &QLowEnergyService::stateChanged, this, &SpheroHandler::onMainServiceChanged);
 
-    m_radioService->discoverDetails();
+    // Optional, and we might go ahead before it shows up (see onServiceDiscovered())
+    if (m_deviceController->services().contains(m_robot.batteryService)) {
+        createBatteryService();
+    }
+
+    // Everything after the setup goes through this
+    BleTransport *transport = new BleTransport(this);
+    transport->addService(m_radioService);
+    transport->addService(m_mainService);
+    transport->setController(m_deviceController);
+    setTransport(transport);
+
+    // Only what has to happen in order waits for each other, the rest runs in parallel.
+    // The robot ignores commands until the radio is unlocked and awake.
+    m_connectSequence.addStep("radio service", {}, [this]() {
+        m_radioService->discoverDetails();
+    });
+    m_connectSequence.addStep("main service", {}, [this]() {
+        m_mainService->discoverDetails();
+    });
+    m_connectSequence.addStep("battery service", {}, [this]() {
+        if (!m_batteryService) {
+            qDebug() << " - No battery service (yet)";
+            m_connectSequence.finish("battery service");
+            return;
+        }
+        m_batteryService->discoverDetails();
+    });
+    m_connectSequence.addStep("unlock", {"radio service"}, [this]() {
+        if (!sendRadioControlCommand(m_robot.passwordCharacteristic, m_robot.radioPassword)) {
+            qWarning() << "Failed to send unlock password";
+            m_connectSequence.stop();
+            return;
+        }
+        m_connectSequence.finish("unlock");
+    });
+    m_connectSequence.addStep("wake", {"unlock"}, [this]() {
+        if (!wakeRadio()) {
+            m_connectSequence.stop();
+            return;
+        }
+        m_connectSequence.finish("wake");
+    });
+    m_connectSequence.addStep("notifications", {"main service"}, [this]() {
+        if (!enableNotifications()) {
+            m_connectSequence.stop();
+            return;
+        }
+        m_connectSequence.finish("notifications");
+    });
+    m_connectSequence.addStep("battery level", {"battery service"}, [this]() {
+        subscribeBatteryLevel();
+        m_connectSequence.finish("battery level");
+    });
+    m_connectSequence.addStep("initialize", {"wake", "notifications"}, [this]() {
+        initializeRobot();
+        m_connectSequence.finish("initialize");
+    });
+
+    m_connectSequence.start(m_connectTimer);
 }
 
 void SpheroHandler::onMainServiceChanged(QLowEnergyService::ServiceState newState)
@@ -583,10 +1027,15 @@ void SpheroHandler::onMainServiceChanged(QLowEnergyService::ServiceState newStat
         qDebug() << "service has char" << characteristic.uuid() << characteristic.name();
     }
 
-    m_commandsCharacteristic = m_mainService->characteristic(m_robot.commandsCharacteristic);
-    if (!m_commandsCharacteristic.isValid()) {
+    m_connectSequence.finish("main service");
+}
+
+bool SpheroHandler::enableNotifications()
+{
+    const QLowEnergyCharacteristic commandsCharacteristic = m_mainService->characteristic(m_robot.commandsCharacteristic);
+    if (!commandsCharacteristic.isValid()) {
         qWarning() << " ! Commands characteristic invalid";
-        return;
+        return false;
     }
 
     QLowEnergyCharacteristic responseCharacteristic;
@@ -595,15 +1044,15 @@ void SpheroHandler::onMainServiceChanged(QLowEnergyService::ServiceState newStat
         responseCharacteristic = m_mainService->characteristic(Characteristics::Main::V1::response);
         break;
     case RobotDefinition::V2:
-        responseCharacteristic = m_commandsCharacteristic;
+        responseCharacteristic = commandsCharacteristic;
         break;
     default:
         qWarning() << "Unhandled API version";
-        return;
+        return false;
     }
     if (!responseCharacteristic.isValid()) {
         qWarning() << " ! response characteristic invalid";
-        return;
+        return false;
     }
 
 
@@ -611,6 +1060,56 @@ void SpheroHandler::onMainServiceChanged(QLowEnergyService::ServiceState newStat
     m_mainService->writeDescriptor(responseCharacteristic.descriptor(QBluetoothUuid::ClientCharacteristicConfiguration), QByteArray::fromHex("0100"));
     m_mainService->writeDescriptor(m_mainService->characteristic(Characteristics::Main::V2::unknown1).descriptor(QBluetoothUuid::ClientCharacteristicConfiguration), QByteArray::fromHex("0100"));
 
+    return true;
+}
+
+void SpheroHandler::onBatteryServiceChanged(QLowEnergyService::ServiceState newState)
+{
+    if (newState == QLowEnergyService::DiscoveringServices) {
+        return;
+    }
+
+    // Not needed to drive, so never hold up connecting
+    if (newState != QLowEnergyService::ServiceDiscovered) {
+        qDebug() << " ! unhandled battery service state changed:" << newState;
+        if (!m_connectSequence.isFinished("battery service")) {
+            m_connectSequence.finish("battery service");
+        }
+        return;
+    }
+
+    // Showed up after the connect sequence was done with it
+    if (m_connectSequence.isFinished("battery service")) {
+        subscribeBatteryLevel();
+        return;
+    }
+    m_connectSequence.finish("battery service");
+}
+
+void SpheroHandler::subscribeBatteryLevel()
+{
+    if (!m_batteryService || m_batteryService->state() != QLowEnergyService::ServiceDiscovered) {
+        return;
+    }
+
+    // The V1 robots have their own battery service, which I don't know the contents of
+    const QLowEnergyCharacteristic levelCharacteristic = m_batteryService->characteristic(QBluetoothUuid::BatteryLevel);
+    if (!levelCharacteristic.isValid()) {
+        qDebug() << " - No standard battery level characteristic";
+        return;
+    }
+    if (!levelCharacteristic.value().isEmpty()) {
+        qDebug() << " - Battery level" << uint8_t(levelCharacteristic.value()[0]) << "%";
+    }
+
+    const QLowEnergyDescriptor notification = levelCharacteristic.descriptor(QBluetoothUuid::ClientCharacteristicConfiguration);
+    if (notification.isValid()) {
+        m_batteryService->writeDescriptor(notification, QByteArray::fromHex("0100"));
+    }
+}
+
+void SpheroHandler::initializeRobot()
+{
     qDebug() << " - Successfully connected";
 
     switch(m_robot.api) {
@@ -620,10 +1119,10 @@ void SpheroHandler::onMainServiceChanged(QLowEnergyService::ServiceState newStat
         sendCommandV1(v1::SetNonPersistentOptionsPacket{v1::SetNonPersistentOptionsPacket::StopOnDisconnect});
         setAutoStabilize(true);
         setDetectCollisions(true);
-        sendCommandV1(v1::CommandPacketHeader::HardwareControl, v1::CommandPacketHeader::SetDataStreaming, v1::DataStreamingCommandPacket::create(1) );
+        setSensorStreaming(v1::SensorSource::MotorBackEmf, 40, 1);
         break;
     case RobotDefinition::V2:
-        m_mainService->writeCharacteristic(m_commandsCharacteristic, v2::encode(v2::WakePacket()));
+        sendCommandV2(v2::WakePacket());
         break;
     default:
         qWarning() << "Unhandled API version";
@@ -631,6 +1130,12 @@ void SpheroHandler::onMainServiceChanged(QLowEnergyService::ServiceState newStat
     }
 
     setColor(Qt::green);
+    m_linkProfiles.start();
+
+    if (m_serviceChangedWatcher) {
+        qInfo().noquote() << QStringLiteral("%1 ready to drive %2 ms after connecting").arg(m_name).arg(m_connectTimer.elapsed());
+        m_serviceChangedWatcher->watch(m_deviceController);
+    }
 
     emit connectedChanged();
     emit statusMessageChanged(statusString());
@@ -640,6 +1145,11 @@ void SpheroHandler::onControllerStateChanged(QLowEnergyController::ControllerSta
 {
     if (state == QLowEnergyController::UnconnectedState) {
         qWarning() << " ! Disconnected";
+        m_requests.cancelAll();
+        m_requestTimer.stop();
+        m_motionWriter.clear();
+        m_linkProfiles.stop();
+        m_transmitQueue.reset();
         emit disconnected();
         emit statusMessageChanged(tr("Sphero lost connection"));
         return;
@@ -676,15 +1186,36 @@ void SpheroHandler::onServiceError(QLowEnergyService::ServiceError error)
     emit disconnected();
 }
 
-void SpheroHandler::onCharacteristicChanged(const QLowEnergyCharacteristic &characteristic, const QByteArray &data)
+void SpheroHandler::onCharacteristicWritten(const QBluetoothUuid &characteristic)
 {
+    if (characteristic == m_robot.commandsCharacteristic) {
+        m_transmitQueue.onWritten();
+        return;
+    }
+    qDebug() << " - " << characteristic << "radio written";
+}
+
+void SpheroHandler::onWriteFailed(const QBluetoothUuid &characteristic)
+{
+    if (characteristic == m_robot.commandsCharacteristic) {
+        m_transmitQueue.onWriteFailed();
+        return;
+    }
+    qWarning() << " ! Writing to" << characteristic << "failed";
+}
+
+void SpheroHandler::onCharacteristicChanged(const QBluetoothUuid &characteristic, const QByteArray &data)
+{
+
+    m_linkStats.traffic.bytesIn += uint64_t(data.size());
+    m_linkStats.traffic.notifications++;
 
     if (data.isEmpty()) {
-        qWarning() << " ! " << characteristic.uuid() << "got empty data";
+        qWarning() << " ! " << characteristic << "got empty data";
         return;
     }
 
-    if (characteristic.uuid() == QBluetoothUuid::ServiceChanged) {
+    if (characteristic == QBluetoothUuid::ServiceChanged) {
         // TODO: I think maybe this is when it is removed from the charger, and the battery service becomes available
         qDebug() << " ? GATT service changed" << data.toHex(':');
         return;
@@ -692,19 +1223,19 @@ void SpheroHandler::onCharacteristicChanged(const QLowEnergyCharacteristic &char
 
     switch(m_robot.api) {
     case RobotDefinition::V1:
-        qDebug() << "main characteristic changed";
-        if (characteristic.uuid() == Characteristics::Radio::V1::rssi) {
+        TRACE(lcSpheroRx) << " < Notification" << HexDump(data);
+        if (characteristic == Characteristics::Radio::V1::rssi) {
             m_rssi = data[0];
             emit rssiChanged();
             break;
         }
 
-        if (characteristic.uuid() == Characteristics::Main::V1::response) {
+        if (characteristic == Characteristics::Main::V1::response) {
             parsePacketV1(data);
             break;
         }
 
-        qWarning() << " ? Changed from unexpected characteristic" << characteristic.name() << characteristic.uuid() << data;
+        qWarning() << " ? Changed from unexpected characteristic" << characteristic << data;
         break;
 
     case RobotDefinition::V2:
@@ -712,7 +1243,7 @@ void SpheroHandler::onCharacteristicChanged(const QLowEnergyCharacteristic &char
         break;
     default:
         qWarning() << " !!!!! Unhandled API version";
-        qDebug() << "characteristic" << characteristic.uuid();
+        qDebug() << "characteristic" << characteristic;
         qDebug() << "DatA:" << data.toHex(':');
         break;
 
@@ -721,152 +1252,165 @@ void SpheroHandler::onCharacteristicChanged(const QLowEnergyCharacteristic &char
 
 void SpheroHandler::parsePacketV2(const QByteArray &data)
 {
-    if (data.startsWith(v2::StartOfPacket)) {
-        m_receiveBuffer = data;
-    } else if (!m_receiveBuffer.isEmpty()) {
-        m_receiveBuffer.append(data);
-    } else {
-        qWarning() << " ! Got data but without correct start";
-        qDebug() << data.toHex(':');
-        const int startOfData = data.indexOf(v2::StartOfPacket);
-        if (startOfData < 0) {
-            qWarning() << " ! Contains nothing useful";
-            m_receiveBuffer.clear();
+    const v2::FrameDecoder::Stats before = m_frameDecoderV2.stats();
+
+    m_frameDecoderV2.feed(data.constData(), data.size(), [this](const v2::FrameDecoder::Frame &frame) {
+        if (!m_decodeStats) {
+            handlePacketV2(frame);
             return;
         }
-        m_receiveBuffer = data.mid(startOfData);
-    }
 
-    int end = m_receiveBuffer.indexOf(v2::EndOfPacket);
-    while (end != -1) {
-        const QByteArray packetData = m_receiveBuffer.mid(0, end + 1);
-        m_receiveBuffer = m_receiveBuffer.mid(end + 1);
-        end = m_receiveBuffer.indexOf(v2::EndOfPacket);
+        v2::Packet base;
+        const uint16_t type = frame.read(&base) ? uint16_t(base.m_deviceID << 8 | base.m_commandID) : DecodeStats::InvalidType;
+        DecodeStats::Timer timer(m_decodeStats, type);
+        handlePacketV2(frame);
+    });
 
-        qDebug() << "Decoding" << packetData.toHex(':');
-        if (size_t(packetData.size()) < sizeof(v2::Packet)) {
-            qWarning() << "not enough data" << packetData.size();
-            qDebug() << packetData.toHex(':');
-            continue;
-        }
-        bool ok;
-        const v2::Packet base = v2::decode<v2::Packet>(packetData, &ok);
-        if (!ok) {
-            qWarning() << "Failed to decode" << packetData.toHex(':');
+    if (m_decodeStats) {
+        const v2::FrameDecoder::Stats &after = m_frameDecoderV2.stats();
+        const uint32_t failures = (after.checksumErrors - before.checksumErrors) + (after.escapeErrors - before.escapeErrors) + (after.overflows - before.overflows);
+        for (uint32_t i=0; i<failures; i++) {
+            m_decodeStats->addFailure();
         }
-        if (base.m_flags & v2::Packet::HasErrorCode) {
-            const v2::ResponsePacket response = v2::decode<v2::ResponsePacket>(packetData, &ok);
-            qWarning() << "Got error code" << v2::Packet::Error(response.errorCode);
-            qDebug() << "for" << v2::Packet::CommandTarget(base.m_deviceID) << base.m_commandID;
-            continue;
-        }
-
-//        qDebug() << "Got data for" << v2::Packet::CommandTarget(base.m_deviceID) << base.;
     }
 }
 
-void SpheroHandler::parsePacketV1(const QByteArray &data)
+void SpheroHandler::handlePacketV2(const v2::FrameDecoder::Frame &frame)
 {
-
-    qDebug() << " ------------ Characteristic changed" << data.toHex(':') << " ----------";
-
-    if (data.isEmpty()) {
-        qWarning() << " ! No data received";
+    v2::Packet base;
+    if (!frame.read(&base)) {
+        qWarning() << "not enough data" << frame.size;
+        m_linkStats.invalidFrames++;
+        if (m_decodeStats) {
+            m_decodeStats->addFailure();
+        }
         return;
     }
+    m_linkStats.frameTypes[uint16_t(base.m_deviceID << 8 | base.m_commandID)]++;
 
-    // New messages start with 0xFF, so reset buffer in that case
-    if (data.startsWith(0xFF)) {
-        m_receiveBuffer = data;
-    } else if (data.startsWith("u>\xff\xff")) {
-        // We don't always get this
-         // I _think_ the 'u>' is a separate packet, so just strip it
-        qDebug() << " - Got unknown something that looks like a prompt (u>), is an ack of some sorts?";
-        m_receiveBuffer = data.mid(2);
-    } else if (!m_receiveBuffer.isEmpty()) {
-        m_receiveBuffer.append(data);
-    } else {
-        qWarning() << " ! Got data but without correct start";
-        qDebug() << data;
-        const int startOfData = data.indexOf(0xFF);
-        if (startOfData < 0) {
-            qWarning() << " ! Contains nothing useful";
-            m_receiveBuffer.clear();
+    if (base.m_flags & v2::Packet::HasErrorCode) {
+        v2::ResponsePacket response;
+        if (!frame.read(&response)) {
+            qWarning() << "Error response without error code";
+            m_linkStats.invalidFrames++;
+            if (m_decodeStats) {
+                m_decodeStats->addFailure(uint16_t(base.m_deviceID << 8 | base.m_commandID));
+            }
             return;
         }
-        m_receiveBuffer = data.mid(startOfData);
-    }
+        const bool success = v2::Packet::Error(response.errorCode) == v2::Packet::Error::Success;
+        if (!success) {
+            qWarning() << "Got error code" << v2::Packet::Error(response.errorCode);
+            qDebug() << "for" << v2::Packet::CommandTarget(base.m_deviceID) << base.m_commandID;
+        }
 
-    if (m_receiveBuffer.size() > 10000) {
-        qWarning() << " ! Receive buffer too large, nuking" << m_receiveBuffer.size();
-        m_receiveBuffer.clear();
+        const int headerSize = int(sizeof(v2::ResponsePacket));
+        const QByteArray contents = QByteArray::fromRawData(reinterpret_cast<const char*>(frame.data + headerSize), frame.size - headerSize);
+        uint8_t deviceId, commandId;
+        if (!m_requests.complete(base.m_sequenceNumber, success, response.errorCode, contents, &deviceId, &commandId)) {
+            qDebug() << "Unexpected response for" << v2::Packet::CommandTarget(base.m_deviceID) << base.m_commandID << "sequence" << base.m_sequenceNumber;
+        } else {
+            onRequestCompleted();
+        }
+        scheduleRequestTimeout();
         return;
     }
 
-    if (m_receiveBuffer.size() < int(sizeof(v1::CommandPacketHeader))) {
-        qDebug() << " - Not a full header" << m_receiveBuffer.size();
+    if (base.m_deviceID == v2::Packet::Sensors && base.m_commandID == v2::Sensors::Sensor) {
+        handleSensorStreamV2(frame);
         return;
     }
 
-    ResponsePacketHeader header;
-    qFromBigEndian<uint8_t>(m_receiveBuffer.data(), sizeof(ResponsePacketHeader), &header);
-    qDebug() << " - magic" << header.magic;
-    if (header.magic != 0xFF) {
-        qWarning() << " ! Invalid magic";
-        return;
-    }
-    qDebug() << " - type" << header.type;
+//        qDebug() << "Got data for" << v2::Packet::CommandTarget(base.m_deviceID) << base.;
+}
 
-    switch(header.type) {
-    case ResponsePacketHeader::Response:
-    case ResponsePacketHeader::Notification:
-        break;
-    default:
-        qWarning() << " !!!!!!!!!!!!!!!!!!!!!  unhandled response type!: " << header.type;
-        m_receiveBuffer.clear();
+void SpheroHandler::handleSensorStreamV2(const v2::FrameDecoder::Frame &frame)
+{
+    if (!m_sensorSources) {
+        return;
     }
 
-    qDebug() << " - sequence num" << header.sequenceNumber;
-    qDebug() << " - data length" << header.dataLength;
+    const bool wasEmpty = m_sensorSamplesV2.isEmpty();
+    const int64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 
-    if (m_receiveBuffer.size() != sizeof(v1::CommandPacketHeader) + header.dataLength - 1) {
-        qWarning() << " ! Packet size wrong" << m_receiveBuffer.size();
-        qDebug() << "  > Expected" << sizeof(v1::CommandPacketHeader) << "+" << header.dataLength;
+    const int headerSize = int(sizeof(v2::Packet));
+    const int frames = v2::decodeSensorStream(m_sensorSources, frame.data + headerSize, frame.size - headerSize, timestamp, [this](const v2::SensorSample &sample) {
+        m_sensorSamplesV2.push(sample);
+        if (sample.has(v2::SensorSample::Pitch)) {
+            m_attitude = sample.attitude();
+        }
+    });
+    if (!frames) {
+        qWarning() << " ! Invalid sensor stream data" << frame.size - headerSize << "for sources" << QByteArray::number(qulonglong(m_sensorSources), 16);
+        m_linkStats.invalidFrames++;
+        if (m_decodeStats) {
+            m_decodeStats->addFailure(uint16_t(v2::Packet::Sensors << 8 | v2::Sensors::Sensor));
+        }
         return;
     }
 
-    uint8_t checksum = 0;
-    for (int i=2; i<m_receiveBuffer.size() - 1; i++) {
-        checksum += uint8_t(m_receiveBuffer[i]);
+    if (m_sensorSources & v2::SensorSource::Attitude) {
+        publishState();
     }
-    checksum ^= 0xFF;
-    if (!m_receiveBuffer.endsWith(checksum)) {
-        qWarning() << " !!!! Invalid checksum !!!!" << checksum;
-        qDebug() << "  > Expected" << uint8_t(m_receiveBuffer.back());
-        return;
+
+    if (wasEmpty) {
+        emit sensorSamplesAvailable();
     }
+}
 
-    qDebug() << " - Checksum:" << QByteArray::number(checksum, 16);
+void SpheroHandler::parsePacketV1(const QByteArray &data)
+{
+    const v1::FrameReassembler::Stats before = m_frameReassemblerV1.stats();
 
-    QByteArray contents = data.mid(sizeof(ResponsePacketHeader), header.dataLength - 1); // checksum is last byte
-    if (contents.isEmpty()) {
-        qWarning() << " ! No contents";
+    m_frameReassemblerV1.feed(data.constData(), data.size(), [this](const v1::FrameReassembler::Frame &frame) {
+        if (!m_decodeStats) {
+            handlePacketV1(frame);
+            return;
+        }
+
+        DecodeStats::Timer timer(m_decodeStats, uint16_t(frame.type << 8 | frame.packetType));
+        handlePacketV1(frame);
+    });
+
+    const v1::FrameReassembler::Stats &after = m_frameReassemblerV1.stats();
+    if (after.resyncs != before.resyncs || after.checksumErrors != before.checksumErrors) {
+        qWarning() << " ! Receive stream corrupted, resyncs:" << after.resyncs << "checksum failures:" << after.checksumErrors << "dropped bytes:" << after.droppedBytes;
+
+        if (m_decodeStats) {
+            const uint32_t failures = (after.resyncs - before.resyncs) + (after.checksumErrors - before.checksumErrors);
+            for (uint32_t i=0; i<failures; i++) {
+                m_decodeStats->addFailure();
+            }
+        }
     }
-    qDebug() << " - received contents" << contents.size() << contents.toHex(':');
-    qDebug() << " - response type:" << header.type;
+}
 
-    m_receiveBuffer.clear(); // TODO leave some
+void SpheroHandler::handlePacketV1(const v1::FrameReassembler::Frame &frame)
+{
+    ResponsePacketHeader header;
+    header.type = frame.type;
+    header.packetType = frame.packetType;
+    header.sequenceNumber = frame.sequenceNumber;
+    m_linkStats.frameTypes[uint16_t(frame.type << 8 | frame.packetType)]++;
+
+    // Points into the reassembly buffer, only valid until we return
+    const QByteArray contents = QByteArray::fromRawData(frame.contents, frame.size);
+    if (contents.isEmpty()) {
+        TRACE(lcSpheroRx) << " - No contents";
+    }
 
     switch(header.type) {
     case ResponsePacketHeader::Response: {
-        if (!m_pendingSyncRequests.contains(header.sequenceNumber)) {
+        QPair<uint8_t, uint8_t> responseToCommand;
+        const bool success = header.packetType == ResponsePacketHeader::Ack;
+        if (!m_requests.complete(header.sequenceNumber, success, header.packetType, contents, &responseToCommand.first, &responseToCommand.second)) {
             qWarning() << " ! this was not an expected response";
             break;
         }
+        onRequestCompleted();
+        scheduleRequestTimeout();
 
-        const QPair<uint8_t, uint8_t> responseToCommand = m_pendingSyncRequests.take(header.sequenceNumber);
-
-        qDebug() << " - ack response" << ResponsePacketHeader::PacketType(header.packetType);
+        TRACE(lcSpheroRx) << " - ack response" << ResponsePacketHeader::PacketType(header.packetType);
 //        qDebug() << "Content length" << contents.length() << "data length" << header.dataLength << "buffer length" << m_receiveBuffer.length() << "locator packet size" << sizeof(LocatorPacket) << "response packet size" << sizeof(ResponsePacketHeader);
 
         if (header.packetType == ResponsePacketHeader::InvalidParameter) {
@@ -950,11 +1494,11 @@ void SpheroHandler::parsePacketV1(const QByteArray &data)
                 break;
             }
             case v1::CommandPacketHeader::SetHeading: {
-                qDebug() << " + Heading set";
+                TRACE(lcSpheroRx) << " + Heading set";
                 break;
             }
             case v1::CommandPacketHeader::Roll: {
-                qDebug() << " + Roll set";
+                TRACE(lcSpheroRx) << " + Roll set";
                 break;
             }
             case v1::CommandPacketHeader::SetDataStreaming: {
@@ -980,7 +1524,7 @@ void SpheroHandler::parsePacketV1(const QByteArray &data)
         break;
     }
     case ResponsePacketHeader::Notification:
-        qDebug() << " - data notification" << header.packetType;
+        TRACE(lcSpheroRx) << " - data notification" << header.packetType;
         switch(header.packetType) {
         case ResponsePacketHeader::PowerNotification: {
             if (contents.size() != 1) {
@@ -1000,6 +1544,33 @@ void SpheroHandler::parsePacketV1(const QByteArray &data)
 
             break;
         }
+        case ResponsePacketHeader::SensorStream: {
+            const bool wasEmpty = m_sensorSamples.isEmpty();
+            const int64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+            const int frames = v1::decodeSensorStream(m_sensorSources, frame.contents, frame.size, timestamp, [this](const v1::SensorSample &sample) {
+                m_sensorSamples.push(sample);
+                if (sample.has(v1::SensorSample::ImuPitch)) {
+                    const Orientation<int16_t> imu = sample.imu();
+                    m_attitude = {float(imu.pitch), float(imu.roll), float(imu.yaw)};
+                }
+            });
+            if (!frames) {
+                qWarning() << " ! Invalid sensor stream data" << frame.size << "for sources" << QByteArray::number(qulonglong(m_sensorSources), 16);
+                if (m_decodeStats) {
+                    m_decodeStats->addFailure(uint16_t(frame.type << 8 | frame.packetType));
+                }
+                break;
+            }
+            if (m_sensorSources & v1::SensorSource::ImuAll) {
+                publishState();
+            }
+
+            if (wasEmpty) {
+                emit sensorSamplesAvailable();
+            }
+            break;
+        }
         case ResponsePacketHeader::SleepingIn10Sec : {
             qWarning() << "Going to sleep soon";
             break;
@@ -1016,9 +1587,7 @@ void SpheroHandler::parsePacketV1(const QByteArray &data)
         break;
     default:
         qWarning() << " ! unhandled type" << header.type;
-        m_receiveBuffer.clear();
     }
-    qDebug() << " ************************* ";
 
 //    // async
 //    switch(header.response) {
@@ -1082,11 +1651,11 @@ void SpheroHandler::onRadioServiceChanged(QLowEnergyService::ServiceState newSta
         return;
     }
 
-    if (!sendRadioControlCommand(m_robot.passwordCharacteristic, m_robot.radioPassword)) {
-        qWarning() << "Failed to send unlock password";
-        return;
-    }
+    m_connectSequence.finish("radio service");
+}
 
+bool SpheroHandler::wakeRadio()
+{
     switch(m_robot.api) {
     case RobotDefinition::V1: {
         if (!sendRadioControlCommand(Characteristics::Radio::V1::transmitPower, "\x7") ||
@@ -1094,7 +1663,7 @@ void SpheroHandler::onRadioServiceChanged(QLowEnergyService::ServiceState newSta
             qWarning() << " ! Init sequence failed";
             emit disconnected();
             emit statusMessageChanged(tr("Sphero Init sequence failed"));
-            return;
+            return false;
         }
         const QLowEnergyCharacteristic rssiCharacteristic = m_radioService->characteristic(Characteristics::Radio::V1::rssi);
         m_radioService->writeDescriptor(rssiCharacteristic.descriptor(QBluetoothUuid::ClientCharacteristicConfiguration), QByteArray::fromHex("0100"));
@@ -1115,11 +1684,11 @@ void SpheroHandler::onRadioServiceChanged(QLowEnergyService::ServiceState newSta
     }
     default:
         qWarning() << "unhandled robot api";
-        return;
+        return false;
     }
 
     qDebug() << " - Init sequence done";
-    m_mainService->discoverDetails();
+    return true;
 }
 
 bool SpheroHandler::sendRadioControlCommand(const QBluetoothUuid &characteristicUuid, const QByteArray &data)
@@ -1133,44 +1702,120 @@ bool SpheroHandler::sendRadioControlCommand(const QBluetoothUuid &characteristic
         qWarning() << "Radio characteristic" << characteristicUuid << "not available";
         return false;
     }
-    m_radioService->writeCharacteristic(characteristic, data);
+    m_transport->write(characteristicUuid, data, QLowEnergyService::WriteWithResponse);
     return true;
 }
 
-void SpheroHandler::sendCommandV1(const uint8_t deviceId, const uint8_t commandID, const QByteArray &data)
+void SpheroHandler::sendCommandV1(const uint8_t deviceId, const uint8_t commandID, const QByteArray &data, RequestTracker::Callback callback, const TransmitQueue::Priority priority)
 {
     v1::CommandPacketHeader packet(deviceId, commandID);
     if (!packet.isValid()) {
         return;
     }
-    qDebug() << " >>>>>>>>>>> sending command <<<<<<<<<<";
-    qDebug() << " - data" << data;
+    TRACE(lcSpheroTx) << " > Sending command, data" << HexDump(data);
 
-    if (packet.isSynchronous()) {
-        if (!m_nextSequenceNumber) {
-            m_nextSequenceNumber++; // skip 0, that's special
-        }
-        if (m_pendingSyncRequests.contains(m_nextSequenceNumber)) {
-            qWarning() << " !!!!!! We have outstanding requests, overflow?";
-            qWarning() << " !!!!!! Next request:" << m_nextSequenceNumber;
-            qWarning() << " !!!!!! Outstanding requests:" << m_pendingSyncRequests;
+    if (!packet.isSynchronous()) {
+        const QByteArray toSend = packet.encode(data);
+        if (toSend.isEmpty()) {
+            qDebug() << " ! Encoding packet failed!";
             return;
         }
+        m_transmitQueue.enqueue(priority, toSend);
+        return;
+    }
 
-        packet.setSequenceNumber(m_nextSequenceNumber);
-        m_pendingSyncRequests.insert(m_nextSequenceNumber, {deviceId, commandID});
+    m_requests.submit(deviceId, commandID, [packet, data](const uint8_t sequenceNumber) mutable {
+        packet.setSequenceNumber(sequenceNumber);
+        return packet.encode(data);
+    }, std::move(callback), priority);
+    scheduleRequestTimeout();
+}
 
-        m_nextSequenceNumber++;
+bool SpheroHandler::isNonIdempotent(const RobotDefinition::APIVersion api, const uint8_t deviceId, const uint8_t commandId)
+{
+    switch(api) {
+    case RobotDefinition::V1:
+        if (deviceId == v1::CommandPacketHeader::Internal) {
+            return commandId == v1::CommandPacketHeader::Sleep || commandId == v1::CommandPacketHeader::GotoBl;
+        }
+        if (deviceId == v1::CommandPacketHeader::HardwareControl) {
+            return commandId == v1::CommandPacketHeader::Boost || commandId == v1::CommandPacketHeader::SelfLevel;
+        }
+        return false;
+    case RobotDefinition::V2:
+        // Animations and sounds would play twice
+        if (deviceId == v2::Packet::AnimationControl || deviceId == v2::Packet::AVControl) {
+            return true;
+        }
+        if (deviceId == v2::Packet::MainSystem) {
+            return commandId == v2::Power::EnterDeepSleep || commandId == v2::Power::EnterSoftSleep || commandId == v2::Power::Sleep;
+        }
+        return false;
+    default:
+        return false;
     }
+}
 
-    const QByteArray toSend = packet.encode(data);
-    if (toSend.isEmpty()) {
-        qDebug() << " ! Encoding packet failed!";
+void SpheroHandler::scheduleRequestTimeout()
+{
+    const int64_t deadline = m_requests.nextDeadline();
+    if (deadline < 0) {
+        m_requestTimer.stop();
         return;
     }
-    qDebug() << " ++++++++++++++++++++++++++++++++++++++";
 
-    m_mainService->writeCharacteristic(m_commandsCharacteristic, toSend);
+    // Round up, so we don't wake up just before it expires
+    const int64_t remaining = deadline - RequestTracker::now();
+    m_requestTimer.start(int(qMax<int64_t>(0, (remaining + 999999) / 1000000)));
+}
+
+void SpheroHandler::onRequestCompleted()
+{
+    if (!m_latencyTimer.isActive()) {
+        m_latencyTimer.start();
+    }
+}
+
+QVariantMap SpheroHandler::latencies() const
+{
+    return m_requests.latencies().toVariantMap([this](const uint16_t command) { return latencyName(command); });
+}
+
+bool SpheroHandler::dumpLatencies(const QString &path)
+{
+    const QString header = QStringLiteral("%1 %2, rssi %3 dBm").arg(m_name, QDateTime::currentDateTime().toString(Qt::ISODate)).arg(m_rssi);
+    return m_requests.latencies().dump(path, header, [this](const uint16_t command) { return latencyName(command); });
+}
+
+void SpheroHandler::resetLatencies()
+{
+    m_requests.clearLatencies();
+    emit latenciesChanged();
+}
+
+QString SpheroHandler::latencyName(const uint16_t command) const
+{
+    const uint8_t deviceId = command >> 8;
+    const uint8_t commandId = command & 0xFF;
+
+    if (m_robot.api == RobotDefinition::V1) {
+        switch(deviceId) {
+        case v1::CommandPacketHeader::Internal:
+            return EnumHelper::toString(v1::CommandPacketHeader::InternalCommand(commandId));
+        case v1::CommandPacketHeader::HardwareControl:
+            return EnumHelper::toString(v1::CommandPacketHeader::HardwareCommand(commandId));
+        default:
+            break;
+        }
+    }
+
+    return EnumHelper::toString(v2::Packet::CommandTarget(deviceId)) + QStringLiteral(" 0x") + QString::number(commandId, 16);
+}
+
+void SpheroHandler::onRequestTimeout()
+{
+    m_requests.expire(RequestTracker::now());
+    scheduleRequestTimeout();
 }
 
 SpheroHandler::RobotDefinition::RobotDefinition(const RobotType type)
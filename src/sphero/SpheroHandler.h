@@ -3,6 +3,22 @@
 #include "BasicTypes.h"
 
 #include "utils.h"
+#include "RingBuffer.h"
+#include "RequestTracker.h"
+#include "MotionWriter.h"
+#include "TransmitQueue.h"
+#include "Transport.h"
+#include "DecodeStats.h"
+#include "LinkStats.h"
+#include "LinkProfiles.h"
+#include "RobotState.h"
+#include "ServiceChangedWatcher.h"
+#include "ConnectSequence.h"
+#include "v1/CommandPackets.h"
+#include "v1/FrameReassembler.h"
+#include "v1/SensorStream.h"
+#include "v2/FrameDecoder.h"
+#include "v2/SensorStream.h"
 
 #include <QObject>
 #include <QPointer>
@@ -11,6 +27,9 @@
 #include <QLowEnergyCharacteristic>
 #include <QLowEnergyController>
 #include <QColor>
+#include <QVariantList>
+#include <QTimer>
+#include <QElapsedTimer>
 
 class QLowEnergyController;
 class QBluetoothDeviceInfo;
@@ -46,6 +65,10 @@ class SpheroHandler : public QObject
 
     Q_PROPERTY(PowerState powerState READ powerState NOTIFY powerChanged)
 
+    Q_PROPERTY(QVariantMap latencies READ latencies NOTIFY latenciesChanged)
+    Q_PROPERTY(QVariantMap linkStats READ linkStatsMap NOTIFY linkStatsChanged)
+    Q_PROPERTY(QString linkStatsText READ linkStatsText NOTIFY linkStatsChanged)
+
 public:
     enum class RobotType {
         Unknown,
@@ -74,8 +97,15 @@ public:
 public:
 
     explicit SpheroHandler(const QBluetoothDeviceInfo &deviceInfo, QObject *parent);
+
+    // Without Bluetooth, e. g. with a SimulatedRobot, takes ownership of the transport.
+    // The type of robot is from the name, same as for real ones.
+    SpheroHandler(Transport *transport, const QString &name, QObject *parent);
     ~SpheroHandler();
 
+    /// Times and counts every received frame, nullptr to stop
+    void setDecodeStats(DecodeStats *stats);
+
     bool isConnected();
 
     QString statusString();
@@ -117,11 +147,82 @@ public:
 
     PowerState powerState() const { return m_powerState; }
 
+    // sources is a combination of v1::SensorSource or v2::SensorSource depending on the robot,
+    // rate is in Hz (V1 max 400, V2 is limited by the BLE connection interval)
+    void setSensorStreaming(const uint64_t sources, const int rate = 40, const int packetCount = 0);
+    void stopSensorStreaming() { setSensorStreaming(0); }
+
+    // Can be called from any (but only one) thread, only the one matching the robot gets samples
+    size_t readSensorSamples(v1::SensorSample *samples, const size_t maxCount) { return m_sensorSamples.pop(samples, maxCount); }
+    size_t readSensorSamples(v2::SensorSample *samples, const size_t maxCount) { return m_sensorSamplesV2.pop(samples, maxCount); }
+
+    // Only pops the sample ring, so DeviceProxy calls it directly on the GUI thread
+    // (which makes that the only thread that may read samples)
+    Q_INVOKABLE QVariantList takeSensorSamples(const int maxCount = 64);
+
+    // Synchronous commands are pipelined, this many can be waiting for a response at once
+    void setPipelineDepth(const int depth) { m_requests.setPipelineDepth(depth); }
+    void setRequestTimeout(const int milliseconds, const int retries) { m_requests.setTimeout(milliseconds); m_requests.setMaxRetries(retries); }
+    const RequestTracker::Stats &requestStats() const { return m_requests.stats(); }
+
+    // The callback is called when the robot responds, or the request times out or is cancelled.
+    // Asynchronous commands never get a response, so the callback isn't used for them.
+    // Safety commands should be asynchronous, so they don't wait for room in the request pipeline.
+    void sendCommandV1(const uint8_t deviceId, const uint8_t commandID, const QByteArray &data = QByteArray(), RequestTracker::Callback callback = {},
+            const TransmitQueue::Priority priority = TransmitQueue::Config);
+
+    template<typename PACKET> void sendCommandV1(const PACKET &packet, RequestTracker::Callback callback = {}, const TransmitQueue::Priority priority = TransmitQueue::Config) {
+        using Frame = v1::CommandFrame<PACKET>;
+
+        if (!Frame::isSynchronous) {
+            const typename Frame::Buffer frame = Frame::encode(packet, 0);
+            m_transmitQueue.enqueue(priority, QByteArray(frame.data(), int(frame.size())));
+            return;
+        }
+
+        m_requests.submit(PACKET::deviceId, PACKET::commandId, [packet](const uint8_t sequenceNumber) {
+            const typename Frame::Buffer frame = Frame::encode(packet, sequenceNumber);
+            return QByteArray(frame.data(), int(frame.size()));
+        }, std::move(callback), priority);
+        scheduleRequestTimeout();
+    }
+
+    template<typename PACKET> void sendCommandV2(PACKET packet, RequestTracker::Callback callback = {}, const TransmitQueue::Priority priority = TransmitQueue::Config) {
+        if (!packet.isSynchronous()) {
+            m_transmitQueue.enqueue(priority, v2::encode(packet));
+            return;
+        }
+
+        m_requests.submit(packet.m_deviceID, packet.m_commandID, [packet](const uint8_t sequenceNumber) mutable {
+            packet.m_sequenceNumber = sequenceNumber;
+            return v2::encode(packet);
+        }, std::move(callback), priority);
+        scheduleRequestTimeout();
+    }
+
+    const TransmitQueue::Stats &transmitStats() const { return m_transmitQueue.stats(); }
+
+    // Milliseconds without any setpoints before asking for the idle connection parameters
+    void setLinkIdleTimeout(const int milliseconds) { m_linkProfiles.setIdleTimeout(milliseconds); }
+
+    /// Round trip times of synchronous requests, in ms, see LatencyStats::toVariantMap()
+    QVariantMap latencies() const;
+
+    /// Snapshot of the protocol counters, linkStatsChanged() is emitted every second while connected
+    LinkStats linkStats() const;
+    QVariantMap linkStatsMap() const;
+    QString linkStatsText() const;
+
+    /// Safe to call from any thread, unlike everything else here
+    RobotState state() const { return m_state.load(); }
+
 signals:
     void connectedChanged();
     void rssiChanged();
     void disconnected(); // TODO
     void statusMessageChanged(const QString &message);
+    void latenciesChanged();
+    void linkStatsChanged();
 
     void colorChanged();
     void angleChanged();
@@ -131,42 +232,98 @@ signals:
 
     void powerChanged();
 
+    // Only emitted when new samples arrive in an empty buffer, so read until it is empty
+    void sensorSamplesAvailable();
+
 public slots:
     void disconnectFromRobot();
     void brake();
 
+    bool dumpLatencies(const QString &path);
+    void resetLatencies();
+
 private slots:
     void onControllerStateChanged(QLowEnergyController::ControllerState state);
     void onControllerError(QLowEnergyController::Error newError);
 
+    void onServiceDiscovered(const QBluetoothUuid &service);
     void onServiceDiscoveryFinished();
     void onMainServiceChanged(QLowEnergyService::ServiceState newState);
     void onServiceError(QLowEnergyService::ServiceError error);
 
-    void onCharacteristicChanged(const QLowEnergyCharacteristic &characteristic, const QByteArray &newValue);
+    void onCharacteristicChanged(const QBluetoothUuid &characteristic, const QByteArray &newValue);
+    void onCharacteristicWritten(const QBluetoothUuid &characteristic);
+    void onWriteFailed(const QBluetoothUuid &characteristic);
     void onRadioServiceChanged(QLowEnergyService::ServiceState newState);
+    void onBatteryServiceChanged(QLowEnergyService::ServiceState newState);
+
+    void onRequestTimeout();
+    void onLinkStatsTimer();
+    void publishState();
 
 private:
+    void setupWriters();
+    void setTransport(Transport *transport);
+    void initializeRobot(); // when the services are ready
+    void stopRobot(); // before disconnecting
+    void closeConnection();
+
+    // Steps in m_connectSequence
+    void createBatteryService();
+    bool wakeRadio();
+    bool enableNotifications();
+    void subscribeBatteryLevel();
+
     bool sendRadioControlCommand(const QBluetoothUuid &characteristicUuid, const QByteArray &data);
-    void sendCommandV1(const uint8_t deviceId, const uint8_t commandID, const QByteArray &data = QByteArray());
     void parsePacketV1(const QByteArray &data);
+    void handlePacketV1(const v1::FrameReassembler::Frame &frame);
     void parsePacketV2(const QByteArray &data);
+    void handlePacketV2(const v2::FrameDecoder::Frame &frame);
+    void handleSensorStreamV2(const v2::FrameDecoder::Frame &frame);
+
+    void scheduleRequestTimeout();
+    void onRequestCompleted();
+    QString latencyName(const uint16_t command) const;
 
-    template<typename PACKET> void sendCommandV1(const PACKET &packet) {
-        sendCommandV1(PACKET::deviceId, PACKET::commandId, packetToByteArray(packet));
+    // Only the latest setpoint matters, so these are coalesced and sent without response
+    template<typename PACKET> void sendMotionV1(const PACKET &packet) {
+        using Frame = v1::CommandFrame<PACKET>;
+        static_assert(!Frame::isSynchronous, "Motion commands can't wait for a response");
+
+        const typename Frame::Buffer frame = Frame::encode(packet, 0);
+        m_linkProfiles.onActivity();
+        m_motionWriter.write(QByteArray(frame.data(), int(frame.size())));
+    }
+    void sendMotionV2(v2::DrivePacket packet) {
+        packet.m_flags &= ~v2::Packet::Synchronous;
+        m_linkProfiles.onActivity();
+        m_motionWriter.write(v2::encode(packet));
     }
 
 
-    QPointer<QLowEnergyController> m_deviceController;
+    static constexpr int disconnectTimeout = 1000; // ms to wait for the sleep command to get out
 
-    QLowEnergyCharacteristic m_commandsCharacteristic;
+    QPointer<QLowEnergyController> m_deviceController;
+    QPointer<Transport> m_transport;
+    DecodeStats *m_decodeStats = nullptr;
+    capture::Recorder m_recorder; // only if $ROBOT_CAPTURE_DIR is set
 
     QLowEnergyDescriptor m_readDescriptor;
 
     QPointer<QLowEnergyService> m_mainService;
     QPointer<QLowEnergyService> m_radioService;
+    QPointer<QLowEnergyService> m_batteryService; // not all have it
+
+    ServiceChangedWatcher *m_serviceChangedWatcher = nullptr; // only with bluetooth
+    QElapsedTimer m_connectTimer;
+    ConnectSequence m_connectSequence;
 
-    QByteArray m_receiveBuffer;
+    v1::FrameReassembler m_frameReassemblerV1;
+    v2::FrameDecoder m_frameDecoderV2;
+
+    LinkStats m_linkStats;
+    QTimer m_linkStatsTimer;
+    int m_linkStatsTicks = 0;
 
     QString m_name;
     int8_t m_rssi = 0;
@@ -200,12 +357,32 @@ private:
 
     RobotType m_robotType = RobotType::Unknown;
 
-    QMap<uint8_t, QPair<uint8_t, uint8_t>> m_pendingSyncRequests;
-    uint8_t m_nextSequenceNumber = 0;
+    TransmitQueue m_transmitQueue;
+
+    RequestTracker m_requests;
+    QTimer m_requestTimer;
+    QTimer m_latencyTimer; // so QML isn't updated for every response
+
+    MotionWriter m_motionWriter;
+    LinkProfiles m_linkProfiles; // drive or idle connection parameters
 
     PowerState m_powerState = UnknownPowerState;
 
+    uint64_t m_sensorSources = 0;
+    SpscRingBuffer<v1::SensorSample, 1024> m_sensorSamples;
+    SpscRingBuffer<v2::SensorSample, 1024> m_sensorSamplesV2;
+    Orientation<float> m_attitude{}; // latest streamed, if any
+
+    SeqLock<RobotState> m_state;
+    uint64_t m_stateVersion = 0;
+
     RobotDefinition m_robot;
+
+    // The types are (type << 8 | packet type) for V1, and (device << 8 | command) for V2
+    static QString packetTypeName(const RobotDefinition::APIVersion api, const uint16_t type);
+
+    // Commands that shouldn't be resent when they time out, the robot might have done them already
+    static bool isNonIdempotent(const RobotDefinition::APIVersion api, const uint8_t deviceId, const uint8_t commandId);
 };
 
 using RobotType = SpheroHandler::RobotType;
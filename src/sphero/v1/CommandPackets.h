@@ -1,12 +1,15 @@
 #pragma once
 
 #include "BasicTypes.h"
+#include "Logging.h"
 #include "utils.h"
 
 #include <QDebug>
 #include <QObject>
 #include <QtEndian>
+#include <array>
 #include <cstdint>
+#include <cstring>
 
 namespace sphero {
 namespace v1 {
@@ -18,13 +21,14 @@ struct CommandPacketHeader {
 public:
     enum TimeoutHandling : uint8_t {
         KeepTimeout = 0,
-        ResetTimeout = 1 << 0
+        ResetTimeout = 1 << 1
     };
     Q_ENUM(TimeoutHandling)
 
+    // The robot only responds if this is set, so 0xFE is asynchronous
     enum SynchronousType : uint8_t {
         Asynchronous = 0,
-        Synchronous = 1 << 1
+        Synchronous = 1 << 0
     };
     Q_ENUM(SynchronousType)
 
@@ -135,112 +139,69 @@ public:
     };
     Q_ENUM(SoulCommands)
 
-    CommandPacketHeader(const uint8_t deviceID, const uint8_t commandID) :
-        m_deviceID(deviceID),
-        m_commandID(commandID)
-    {
-        uint8_t flags = 0xFC;
+    static constexpr uint8_t SynchronousFlags = 0xFF;
+    static constexpr uint8_t AsynchronousFlags = 0xFE;
+
+    /// Returns 0 for commands we can't send
+    static constexpr uint8_t flagsFor(const uint8_t deviceID, const uint8_t commandID) {
         switch(deviceID) {
         case CommandPacketHeader::Internal:
-            qDebug() << " > Sending internal command" << CommandPacketHeader::InternalCommand(m_commandID);
-            switch(m_commandID) {
+            switch(commandID) {
             case CommandPacketHeader::GetPwrState:
-                flags |= CommandPacketHeader::Synchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
-            case CommandPacketHeader::SetPwrNotify:
-                flags |= CommandPacketHeader::Asynchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
             case CommandPacketHeader::Sleep:
-                flags |= CommandPacketHeader::Synchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
             case CommandPacketHeader::GetAutoReconnect:
-                flags |= CommandPacketHeader::Synchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
             case CommandPacketHeader::Ping:
-                flags |= CommandPacketHeader::Synchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
+                return SynchronousFlags;
+            case CommandPacketHeader::SetPwrNotify:
+                return AsynchronousFlags;
             default:
-                qWarning() << "Unhandled packet internal command" << m_commandID;
-                flags |= CommandPacketHeader::Asynchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                return;
+                return 0;
             }
 
-            break;
         case CommandPacketHeader::HardwareControl:
-            qDebug() << " > Sending hardware command" << CommandPacketHeader::HardwareCommand(m_commandID);
-            switch(m_commandID) {
+            switch(commandID) {
             case CommandPacketHeader::GetRGBLed:
-                flags |= CommandPacketHeader::Synchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
             case CommandPacketHeader::GetLocatorData:
-                flags |= CommandPacketHeader::Synchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
             case CommandPacketHeader::SetDataStreaming:
-                flags |= CommandPacketHeader::Synchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
+            case CommandPacketHeader::SetStabilization:
+            case CommandPacketHeader::SetNonPersistentOptionFlags:
+                return SynchronousFlags;
             case CommandPacketHeader::ConfigureCollisionDetection:
-                flags |= CommandPacketHeader::Asynchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
             case CommandPacketHeader::SetRGBLed:
-                flags |= CommandPacketHeader::Asynchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
             case CommandPacketHeader::SetBackLED:
-                flags |= CommandPacketHeader::Asynchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
             case CommandPacketHeader::Roll:
-                flags |= CommandPacketHeader::Asynchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
-            case CommandPacketHeader::SetStabilization:
-                flags |= CommandPacketHeader::Synchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
             case CommandPacketHeader::SetHeading:
-                flags |= CommandPacketHeader::Asynchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
             case CommandPacketHeader::SetRotationRate:
-                flags |= CommandPacketHeader::Asynchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
-            case CommandPacketHeader::SetNonPersistentOptionFlags:
-                flags |= CommandPacketHeader::Synchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
+                return AsynchronousFlags;
             default:
-                qWarning() << " !!!!!!!!!!!!!!! Unhandled packet hardware command" << m_commandID;
-                flags |= CommandPacketHeader::Asynchronous;
-                flags |= CommandPacketHeader::ResetTimeout;
-                break;
+                // Unhandled hardware command, assume asynchronous
+                return AsynchronousFlags;
             }
 
+        default:
+            return AsynchronousFlags;
+        }
+    }
+
+    CommandPacketHeader(const uint8_t deviceID, const uint8_t commandID) :
+        m_flags(flagsFor(deviceID, commandID)),
+        m_deviceID(deviceID),
+        m_commandID(commandID)
+    {
+        switch(deviceID) {
+        case CommandPacketHeader::Internal:
+            TRACE(lcSpheroTx) << " > Sending internal command" << CommandPacketHeader::InternalCommand(m_commandID);
+            if (!m_flags) {
+                qWarning() << "Unhandled packet internal command" << m_commandID;
+            }
+            break;
+        case CommandPacketHeader::HardwareControl:
+            TRACE(lcSpheroTx) << " > Sending hardware command" << CommandPacketHeader::HardwareCommand(m_commandID);
             break;
         default:
             qWarning() << "Unhandled device id" << deviceID;
-            m_flags |= CommandPacketHeader::Asynchronous;
-            m_flags |= CommandPacketHeader::ResetTimeout;
             break;
         }
-
-//        m_flags = flags;
-        if (flags & Synchronous) {
-            m_flags = 0xff;
-        } else {
-            m_flags = 0xfe;
-        }
-
     }
 
     bool isValid() const {
@@ -276,12 +237,7 @@ public:
 
         toSend.append(checksum xor 0xFF);
 
-        qDebug() << " - Writing command" << toSend.toHex(':');
-
-        qDebug() << " + Packet:";
-        qDebug() << "  ] Device id:" << m_deviceID;
-        qDebug() << "  ] command id:" << m_commandID;
-        qDebug() << "  ] seq number:" << m_sequenceNumber;
+        TRACE(lcSpheroTx) << " - Writing command" << HexDump(toSend) << "device id:" << m_deviceID << "command id:" << m_commandID << "seq number:" << m_sequenceNumber;
 
         return toSend;
     }
@@ -298,6 +254,59 @@ private:
 
 static_assert(sizeof(CommandPacketHeader) == 6);
 
+/// Everything except the sequence number, payload and checksum is fixed per
+/// packet type, so build that at compile time and only patch the rest when sending.
+template<typename PACKET>
+struct CommandFrame
+{
+    static constexpr uint8_t flags = CommandPacketHeader::flagsFor(PACKET::deviceId, PACKET::commandId);
+    static_assert(flags != 0, "Unhandled command");
+
+    // Same as CommandPacketHeader::isSynchronous()
+    static constexpr bool isSynchronous = flags & CommandPacketHeader::Synchronous;
+
+    static constexpr uint8_t dataLength = sizeof(PACKET) + 1; // + 1 for checksum
+    static constexpr size_t size = sizeof(CommandPacketHeader) + sizeof(PACKET) + 1;
+
+    using Buffer = std::array<char, size>;
+    using Payload = std::array<uint8_t, sizeof(PACKET)>;
+
+    // The checksum covers everything after the magic and flags
+    static constexpr uint8_t constantChecksum = uint8_t(PACKET::deviceId + PACKET::commandId + dataLength);
+
+    static constexpr Buffer createTemplate() {
+        Buffer frame{};
+        frame[0] = char(0xFF);
+        frame[1] = char(flags);
+        frame[2] = char(PACKET::deviceId);
+        frame[3] = char(PACKET::commandId);
+        frame[4] = 0; // sequence number
+        frame[5] = char(dataLength);
+        return frame;
+    }
+    static constexpr Buffer frameTemplate = createTemplate();
+
+    static constexpr Buffer encode(const Payload &payload, const uint8_t sequenceNumber) {
+        Buffer frame = frameTemplate;
+        frame[4] = char(sequenceNumber);
+
+        uint8_t checksum = constantChecksum + sequenceNumber;
+        for (size_t i=0; i<payload.size(); i++) {
+            frame[sizeof(CommandPacketHeader) + i] = char(payload[i]);
+            checksum += payload[i];
+        }
+        frame[size - 1] = char(checksum ^ 0xFF);
+
+        return frame;
+    }
+
+    static Buffer encode(const PACKET &packet, const uint8_t sequenceNumber) {
+        Payload payload;
+        memcpy(payload.data(), &packet, sizeof(PACKET));
+        return encode(payload, sequenceNumber);
+    }
+};
+
 struct RotateCommandPacket
 {
     float rate;
@@ -419,9 +428,9 @@ struct DataStreamingCommandPacket_Old
     static QByteArray create(const int packetCount, const uint16_t maxRateDivisor = 400, const uint16_t framesPerPacket = 1, const uint32_t sourceMask = AllSources) {
         DataStreamingCommandPacket_Old def;
         def.packetCount = packetCount;
-        def.maxRateDivisor = maxRateDivisor;
-        def.framesPerPacket = framesPerPacket;
-        def.sourceMask = sourceMask;
+        def.maxRateDivisor = qToBigEndian(maxRateDivisor);
+        def.framesPerPacket = qToBigEndian(framesPerPacket);
+        def.sourceMask = qToBigEndian(sourceMask);
         return packetToByteArray(def);
     }
 };
@@ -456,10 +465,10 @@ struct DataStreamingCommandPacket : DataStreamingCommandPacket_Old
     static QByteArray create(const int packetCount, const uint16_t maxRateDivisor = 10, const uint16_t framesPerPacket = 1, const uint32_t sourceMask = AllSources, const uint32_t sourceMask2 = NoMask) {
         DataStreamingCommandPacket def;
         def.packetCount = packetCount;
-        def.maxRateDivisor = maxRateDivisor;
-        def.framesPerPacket = framesPerPacket;
-        def.sourceMask = sourceMask;
-        def.sourceMaskHighBits = sourceMask2;
+        def.maxRateDivisor = qToBigEndian(maxRateDivisor);
+        def.framesPerPacket = qToBigEndian(framesPerPacket);
+        def.sourceMask = qToBigEndian(sourceMask);
+        def.sourceMaskHighBits = qToBigEndian(sourceMask2);
         return packetToByteArray(def);
     }
 };
@@ -626,5 +635,28 @@ struct SetPowerNotifyCommandPacket
 };
 #pragma pack(pop)
 
+// Make sure the compile time framing gives the same bytes as CommandPacketHeader::encode()
+namespace {
+template<size_t SIZE>
+constexpr bool sameBytes(const std::array<char, SIZE> &actual, const std::array<uint8_t, SIZE> &expected)
+{
+    for (size_t i=0; i<SIZE; i++) {
+        if (uint8_t(actual[i]) != expected[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(sameBytes(CommandFrame<RollCommandPacket>::encode({0x80, 0x00, 0x5A, 0x01}, 0x05),
+    {0xFF, 0xFE, 0x02, 0x30, 0x05, 0x05, 0x80, 0x00, 0x5A, 0x01, 0xE8}));
+static_assert(sameBytes(CommandFrame<SetColorsCommandPacket>::encode({0x00, 0xFF, 0x00, 0x00}, 0x2A),
+    {0xFF, 0xFE, 0x02, 0x20, 0x2A, 0x05, 0x00, 0xFF, 0x00, 0x00, 0xAF}));
+static_assert(sameBytes(CommandFrame<GoToSleepPacket>::encode({0x05, 0x00, 0x00, 0x00, 0x00}, 0xFF),
+    {0xFF, 0xFF, 0x00, 0x22, 0xFF, 0x06, 0x05, 0x00, 0x00, 0x00, 0x00, 0xD3}));
+static_assert(sameBytes(CommandFrame<SetHeadingPacket>::encode({0x00, 0xB4}, 0x01),
+    {0xFF, 0xFE, 0x02, 0x01, 0x01, 0x03, 0x00, 0xB4, 0x44}));
+} // namespace
+
 } // namespace v1
 } // namespace sphero
@@ -0,0 +1,194 @@
+#pragma once
+
+#include "ResponsePackets.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace sphero {
+namespace v1 {
+
+/// Reassembles V1 responses (FF FF ...) and async notifications (FF FE ...)
+/// from the stream of BLE notifications. Extracts every complete frame,
+/// keeps whatever is left over for the next notification and resyncs on the
+/// magic bytes if something is corrupted.
+class FrameReassembler
+{
+public:
+    // Responses are at most 5 + 255 bytes, notifications bigger than this are probably garbage anyways
+    static constexpr int BufferSize = 1024;
+
+    // Responses have a one byte length, notifications a two byte length, both after three bytes
+    static constexpr int HeaderSize = 5;
+
+    /// Only valid inside the callback
+    struct Frame {
+        uint8_t type = 0; // ResponsePacketHeader::Type
+        uint8_t packetType = 0; // response code or notification type
+        uint8_t sequenceNumber = 0; // only for responses
+
+        const char *contents = nullptr;
+        int size = 0; // without checksum
+    };
+
+    struct Stats {
+        uint32_t frames = 0;
+        uint32_t checksumErrors = 0;
+        uint32_t resyncs = 0; // once per run of garbage, however long
+        uint32_t droppedBytes = 0;
+        uint32_t prompts = 0; // "u>" the robot sometimes sends in front of a response, not an error
+        uint32_t overflows = 0;
+    };
+
+    /// Calls onFrame(const Frame &) for every complete frame with a valid checksum
+    template<typename CALLBACK>
+    void feed(const char *data, int size, CALLBACK &&onFrame)
+    {
+        while (size > 0) {
+            const int toCopy = qMin(size, BufferSize - m_length);
+            if (toCopy <= 0) {
+                // Shouldn't happen, process() always leaves room
+                m_stats.overflows++;
+                m_stats.droppedBytes += m_length;
+                m_length = 0;
+                continue;
+            }
+            memcpy(m_buffer + m_length, data, toCopy);
+            m_length += toCopy;
+            data += toCopy;
+            size -= toCopy;
+
+            process(onFrame);
+        }
+    }
+
+    void reset() {
+        m_length = 0;
+        m_resyncing = false;
+    }
+
+    const Stats &stats() const { return m_stats; }
+
+private:
+    int findStart(int position) const {
+        for (; position < m_length; position++) {
+            if (m_buffer[position] == 'u' && (position + 1 == m_length || m_buffer[position + 1] == '>')) {
+                // A prompt, or maybe one split across notifications
+                return position;
+            }
+            if (m_buffer[position] != 0xFF) {
+                continue;
+            }
+            if (position + 1 == m_length) {
+                // Might be the start, need more data
+                return position;
+            }
+            const uint8_t type = m_buffer[position + 1];
+            if (type == ResponsePacketHeader::Response || type == ResponsePacketHeader::Notification) {
+                return position;
+            }
+        }
+        return m_length;
+    }
+
+    void skip(const int bytes) {
+        m_stats.droppedBytes += bytes;
+        if (!m_resyncing) {
+            m_stats.resyncs++;
+            m_resyncing = true;
+        }
+    }
+
+    bool isPrompt(const int position) const {
+        return m_length - position >= 2 && m_buffer[position] == 'u' && m_buffer[position + 1] == '>';
+    }
+
+    template<typename CALLBACK>
+    void process(CALLBACK &onFrame)
+    {
+        int position = 0;
+
+        while (position < m_length) {
+            // I _think_ it is an ack of some sorts, just strip it
+            if (isPrompt(position)) {
+                m_stats.prompts++;
+                position += 2;
+                continue;
+            }
+
+            const int start = findStart(position);
+            if (start != position) {
+                skip(start - position);
+                position = start;
+                continue; // might have stopped at a prompt
+            }
+
+            if (m_length - position < HeaderSize) {
+                break;
+            }
+
+            const uint8_t *frameStart = m_buffer + position;
+            const bool isNotification = frameStart[1] == ResponsePacketHeader::Notification;
+
+            int dataLength = frameStart[4]; // includes checksum
+            if (isNotification) {
+                dataLength |= frameStart[3] << 8;
+            }
+
+            const int frameSize = HeaderSize + dataLength;
+            if (dataLength < 1 || frameSize > BufferSize) {
+                if (frameSize > BufferSize) {
+                    m_stats.overflows++;
+                }
+                // Not a real header, look for the next one
+                skip(1);
+                position++;
+                continue;
+            }
+
+            if (m_length - position < frameSize) {
+                break;
+            }
+
+            uint8_t checksum = 0;
+            for (int i=2; i<frameSize - 1; i++) {
+                checksum += frameStart[i];
+            }
+            checksum ^= 0xFF;
+            if (checksum != frameStart[frameSize - 1]) {
+                m_stats.checksumErrors++;
+                skip(1);
+                position++;
+                continue;
+            }
+
+            Frame frame;
+            frame.type = frameStart[1];
+            frame.packetType = frameStart[2];
+            frame.sequenceNumber = isNotification ? 0 : frameStart[3];
+            frame.contents = reinterpret_cast<const char*>(frameStart + HeaderSize);
+            frame.size = dataLength - 1;
+
+            m_stats.frames++;
+            m_resyncing = false;
+            position += frameSize;
+
+            onFrame(frame);
+        }
+
+        // Keep what's left for next time
+        if (position > 0) {
+            m_length -= position;
+            memmove(m_buffer, m_buffer + position, m_length);
+        }
+    }
+
+    uint8_t m_buffer[BufferSize];
+    int m_length = 0;
+    bool m_resyncing = false; // skipping until the next valid frame
+
+    Stats m_stats;
+};
+
+} // namespace v1
+} // namespace sphero
@@ -0,0 +1,210 @@
+#pragma once
+
+#include "BasicTypes.h"
+
+#include <QtEndian>
+#include <cstdint>
+
+namespace sphero {
+namespace v1 {
+
+/// The two 32 bit source masks from SetDataStreaming, MASK in the upper and
+/// MASK2 in the lower half. The values are sent in this order, highest bit first.
+namespace SensorSource {
+enum : uint64_t {
+    AccelerometerXRaw = 0x80000000ull << 32,
+    AccelerometerYRaw = 0x40000000ull << 32,
+    AccelerometerZRaw = 0x20000000ull << 32,
+    GyroXRaw = 0x10000000ull << 32,
+    GyroYRaw = 0x08000000ull << 32,
+    GyroZRaw = 0x04000000ull << 32,
+    RightMotorBackEmfRaw = 0x00400000ull << 32,
+    LeftMotorBackEmfRaw = 0x00200000ull << 32,
+    LeftMotorPwm = 0x00100000ull << 32,
+    RightMotorPwm = 0x00080000ull << 32,
+    ImuPitch = 0x00040000ull << 32,
+    ImuRoll = 0x00020000ull << 32,
+    ImuYaw = 0x00010000ull << 32,
+    AccelerometerX = 0x00008000ull << 32,
+    AccelerometerY = 0x00004000ull << 32,
+    AccelerometerZ = 0x00002000ull << 32,
+    GyroX = 0x00001000ull << 32,
+    GyroY = 0x00000800ull << 32,
+    GyroZ = 0x00000400ull << 32,
+    RightMotorBackEmf = 0x00000040ull << 32,
+    LeftMotorBackEmf = 0x00000020ull << 32,
+
+    // Firmware >= 1.17
+    Quaternion0 = 0x80000000ull,
+    Quaternion1 = 0x40000000ull,
+    Quaternion2 = 0x20000000ull,
+    Quaternion3 = 0x10000000ull,
+    LocatorX = 0x08000000ull,
+    LocatorY = 0x04000000ull,
+    Acceleration = 0x02000000ull,
+    VelocityX = 0x01000000ull,
+    VelocityY = 0x00800000ull,
+
+    AccelerometerRawAll = AccelerometerXRaw | AccelerometerYRaw | AccelerometerZRaw,
+    GyroRawAll = GyroXRaw | GyroYRaw | GyroZRaw,
+    ImuAll = ImuPitch | ImuRoll | ImuYaw,
+    AccelerometerAll = AccelerometerX | AccelerometerY | AccelerometerZ,
+    GyroAll = GyroX | GyroY | GyroZ,
+    MotorBackEmf = RightMotorBackEmf | LeftMotorBackEmf,
+    QuaternionAll = Quaternion0 | Quaternion1 | Quaternion2 | Quaternion3,
+    LocatorAll = LocatorX | LocatorY,
+    VelocityAll = VelocityX | VelocityY,
+};
+} // namespace SensorSource
+
+struct SensorSample
+{
+    // Same order as they are streamed
+    enum Field : uint8_t {
+        AccelerometerXRaw,
+        AccelerometerYRaw,
+        AccelerometerZRaw,
+        GyroXRaw,
+        GyroYRaw,
+        GyroZRaw,
+        RightMotorBackEmfRaw,
+        LeftMotorBackEmfRaw,
+        LeftMotorPwm,
+        RightMotorPwm,
+        ImuPitch,
+        ImuRoll,
+        ImuYaw,
+        AccelerometerX,
+        AccelerometerY,
+        AccelerometerZ,
+        GyroX,
+        GyroY,
+        GyroZ,
+        RightMotorBackEmf,
+        LeftMotorBackEmf,
+        Quaternion0,
+        Quaternion1,
+        Quaternion2,
+        Quaternion3,
+        LocatorX,
+        LocatorY,
+        Acceleration,
+        VelocityX,
+        VelocityY,
+
+        FieldCount
+    };
+
+    static constexpr uint64_t sourceBits[FieldCount] = {
+        SensorSource::AccelerometerXRaw,
+        SensorSource::AccelerometerYRaw,
+        SensorSource::AccelerometerZRaw,
+        SensorSource::GyroXRaw,
+        SensorSource::GyroYRaw,
+        SensorSource::GyroZRaw,
+        SensorSource::RightMotorBackEmfRaw,
+        SensorSource::LeftMotorBackEmfRaw,
+        SensorSource::LeftMotorPwm,
+        SensorSource::RightMotorPwm,
+        SensorSource::ImuPitch,
+        SensorSource::ImuRoll,
+        SensorSource::ImuYaw,
+        SensorSource::AccelerometerX,
+        SensorSource::AccelerometerY,
+        SensorSource::AccelerometerZ,
+        SensorSource::GyroX,
+        SensorSource::GyroY,
+        SensorSource::GyroZ,
+        SensorSource::RightMotorBackEmf,
+        SensorSource::LeftMotorBackEmf,
+        SensorSource::Quaternion0,
+        SensorSource::Quaternion1,
+        SensorSource::Quaternion2,
+        SensorSource::Quaternion3,
+        SensorSource::LocatorX,
+        SensorSource::LocatorY,
+        SensorSource::Acceleration,
+        SensorSource::VelocityX,
+        SensorSource::VelocityY,
+    };
+
+    static const char *fieldName(const Field field) {
+        static const char *names[FieldCount] = {
+            "accelerometerXRaw", "accelerometerYRaw", "accelerometerZRaw",
+            "gyroXRaw", "gyroYRaw", "gyroZRaw",
+            "rightMotorBackEmfRaw", "leftMotorBackEmfRaw",
+            "leftMotorPwm", "rightMotorPwm",
+            "imuPitch", "imuRoll", "imuYaw",
+            "accelerometerX", "accelerometerY", "accelerometerZ",
+            "gyroX", "gyroY", "gyroZ",
+            "rightMotorBackEmf", "leftMotorBackEmf",
+            "quaternion0", "quaternion1", "quaternion2", "quaternion3",
+            "locatorX", "locatorY",
+            "acceleration",
+            "velocityX", "velocityY",
+        };
+        return field < FieldCount ? names[field] : "";
+    }
+
+    bool has(const Field field) const { return sources & sourceBits[field]; }
+
+    Vector3D<int16_t> accelerometerRaw() const { return {values[AccelerometerXRaw], values[AccelerometerYRaw], values[AccelerometerZRaw]}; } // -2048 to 2047
+    Vector3D<int16_t> gyroRaw() const { return {values[GyroXRaw], values[GyroYRaw], values[GyroZRaw]}; } // -32768 to 32767, 0.068 degrees
+    Orientation<int16_t> imu() const { return {values[ImuPitch], values[ImuRoll], values[ImuYaw]}; } // -179 to 180 degrees
+    Vector3D<int16_t> accelerometer() const { return {values[AccelerometerX], values[AccelerometerY], values[AccelerometerZ]}; } // 1/4096 G
+    Vector3D<int16_t> gyro() const { return {values[GyroX], values[GyroY], values[GyroZ]}; } // 0.1 dps
+    Quaternion<int16_t> quaternion() const { return {values[Quaternion0], values[Quaternion1], values[Quaternion2], values[Quaternion3]}; } // 1/10000 Q
+    Vector2D<int16_t> locator() const { return {values[LocatorX], values[LocatorY]}; } // cm
+    Vector2D<int16_t> velocity() const { return {values[VelocityX], values[VelocityY]}; } // mm/s
+
+    int64_t timestamp = 0; // nanoseconds, monotonic
+    uint64_t sources = 0; // which values are valid
+    int16_t values[FieldCount] = {};
+};
+
+inline int sensorStreamFrameSize(const uint64_t sources)
+{
+    int count = 0;
+    for (int i=0; i<SensorSample::FieldCount; i++) {
+        if (sources & SensorSample::sourceBits[i]) {
+            count++;
+        }
+    }
+    return count * int(sizeof(int16_t));
+}
+
+/// A SensorStream notification contains one or more frames, each one a big
+/// endian int16 for every enabled source. Calls onSample(const SensorSample &) for
+/// each frame, returns the number of frames decoded.
+template<typename CALLBACK>
+int decodeSensorStream(const uint64_t sources, const char *data, int size, const int64_t timestamp, CALLBACK &&onSample)
+{
+    const int frameSize = sensorStreamFrameSize(sources);
+    if (frameSize == 0) {
+        return 0;
+    }
+
+    int frames = 0;
+    SensorSample sample;
+    sample.timestamp = timestamp;
+    sample.sources = sources;
+
+    while (size >= frameSize) {
+        for (int i=0; i<SensorSample::FieldCount; i++) {
+            if (!(sources & SensorSample::sourceBits[i])) {
+                continue;
+            }
+            sample.values[i] = qFromBigEndian<int16_t>(data);
+            data += sizeof(int16_t);
+        }
+        size -= frameSize;
+
+        onSample(sample);
+        frames++;
+    }
+
+    return frames;
+}
+
+} // namespace v1
+} // namespace sphero
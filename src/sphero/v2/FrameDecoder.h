@@ -0,0 +1,173 @@
+#pragma once
+
+#include "Packets.h"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+namespace sphero {
+namespace v2 {
+
+/// Incremental decoder for the V2 framing (0x8D ... 0xD8, with 0xAB escapes).
+/// Unescapes and checksums each byte as it arrives, into a fixed buffer, so
+/// frames split across notifications or several frames in one notification
+/// don't need any shuffling or allocations.
+class FrameDecoder
+{
+public:
+    // The biggest packets we know of are well below this, anything larger is garbage
+    static constexpr int MaxFrameSize = 256;
+
+    /// Only valid until the next call to feed()
+    struct Frame {
+        const uint8_t *data = nullptr;
+        int size = 0; // without checksum
+
+        template<typename PACKET>
+        bool read(PACKET *packet) const {
+            if (size_t(size) < sizeof(PACKET)) {
+                return false;
+            }
+            memcpy(reinterpret_cast<void*>(packet), data, sizeof(PACKET));
+            return true;
+        }
+    };
+
+    struct Stats {
+        uint32_t frames = 0;
+        uint32_t checksumErrors = 0;
+        uint32_t escapeErrors = 0;
+        uint32_t overflows = 0;
+        uint32_t discardedBytes = 0;
+    };
+
+    /// Calls onFrame(const Frame &) for every complete frame with a valid checksum
+    template<typename CALLBACK>
+    void feed(const char *data, const int size, CALLBACK &&onFrame)
+    {
+        for (int i=0; i<size; i++) {
+            const char c = data[i];
+
+            switch(m_state) {
+            case WaitingForStart:
+                if (c == StartOfPacket) {
+                    startFrame();
+                } else {
+                    m_stats.discardedBytes++;
+                }
+                break;
+
+            case InFrame:
+                switch(c) {
+                case StartOfPacket:
+                    // Lost the end of the previous one
+                    m_stats.discardedBytes += m_length;
+                    startFrame();
+                    break;
+                case EndOfPacket:
+                    finishFrame(onFrame);
+                    break;
+                case Escape:
+                    m_state = Escaped;
+                    break;
+                default:
+                    append(c);
+                    break;
+                }
+                break;
+
+            case Escaped:
+                switch(c) {
+                case EscapedEscape:
+                    m_state = InFrame;
+                    append(Escape);
+                    break;
+                case EscapedStartOfPacket:
+                    m_state = InFrame;
+                    append(StartOfPacket);
+                    break;
+                case EscapedEndOfPacket:
+                    m_state = InFrame;
+                    append(EndOfPacket);
+                    break;
+                default:
+                    m_stats.escapeErrors++;
+                    m_stats.discardedBytes += m_length;
+                    m_state = (c == StartOfPacket) ? InFrame : WaitingForStart;
+                    m_length = 0;
+                    m_checksum = 0;
+                    break;
+                }
+                break;
+            }
+        }
+    }
+
+    void reset() {
+        m_state = WaitingForStart;
+        m_length = 0;
+        m_checksum = 0;
+    }
+
+    const Stats &stats() const { return m_stats; }
+
+private:
+    enum State {
+        WaitingForStart,
+        InFrame,
+        Escaped
+    };
+
+    void startFrame() {
+        m_state = InFrame;
+        m_length = 0;
+        m_checksum = 0;
+    }
+
+    void append(const char c) {
+        if (m_length >= MaxFrameSize) {
+            m_stats.overflows++;
+            m_stats.discardedBytes += m_length;
+            reset();
+            return;
+        }
+        m_buffer[m_length++] = uint8_t(c);
+        m_checksum += uint8_t(c);
+    }
+
+    template<typename CALLBACK>
+    void finishFrame(CALLBACK &onFrame) {
+        m_state = WaitingForStart;
+
+        if (m_length < 1) {
+            return;
+        }
+
+        // Running sum includes the checksum byte itself, so take it out again
+        const uint8_t received = m_buffer[m_length - 1];
+        const uint8_t expected = uint8_t(m_checksum - received) ^ 0xFF;
+        if (received != expected) {
+            m_stats.checksumErrors++;
+            m_stats.discardedBytes += m_length;
+            return;
+        }
+
+        m_stats.frames++;
+
+        Frame frame;
+        frame.data = m_buffer.data();
+        frame.size = m_length - 1;
+        onFrame(frame);
+    }
+
+    std::array<uint8_t, MaxFrameSize> m_buffer{};
+    int m_length = 0;
+    uint8_t m_checksum = 0;
+    State m_state = WaitingForStart;
+
+    Stats m_stats;
+};
+
+} // namespace v2
+} // namespace sphero
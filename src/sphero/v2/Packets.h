@@ -7,6 +7,7 @@
 #include <QDebug>
 #include <QObject>
 #include <QtEndian>
+#include <array>
 #include <cstdint>
 
 // TODO: the audio upload stuff, don't know the command IDs
@@ -21,102 +22,67 @@ static constexpr char EscapedStartOfPacket = 0x03;
 static constexpr char EndOfPacket = 0xD8;
 static constexpr char EscapedEndOfPacket = 0x50;
 
+/// Worst case is every byte (including the checksum) needing to be escaped
 template <typename PACKET>
-QByteArray encode(const PACKET &packet)
+constexpr int maxEncodedSize()
 {
-    QByteArray raw(reinterpret_cast<const char*>(&packet), sizeof(PACKET));
-    uint8_t checksum = 0;
-    for (const char c : raw) {
-        checksum += c;
-    }
-    raw.append(checksum xor 0xFF);
-
-    QByteArray encoded(1, StartOfPacket);
-    for (const char c : raw) {
-        switch(c) {
-        case Escape:
-            encoded.append(Escape);
-            encoded.append(EscapedEscape);
-            break;
-        case StartOfPacket:
-            encoded.append(Escape);
-            encoded.append(EscapedStartOfPacket);
-            break;
-        case EndOfPacket:
-            encoded.append(Escape);
-            encoded.append(EscapedEndOfPacket);
-            break;
-        default:
-            encoded.append(c);
-            break;
-        }
-    }
-
-
-
-    encoded.append(EndOfPacket);
-
-    qDebug() << " + Packet:";
-    qDebug() << "  ] Flags:" << packet.m_flags;
-    qDebug() << "  ] Device ID:" << packet.m_deviceID;
-    qDebug() << "  ] Command ID:" << packet.m_commandID;
-//    qDebug() << "  ] Sequence number:" << packet.m_sequenceNumber;
-//    qDebug() << "  ] Source:" << packet.sourceID;
-//    qDebug() << "  ] Target:" << packet.targetID;
-//    qDebug() << "  ] Error code:" << packet.errorCode;
-
-    return encoded;
+    return 1 + 2 * (int(sizeof(PACKET)) + 1) + 1;
 }
-template <typename PACKET>
-PACKET decode(const QByteArray &input, bool *ok)
+
+inline char *appendEscaped(char *out, const char c)
 {
-    if (!input.startsWith(StartOfPacket) || !input.endsWith(EndOfPacket)) {
-        qWarning() << "invalid start or end";
-        *ok = false;
-        return {};
+    switch(c) {
+    case Escape:
+        *out++ = Escape;
+        *out++ = EscapedEscape;
+        break;
+    case StartOfPacket:
+        *out++ = Escape;
+        *out++ = EscapedStartOfPacket;
+        break;
+    case EndOfPacket:
+        *out++ = Escape;
+        *out++ = EscapedEndOfPacket;
+        break;
+    default:
+        *out++ = c;
+        break;
     }
+    return out;
+}
 
-    QByteArray decoded;
-    for (int i=1; i<input.size()-1; i++){
-        const char c = input[i];
-        if (c != Escape) {
-            decoded.append(c);
-            continue;
-        }
-        i++;
-        switch(input[i]) {
-        case EscapedEscape:
-            decoded.append(Escape);
-            break;
-        case EscapedStartOfPacket:
-            decoded.append(StartOfPacket);
-            break;
-        case EscapedEndOfPacket:
-            decoded.append(EndOfPacket);
-            break;
-        default:
-            *ok = false;
-            qWarning() << "Invalid escape sequence" << c << input[i];
-            qDebug() << input.toHex(':');
-            return {};
-        }
-    }
-    qDebug() << "decoded" << decoded.toHex(':');
+/// Checksums and escapes in one pass, buffer needs room for 2 * (size + 1) + 2 bytes.
+/// Returns the number of bytes written.
+inline int encode(const char *raw, const int size, char *buffer)
+{
+    char *out = buffer;
+    *out++ = StartOfPacket;
 
     uint8_t checksum = 0;
-    for (int i=0; i<decoded.size() - 1; i++) {
-        checksum += decoded[i];
+    for (int i=0; i<size; i++) {
+        checksum += uint8_t(raw[i]);
+        out = appendEscaped(out, raw[i]);
     }
+    out = appendEscaped(out, char(checksum ^ 0xFF));
 
-    if (!decoded.endsWith(checksum xor 0xff)) {
-        qWarning() <<  "invalid checksum" << decoded.back() << "expected" << checksum;
-        *ok = false;
-        return {};
-    }
+    *out++ = EndOfPacket;
 
-    decoded.chop(1); // remove the checksum at the end
+    return int(out - buffer);
+}
 
-    return byteArrayToPacket<PACKET>(decoded, ok);
+/// Buffer needs room for maxEncodedSize<PACKET>() bytes
+template <typename PACKET>
+int encode(const PACKET &packet, char *buffer)
+{
+    return encode(reinterpret_cast<const char*>(&packet), int(sizeof(PACKET)), buffer);
+}
+
+template <typename PACKET>
+QByteArray encode(const PACKET &packet)
+{
+    std::array<char, maxEncodedSize<PACKET>()> buffer;
+    const int size = encode(packet, buffer.data());
+    return QByteArray(buffer.data(), size);
 }
 
 #pragma pack(push,1)
@@ -619,6 +585,34 @@ struct SetLEDIntensity : public SetLED {
     {}
 };
 
+/// Interval is in milliseconds, count 0 means stream until told to stop
+struct SetSensorAppMaskPacket : public Packet {
+    static constexpr uint8_t id = Sensors::SetSensorAppMask;
+
+    SetSensorAppMaskPacket(const uint16_t interval, const uint8_t count, const uint32_t mask) :
+        Packet(Packet::Sensors, id),
+        m_interval(qToBigEndian(interval)),
+        m_count(count),
+        m_mask(qToBigEndian(mask))
+    {}
+
+    uint16_t m_interval;
+    uint8_t m_count;
+    uint32_t m_mask;
+};
+
+/// Uses the interval and count from SetSensorAppMask
+struct SetSensorAppMaskExtendedPacket : public Packet {
+    static constexpr uint8_t id = Sensors::SetSensorAppMaskExtended;
+
+    SetSensorAppMaskExtendedPacket(const uint32_t mask) :
+        Packet(Packet::Sensors, id),
+        m_mask(qToBigEndian(mask))
+    {}
+
+    uint32_t m_mask;
+};
+
 #pragma pack(pop)
 
 } // namespace v2
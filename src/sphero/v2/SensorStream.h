@@ -0,0 +1,166 @@
+#pragma once
+
+#include "BasicTypes.h"
+#include "Constants.h"
+
+#include <QtEndian>
+#include <cstdint>
+
+namespace sphero {
+namespace v2 {
+
+/// SetSensorAppMask in the lower and SetSensorAppMaskExtended in the upper
+/// 32 bits. Only the groups we know the layout of are here, the rest
+/// (gestures, BasicIMU, RollYaw) are unknown and filtered out.
+namespace SensorSource {
+enum : uint64_t {
+    Quaternion = uint64_t(SensorAppMask::OrientQuat),
+    Attitude = uint64_t(SensorAppMask::Att),
+    Accelerometer = uint64_t(SensorAppMask::Accel),
+    Gyro = uint64_t(SensorAppMask::Gyro),
+    Acceleration = uint64_t(SensorAppMask::AccelMag),
+    Speed = uint64_t(SensorAppMask::RollSpeed),
+    Locator = uint64_t(SensorAppMask::Loc),
+    Velocity = uint64_t(SensorAppMask::Vel),
+
+    NormalizedSpeed = uint64_t(SensorAppExtendedMask::NormalizedSpeed) << 32,
+    R2D2HeadAngle = uint64_t(SensorAppExtendedMask::NormalizedR2D2HeadAngle) << 32,
+
+    Supported = Quaternion | Attitude | Accelerometer | Gyro | Acceleration | Speed | Locator | Velocity |
+        NormalizedSpeed | R2D2HeadAngle,
+};
+
+inline uint32_t appMask(const uint64_t sources) { return uint32_t(sources & 0xFFFFFFFF); }
+inline uint32_t extendedMask(const uint64_t sources) { return uint32_t(sources >> 32); }
+} // namespace SensorSource
+
+struct SensorSample
+{
+    // Same order as they are streamed, lowest bit first and the extended mask last
+    enum Field : uint8_t {
+        QuaternionX,
+        QuaternionY,
+        QuaternionZ,
+        QuaternionW,
+        Pitch,
+        Roll,
+        Yaw,
+        AccelerometerX,
+        AccelerometerY,
+        AccelerometerZ,
+        GyroX,
+        GyroY,
+        GyroZ,
+        Acceleration,
+        Speed,
+        LocatorX,
+        LocatorY,
+        VelocityX,
+        VelocityY,
+        NormalizedSpeed,
+        R2D2HeadAngle,
+
+        FieldCount
+    };
+
+    static constexpr uint64_t sourceBits[FieldCount] = {
+        SensorSource::Quaternion,
+        SensorSource::Quaternion,
+        SensorSource::Quaternion,
+        SensorSource::Quaternion,
+        SensorSource::Attitude,
+        SensorSource::Attitude,
+        SensorSource::Attitude,
+        SensorSource::Accelerometer,
+        SensorSource::Accelerometer,
+        SensorSource::Accelerometer,
+        SensorSource::Gyro,
+        SensorSource::Gyro,
+        SensorSource::Gyro,
+        SensorSource::Acceleration,
+        SensorSource::Speed,
+        SensorSource::Locator,
+        SensorSource::Locator,
+        SensorSource::Velocity,
+        SensorSource::Velocity,
+        SensorSource::NormalizedSpeed,
+        SensorSource::R2D2HeadAngle,
+    };
+
+    static const char *fieldName(const Field field) {
+        static const char *names[FieldCount] = {
+            "quaternionX", "quaternionY", "quaternionZ", "quaternionW",
+            "pitch", "roll", "yaw",
+            "accelerometerX", "accelerometerY", "accelerometerZ",
+            "gyroX", "gyroY", "gyroZ",
+            "acceleration",
+            "speed",
+            "locatorX", "locatorY",
+            "velocityX", "velocityY",
+            "normalizedSpeed",
+            "r2d2HeadAngle",
+        };
+        return field < FieldCount ? names[field] : "";
+    }
+
+    bool has(const Field field) const { return sources & sourceBits[field]; }
+
+    Quaternion<float> quaternion() const { return {values[QuaternionX], values[QuaternionY], values[QuaternionZ], values[QuaternionW]}; }
+    Orientation<float> attitude() const { return {values[Pitch], values[Roll], values[Yaw]}; } // degrees
+    Vector3D<float> accelerometer() const { return {values[AccelerometerX], values[AccelerometerY], values[AccelerometerZ]}; } // G
+    Vector3D<float> gyro() const { return {values[GyroX], values[GyroY], values[GyroZ]}; } // degrees per second
+    Vector2D<float> locator() const { return {values[LocatorX], values[LocatorY]}; } // cm
+    Vector2D<float> velocity() const { return {values[VelocityX], values[VelocityY]}; } // cm/s
+
+    int64_t timestamp = 0; // nanoseconds, monotonic
+    uint64_t sources = 0; // which values are valid
+    float values[FieldCount] = {};
+};
+
+inline int sensorStreamFrameSize(const uint64_t sources)
+{
+    int count = 0;
+    for (int i=0; i<SensorSample::FieldCount; i++) {
+        if (sources & SensorSample::sourceBits[i]) {
+            count++;
+        }
+    }
+    return count * int(sizeof(float));
+}
+
+/// The Sensors::Sensor notification has a big endian float for every enabled
+/// value, already scaled by the robot. Normally one sample per notification,
+/// but handles several. Calls onSample(const SensorSample &) for each one and
+/// returns the number of samples decoded, 0 if the size doesn't match the sources.
+template<typename CALLBACK>
+int decodeSensorStream(const uint64_t sources, const uint8_t *data, int size, const int64_t timestamp, CALLBACK &&onSample)
+{
+    const int frameSize = sensorStreamFrameSize(sources);
+    if (frameSize == 0 || size % frameSize != 0) {
+        return 0;
+    }
+
+    int frames = 0;
+    SensorSample sample;
+    sample.timestamp = timestamp;
+    sample.sources = sources;
+
+    while (size >= frameSize) {
+        for (int i=0; i<SensorSample::FieldCount; i++) {
+            if (!(sources & SensorSample::sourceBits[i])) {
+                continue;
+            }
+            sample.values[i] = qFromBigEndian<float>(data);
+            data += sizeof(float);
+        }
+        size -= frameSize;
+
+        onSample(sample);
+        frames++;
+    }
+
+    return frames;
+}
+
+} // namespace v2
+} // namespace sphero
@@ -0,0 +1,373 @@
+#include "SimulatedRobot.h"
+#include "sphero/SpheroHandler.h"
+#include "sphero/v1/CommandPackets.h"
+#include "sphero/v2/Packets.h"
+#include "mousr/MousrHandler.h"
+
+#include <QtTest>
+#include <QStandardPaths>
+#include <QtEndian>
+
+#include <vector>
+
+using sphero::SpheroHandler;
+using sphero::RequestTracker;
+namespace v1 = sphero::v1;
+namespace v2 = sphero::v2;
+
+/// Runs the handlers against a SimulatedRobot, so everything between the
+/// public API and the bytes on the wire is covered without Bluetooth.
+class HandlerTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void pingRoundTrip_data();
+    void pingRoundTrip();
+    void powerStateV1();
+    void batteryVoltageV2();
+
+    void sensorStreamV1();
+    void sensorStreamV2();
+
+    void requestRetry_data();
+    void requestRetry();
+    void requestTimeout_data();
+    void requestTimeout();
+
+    void driveIdleSwitching_data();
+    void driveIdleSwitching();
+
+    void mousrInitAndDrive();
+
+private:
+    static void addProtocols();
+};
+
+namespace {
+
+// Everything initializeRobot() sent is answered, and the one V1 motor sample it asks for is in
+bool isInitialized(const SpheroHandler &handler, const SimulatedRobot *robot)
+{
+    const RequestTracker::Stats &requests = handler.requestStats();
+    if (!requests.sent || requests.inFlight || requests.queued || handler.transmitStats().inFlight) {
+        return false;
+    }
+    return robot->protocol() != SimulatedRobot::SpheroV1 || robot->stats().sensorSamples > 0;
+}
+
+// The contents are only valid inside the callback
+RequestTracker::Callback storeResponse(RequestTracker::Response *response, int *calls)
+{
+    return [response, calls](const RequestTracker::Response &received) {
+        *response = received;
+        response->contents = QByteArray(received.contents.constData(), received.contents.size());
+        (*calls)++;
+    };
+}
+
+void ping(SpheroHandler &handler, const SimulatedRobot::Protocol protocol, RequestTracker::Callback callback)
+{
+    if (protocol == SimulatedRobot::SpheroV1) {
+        handler.sendCommandV1(v1::CommandPacketHeader::Internal, v1::CommandPacketHeader::Ping, {}, std::move(callback));
+    } else {
+        handler.sendCommandV2(v2::PingPacket(), std::move(callback));
+    }
+}
+
+template<typename SAMPLE>
+size_t readSamples(SpheroHandler &handler, std::vector<SAMPLE> *samples)
+{
+    SAMPLE buffer[16];
+    size_t count;
+    while ((count = handler.readSensorSamples(buffer, 16)) > 0) {
+        samples->insert(samples->end(), buffer, buffer + count);
+    }
+    return samples->size();
+}
+
+} // namespace
+
+void HandlerTest::initTestCase()
+{
+    // MousrHandler reads its settings
+    QStandardPaths::setTestModeEnabled(true);
+}
+
+void HandlerTest::addProtocols()
+{
+    QTest::addColumn<SimulatedRobot::Protocol>("protocol");
+    QTest::newRow("v1") << SimulatedRobot::SpheroV1;
+    QTest::newRow("v2") << SimulatedRobot::SpheroV2;
+}
+
+void HandlerTest::pingRoundTrip_data()
+{
+    addProtocols();
+}
+
+void HandlerTest::pingRoundTrip()
+{
+    QFETCH(SimulatedRobot::Protocol, protocol);
+
+    SimulatedRobot *robot = new SimulatedRobot(protocol);
+    robot->setLatency(10);
+    SpheroHandler handler(robot, robot->name(), nullptr);
+    QTRY_VERIFY(isInitialized(handler, robot));
+
+    const uint32_t completed = handler.requestStats().completed;
+
+    RequestTracker::Response response;
+    int calls = 0;
+    ping(handler, protocol, storeResponse(&response, &calls));
+
+    QTRY_COMPARE(calls, 1);
+    QCOMPARE(response.status, RequestTracker::Status::Success);
+    QVERIFY(response.roundTrip >= 9 * 1000000ll); // the latency is in whole ms
+    QCOMPARE(handler.requestStats().completed, completed + 1);
+    QCOMPARE(handler.requestStats().retries, 0u);
+}
+
+void HandlerTest::powerStateV1()
+{
+    SimulatedRobot *robot = new SimulatedRobot(SimulatedRobot::SpheroV1);
+    SpheroHandler handler(robot, robot->name(), nullptr);
+    QTRY_VERIFY(isInitialized(handler, robot));
+    QCOMPARE(handler.powerState(), SpheroHandler::UnknownPowerState);
+
+    // Asked for
+    RequestTracker::Response response;
+    int calls = 0;
+    handler.sendCommandV1(v1::CommandPacketHeader::Internal, v1::CommandPacketHeader::GetPwrState, {}, storeResponse(&response, &calls));
+    QTRY_COMPARE(calls, 1);
+    QCOMPARE(response.status, RequestTracker::Status::Success);
+    QCOMPARE(response.contents.size(), 8);
+    QCOMPARE(uint8_t(response.contents[1]), uint8_t(SpheroHandler::BatteryOK));
+    QCOMPARE(qFromBigEndian<uint16_t>(response.contents.constData() + 2), uint16_t(780));
+
+    // Notified
+    QSignalSpy powerSpy(&handler, &SpheroHandler::powerChanged);
+    handler.enablePowerNotifications();
+    QTRY_COMPARE(powerSpy.count(), 1);
+    QCOMPARE(handler.powerState(), SpheroHandler::BatteryOK);
+
+    robot->setBatteryVoltage(6.5f);
+    handler.enablePowerNotifications();
+    QTRY_COMPARE(powerSpy.count(), 2);
+    QCOMPARE(handler.powerState(), SpheroHandler::BatteryLow);
+}
+
+void HandlerTest::batteryVoltageV2()
+{
+    SimulatedRobot *robot = new SimulatedRobot(SimulatedRobot::SpheroV2);
+    robot->setBatteryVoltage(3.7f);
+    SpheroHandler handler(robot, robot->name(), nullptr);
+    QTRY_VERIFY(isInitialized(handler, robot));
+
+    RequestTracker::Response response;
+    int calls = 0;
+    handler.sendCommandV2(v2::RequestBatteryVoltagePacket(), storeResponse(&response, &calls));
+    QTRY_COMPARE(calls, 1);
+    QCOMPARE(response.status, RequestTracker::Status::Success);
+    QCOMPARE(response.deviceId, uint8_t(v2::Packet::MainSystem));
+    QCOMPARE(response.commandId, uint8_t(v2::RequestBatteryVoltagePacket::id));
+    QCOMPARE(response.contents.size(), 2);
+    QCOMPARE(qFromBigEndian<uint16_t>(response.contents.constData()), uint16_t(370));
+}
+
+void HandlerTest::sensorStreamV1()
+{
+    SimulatedRobot *robot = new SimulatedRobot(SimulatedRobot::SpheroV1);
+    SpheroHandler handler(robot, robot->name(), nullptr);
+    QTRY_VERIFY(isInitialized(handler, robot));
+
+    // The motor sample from initializeRobot()
+    std::vector<v1::SensorSample> samples;
+    QTRY_COMPARE(readSamples(handler, &samples), size_t(1));
+    QVERIFY(samples[0].has(v1::SensorSample::LeftMotorBackEmf));
+    samples.clear();
+
+    // Both masks, and the frames split across notifications
+    const uint32_t sent = robot->stats().sensorSamples;
+    handler.setSensorStreaming(v1::SensorSource::AccelerometerZ | v1::SensorSource::ImuAll | v1::SensorSource::LocatorAll, 50, 10);
+    QTRY_COMPARE(readSamples(handler, &samples), size_t(10));
+
+    int64_t lastTimestamp = 0;
+    for (const v1::SensorSample &sample : samples) {
+        QVERIFY(sample.has(v1::SensorSample::AccelerometerZ));
+        QVERIFY(sample.has(v1::SensorSample::ImuYaw));
+        QVERIFY(sample.has(v1::SensorSample::LocatorY));
+        QVERIFY(!sample.has(v1::SensorSample::AccelerometerX));
+        QVERIFY(!sample.has(v1::SensorSample::LeftMotorBackEmf));
+        QCOMPARE(sample.values[v1::SensorSample::AccelerometerZ], int16_t(4096));
+        QCOMPARE(sample.values[v1::SensorSample::ImuYaw], int16_t(0));
+        QCOMPARE(sample.values[v1::SensorSample::LocatorX], int16_t(0));
+        QVERIFY(sample.timestamp >= lastTimestamp);
+        lastTimestamp = sample.timestamp;
+    }
+
+    // It asked for ten
+    QTest::qWait(100);
+    QCOMPARE(robot->stats().sensorSamples, sent + 10);
+    QCOMPARE(readSamples(handler, &samples), size_t(10));
+}
+
+void HandlerTest::sensorStreamV2()
+{
+    SimulatedRobot *robot = new SimulatedRobot(SimulatedRobot::SpheroV2);
+    SpheroHandler handler(robot, robot->name(), nullptr);
+    QTRY_VERIFY(isInitialized(handler, robot));
+
+    QSignalSpy availableSpy(&handler, &SpheroHandler::sensorSamplesAvailable);
+
+    // Normalized speed is in the extended mask
+    const uint32_t sent = robot->stats().sensorSamples;
+    handler.setSensorStreaming(v2::SensorSource::Quaternion | v2::SensorSource::Locator | v2::SensorSource::NormalizedSpeed, 50, 10);
+
+    std::vector<v2::SensorSample> samples;
+    QTRY_COMPARE(readSamples(handler, &samples), size_t(10));
+    QVERIFY(availableSpy.count() > 0);
+
+    for (const v2::SensorSample &sample : samples) {
+        QVERIFY(sample.has(v2::SensorSample::QuaternionW));
+        QVERIFY(sample.has(v2::SensorSample::LocatorY));
+        QVERIFY(sample.has(v2::SensorSample::NormalizedSpeed));
+        QVERIFY(!sample.has(v2::SensorSample::Pitch));
+        QCOMPARE(sample.values[v2::SensorSample::QuaternionW], 1.f);
+        QCOMPARE(sample.values[v2::SensorSample::QuaternionZ], 0.f);
+        QCOMPARE(sample.values[v2::SensorSample::LocatorX], 0.f);
+        QCOMPARE(sample.values[v2::SensorSample::NormalizedSpeed], 0.f);
+    }
+
+    QTest::qWait(100);
+    QCOMPARE(robot->stats().sensorSamples, sent + 10);
+    QCOMPARE(handler.linkStats().invalidFrames, 0u);
+}
+
+void HandlerTest::requestRetry_data()
+{
+    addProtocols();
+}
+
+void HandlerTest::requestRetry()
+{
+    QFETCH(SimulatedRobot::Protocol, protocol);
+
+    SimulatedRobot *robot = new SimulatedRobot(protocol);
+    SpheroHandler handler(robot, robot->name(), nullptr);
+    handler.setRequestTimeout(100, 1);
+    QTRY_VERIFY(isInitialized(handler, robot));
+
+    const RequestTracker::Stats before = handler.requestStats();
+
+    // The first one is lost, the resent one is answered
+    robot->dropResponses(1);
+    RequestTracker::Response response;
+    int calls = 0;
+    ping(handler, protocol, storeResponse(&response, &calls));
+
+    QTRY_COMPARE(calls, 1);
+    QCOMPARE(response.status, RequestTracker::Status::Success);
+    QCOMPARE(robot->stats().droppedResponses, 1u);
+    QCOMPARE(handler.requestStats().retries, before.retries + 1);
+    QCOMPARE(handler.requestStats().timeouts, before.timeouts);
+    QCOMPARE(handler.requestStats().inFlight, 0);
+}
+
+void HandlerTest::requestTimeout_data()
+{
+    addProtocols();
+}
+
+void HandlerTest::requestTimeout()
+{
+    QFETCH(SimulatedRobot::Protocol, protocol);
+
+    SimulatedRobot *robot = new SimulatedRobot(protocol);
+    SpheroHandler handler(robot, robot->name(), nullptr);
+    handler.setRequestTimeout(100, 1);
+    QTRY_VERIFY(isInitialized(handler, robot));
+
+    const RequestTracker::Stats before = handler.requestStats();
+
+    // Neither the first nor the resent one is answered
+    robot->dropResponses(2);
+    RequestTracker::Response response;
+    int calls = 0;
+    ping(handler, protocol, storeResponse(&response, &calls));
+
+    QTRY_COMPARE(calls, 1);
+    QCOMPARE(response.status, RequestTracker::Status::TimedOut);
+    QVERIFY(response.roundTrip >= 100 * 1000000ll); // since it was resent
+    QCOMPARE(robot->stats().droppedResponses, 2u);
+    QCOMPARE(handler.requestStats().retries, before.retries + 1);
+    QCOMPARE(handler.requestStats().timeouts, before.timeouts + 1);
+    QCOMPARE(handler.requestStats().inFlight, 0);
+
+    // And it still works afterwards
+    ping(handler, protocol, storeResponse(&response, &calls));
+    QTRY_COMPARE(calls, 2);
+    QCOMPARE(response.status, RequestTracker::Status::Success);
+}
+
+void HandlerTest::driveIdleSwitching_data()
+{
+    addProtocols();
+}
+
+void HandlerTest::driveIdleSwitching()
+{
+    QFETCH(SimulatedRobot::Protocol, protocol);
+
+    const QLowEnergyConnectionParameters drive = LinkProfiles::parameters(LinkProfiles::Drive);
+    const QLowEnergyConnectionParameters idle = LinkProfiles::parameters(LinkProfiles::Idle);
+
+    SimulatedRobot *robot = new SimulatedRobot(protocol);
+    robot->setMinConnectionInterval(10.);
+    SpheroHandler handler(robot, robot->name(), nullptr);
+
+    // Long enough that polling doesn't miss the drive profile
+    handler.setLinkIdleTimeout(500);
+    QTRY_VERIFY(isInitialized(handler, robot));
+
+    // Nobody touches the controls
+    QTRY_COMPARE(robot->connectionParameters().latency(), idle.latency());
+    QCOMPARE(robot->connectionParameters().maximumInterval(), idle.minimumInterval());
+    QTRY_COMPARE(handler.linkStats().linkProfile, QStringLiteral("idle"));
+
+    // The robot takes the shortest it supports
+    handler.setSpeed(50);
+    QTRY_COMPARE(robot->connectionParameters().latency(), drive.latency());
+    QCOMPARE(robot->connectionParameters().maximumInterval(), 10.);
+    QCOMPARE(robot->connectionParameters().supervisionTimeout(), drive.supervisionTimeout());
+    QTRY_COMPARE(handler.linkStats().linkProfile, QStringLiteral("drive"));
+
+    // And back when it is left alone again
+    QTRY_COMPARE(robot->connectionParameters().latency(), idle.latency());
+    QTRY_COMPARE(handler.linkStats().linkProfile, QStringLiteral("idle"));
+    QCOMPARE(robot->stats().connectionUpdates, 3u);
+}
+
+void HandlerTest::mousrInitAndDrive()
+{
+    SimulatedRobot *robot = new SimulatedRobot(SimulatedRobot::Mousr);
+    mousr::MousrHandler handler(robot, robot->name(), nullptr);
+    QSignalSpy initSpy(&handler, &mousr::MousrHandler::initComplete);
+
+    QTRY_COMPARE(initSpy.count(), 1);
+    QVERIFY(handler.isConnected());
+
+    // 4 V, it reports percent
+    QTRY_COMPARE(handler.voltage(), 95);
+
+    handler.setAngle(90.f);
+    handler.setSpeed(0.5f);
+    handler.setControlsPressed(true);
+    QTRY_COMPARE(handler.zRotation(), 90.f);
+}
+
+QTEST_GUILESS_MAIN(HandlerTest)
+
+#include "HandlerTest.moc"
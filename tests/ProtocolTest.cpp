@@ -0,0 +1,737 @@
+#include "ConnectSequence.h"
+#include "LatencyHistogram.h"
+#include "SeqLock.h"
+#include "TransmitQueue.h"
+#include "sphero/RequestTracker.h"
+#include "sphero/v1/FrameReassembler.h"
+#include "sphero/v2/FrameDecoder.h"
+
+#include <QtTest>
+#include <QElapsedTimer>
+#include <QRegularExpression>
+#include <QThread>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+using sphero::RequestTracker;
+namespace v1 = sphero::v1;
+namespace v2 = sphero::v2;
+
+/// The protocol building blocks on their own, without a robot or an event loop
+class ProtocolTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void frameReassemblerSplit_data();
+    void frameReassemblerSplit();
+    void frameReassemblerResync();
+
+    void frameDecoderSplit();
+    void frameDecoderErrors();
+
+    void requestPipelining();
+    void requestRetry();
+    void requestRetryPolicy();
+    void requestCancelAll();
+
+    void transmitPriorities();
+    void transmitMotionCoalesced();
+    void transmitWithoutResponse();
+    void transmitDrained();
+    void transmitFailedWrite();
+    void transmitFlush();
+
+    void histogramBuckets();
+    void histogramPercentile();
+
+    void connectSequenceOrder();
+    void connectSequenceErrors();
+
+    void seqLockStress();
+};
+
+namespace {
+
+struct V1Frame {
+    uint8_t type;
+    uint8_t packetType;
+    uint8_t sequenceNumber;
+    QByteArray contents;
+};
+
+QByteArray v1Frame(const uint8_t type, const uint8_t packetType, const uint8_t sequenceNumber, const QByteArray &contents)
+{
+    const int dataLength = contents.size() + 1;
+
+    QByteArray frame;
+    frame.append(char(0xFF));
+    frame.append(char(type));
+    frame.append(char(packetType));
+    if (type == sphero::ResponsePacketHeader::Notification) {
+        frame.append(char(dataLength >> 8));
+    } else {
+        frame.append(char(sequenceNumber));
+    }
+    frame.append(char(dataLength & 0xFF));
+    frame.append(contents);
+
+    uint8_t checksum = 0;
+    for (int i=2; i<frame.size(); i++) {
+        checksum += uint8_t(frame[i]);
+    }
+    frame.append(char(checksum ^ 0xFF));
+    return frame;
+}
+
+// Feeds it in chunks of chunkSize and copies out what it finds, the frames point into its buffer
+std::vector<V1Frame> reassemble(v1::FrameReassembler *reassembler, const QByteArray &data, const int chunkSize)
+{
+    std::vector<V1Frame> frames;
+    for (int offset = 0; offset < data.size(); offset += chunkSize) {
+        reassembler->feed(data.constData() + offset, qMin(chunkSize, data.size() - offset), [&](const v1::FrameReassembler::Frame &frame) {
+            frames.push_back({frame.type, frame.packetType, frame.sequenceNumber, QByteArray(frame.contents, frame.size)});
+        });
+    }
+    return frames;
+}
+
+QByteArray v2Frame(const QByteArray &raw)
+{
+    QByteArray frame(2 * (raw.size() + 1) + 2, Qt::Uninitialized);
+    frame.resize(v2::encode(raw.constData(), raw.size(), frame.data()));
+    return frame;
+}
+
+std::vector<QByteArray> decode(v2::FrameDecoder *decoder, const QByteArray &data)
+{
+    std::vector<QByteArray> frames;
+    decoder->feed(data.constData(), data.size(), [&](const v2::FrameDecoder::Frame &frame) {
+        frames.push_back(QByteArray(reinterpret_cast<const char*>(frame.data), frame.size));
+    });
+    return frames;
+}
+
+struct Written {
+    QByteArray frame;
+    int priority;
+    uint8_t sequenceNumber;
+};
+
+// Just the sequence number, so resent frames can be recognized
+QByteArray encodeSequenceNumber(const uint8_t sequenceNumber)
+{
+    return QByteArray(1, char(sequenceNumber));
+}
+
+} // namespace
+
+void ProtocolTest::frameReassemblerSplit_data()
+{
+    QTest::addColumn<int>("chunkSize");
+    QTest::newRow("single bytes") << 1;
+    QTest::newRow("2") << 2;
+    QTest::newRow("3") << 3;
+    QTest::newRow("7") << 7;
+    QTest::newRow("ble") << 20;
+    QTest::newRow("all at once") << 1000;
+}
+
+void ProtocolTest::frameReassemblerSplit()
+{
+    QFETCH(int, chunkSize);
+
+    // Notifications bigger than 255 bytes have a two byte length
+    const QByteArray sensors(300, 's');
+
+    QByteArray data;
+    data += v1Frame(sphero::ResponsePacketHeader::Response, sphero::ResponsePacketHeader::Ack, 5, "abc");
+    data += v1Frame(sphero::ResponsePacketHeader::Notification, sphero::ResponsePacketHeader::SensorStream, 0, sensors);
+    data += "u>"; // split across notifications with the smaller chunks
+    data += v1Frame(sphero::ResponsePacketHeader::Response, sphero::ResponsePacketHeader::Ack, 6, {});
+
+    v1::FrameReassembler reassembler;
+    const std::vector<V1Frame> frames = reassemble(&reassembler, data, chunkSize);
+
+    QCOMPARE(frames.size(), size_t(3));
+    QCOMPARE(frames[0].type, uint8_t(sphero::ResponsePacketHeader::Response));
+    QCOMPARE(frames[0].sequenceNumber, uint8_t(5));
+    QCOMPARE(frames[0].contents, QByteArray("abc"));
+    QCOMPARE(frames[1].type, uint8_t(sphero::ResponsePacketHeader::Notification));
+    QCOMPARE(frames[1].packetType, uint8_t(sphero::ResponsePacketHeader::SensorStream));
+    QCOMPARE(frames[1].contents, sensors);
+    QCOMPARE(frames[2].sequenceNumber, uint8_t(6));
+    QVERIFY(frames[2].contents.isEmpty());
+
+    const v1::FrameReassembler::Stats &stats = reassembler.stats();
+    QCOMPARE(stats.frames, 3u);
+    QCOMPARE(stats.prompts, 1u);
+    QCOMPARE(stats.resyncs, 0u);
+    QCOMPARE(stats.droppedBytes, 0u);
+    QCOMPARE(stats.checksumErrors, 0u);
+}
+
+void ProtocolTest::frameReassemblerResync()
+{
+    const QByteArray garbage("\x01\x02\x03", 3);
+
+    QByteArray corrupted = v1Frame(sphero::ResponsePacketHeader::Response, sphero::ResponsePacketHeader::Ack, 7, "xyz");
+    corrupted[corrupted.size() - 1] = char(corrupted[corrupted.size() - 1] ^ 0x01);
+
+    QByteArray data;
+    data += garbage;
+    data += v1Frame(sphero::ResponsePacketHeader::Response, sphero::ResponsePacketHeader::Ack, 1, "one");
+    data += corrupted;
+    data += "u>"; // right after the garbage, still a prompt
+    data += v1Frame(sphero::ResponsePacketHeader::Response, sphero::ResponsePacketHeader::Ack, 2, "two");
+
+    v1::FrameReassembler reassembler;
+    const std::vector<V1Frame> frames = reassemble(&reassembler, data, data.size());
+
+    QCOMPARE(frames.size(), size_t(2));
+    QCOMPARE(frames[0].contents, QByteArray("one"));
+    QCOMPARE(frames[1].contents, QByteArray("two"));
+
+    const v1::FrameReassembler::Stats &stats = reassembler.stats();
+    QCOMPARE(stats.checksumErrors, 1u);
+    QCOMPARE(stats.resyncs, 2u); // once per run of garbage
+    QCOMPARE(stats.droppedBytes, uint32_t(garbage.size() + corrupted.size()));
+    QCOMPARE(stats.prompts, 1u);
+}
+
+void ProtocolTest::frameDecoderSplit()
+{
+    // Everything that has to be escaped
+    const QByteArray first("\x0A\x13\x0D\x01\x8D\xAB\xD8", 7);
+    QByteArray second;
+    for (int i=0; i<40; i++) {
+        second.append(char(i * 7));
+    }
+
+    const QByteArray garbage("\x00\x01", 2);
+    const QByteArray data = garbage + v2Frame(first) + v2Frame(second);
+
+    // At every possible point
+    for (int split = 0; split <= data.size(); split++) {
+        v2::FrameDecoder decoder;
+        std::vector<QByteArray> frames = decode(&decoder, data.left(split));
+        for (const QByteArray &frame : decode(&decoder, data.mid(split))) {
+            frames.push_back(frame);
+        }
+
+        QCOMPARE(frames.size(), size_t(2));
+        QCOMPARE(frames[0], first);
+        QCOMPARE(frames[1], second);
+        QCOMPARE(decoder.stats().frames, 2u);
+        QCOMPARE(decoder.stats().discardedBytes, uint32_t(garbage.size()));
+        QCOMPARE(decoder.stats().checksumErrors, 0u);
+    }
+}
+
+void ProtocolTest::frameDecoderErrors()
+{
+    const QByteArray valid("\x0A\x13\x0D\x01", 4);
+
+    QByteArray badChecksum = v2Frame(valid);
+    badChecksum[badChecksum.size() - 2] = char(badChecksum[badChecksum.size() - 2] ^ 0x01);
+
+    QByteArray data;
+    data += badChecksum;
+    data += QByteArray("\x8D\x0A\xAB\x11\xD8", 5); // invalid escape
+    data += QByteArray("\x8D\x0A\x13", 3); // lost the end
+    data += v2Frame(valid);
+    data += v2Frame(QByteArray(300, '\x01')); // too big
+    data += v2Frame(valid);
+
+    v2::FrameDecoder decoder;
+    const std::vector<QByteArray> frames = decode(&decoder, data);
+
+    QCOMPARE(frames.size(), size_t(2));
+    QCOMPARE(frames[0], valid);
+    QCOMPARE(frames[1], valid);
+
+    const v2::FrameDecoder::Stats &stats = decoder.stats();
+    QCOMPARE(stats.frames, 2u);
+    QCOMPARE(stats.checksumErrors, 1u);
+    QCOMPARE(stats.escapeErrors, 1u);
+    QCOMPARE(stats.overflows, 1u);
+}
+
+void ProtocolTest::requestPipelining()
+{
+    std::vector<Written> written;
+    RequestTracker tracker;
+    tracker.setPipelineDepth(2);
+    tracker.setWriter([&](const QByteArray &frame, const int priority, const uint8_t sequenceNumber) {
+        written.push_back({frame, priority, sequenceNumber});
+    });
+
+    std::vector<RequestTracker::Response> responses;
+    const RequestTracker::Callback callback = [&](const RequestTracker::Response &response) {
+        responses.push_back(response);
+        responses.back().contents = QByteArray(response.contents.constData(), response.contents.size());
+    };
+
+    QVERIFY(tracker.submit(1, 0x10, encodeSequenceNumber, callback, 3));
+    QVERIFY(tracker.submit(1, 0x11, encodeSequenceNumber, callback));
+    QVERIFY(tracker.submit(1, 0x12, encodeSequenceNumber, callback));
+
+    // Only two in flight, and 0 is for asynchronous commands
+    QCOMPARE(written.size(), size_t(2));
+    QCOMPARE(tracker.stats().inFlight, 2);
+    QCOMPARE(tracker.stats().queued, 1);
+    QVERIFY(written[0].sequenceNumber != 0);
+    QVERIFY(written[0].sequenceNumber != written[1].sequenceNumber);
+    QCOMPARE(written[0].frame, encodeSequenceNumber(written[0].sequenceNumber));
+    QCOMPARE(written[0].priority, 3);
+
+    // Out of order is fine
+    uint8_t deviceId = 0, commandId = 0;
+    QVERIFY(tracker.complete(written[1].sequenceNumber, false, 0x05, {}, &deviceId, &commandId));
+    QCOMPARE(commandId, uint8_t(0x11));
+    QCOMPARE(responses.size(), size_t(1));
+    QCOMPARE(responses[0].status, RequestTracker::Status::Failed);
+    QCOMPARE(responses[0].code, uint8_t(0x05));
+
+    // Made room for the queued one
+    QCOMPARE(written.size(), size_t(3));
+    QCOMPARE(tracker.stats().queued, 0);
+
+    QVERIFY(tracker.complete(written[0].sequenceNumber, true, 0, QByteArray("pong"), &deviceId, &commandId));
+    QCOMPARE(deviceId, uint8_t(1));
+    QCOMPARE(commandId, uint8_t(0x10));
+    QCOMPARE(responses[1].status, RequestTracker::Status::Success);
+    QCOMPARE(responses[1].contents, QByteArray("pong"));
+
+    // Already answered
+    QVERIFY(!tracker.complete(written[0].sequenceNumber, true, 0, {}, &deviceId, &commandId));
+    QCOMPARE(tracker.stats().unexpected, 1u);
+
+    QCOMPARE(tracker.stats().sent, 3u);
+    QCOMPARE(tracker.stats().completed, 2u);
+    QCOMPARE(tracker.stats().failed, 1u);
+    QCOMPARE(tracker.stats().inFlight, 1);
+}
+
+void ProtocolTest::requestRetry()
+{
+    std::vector<Written> written;
+    RequestTracker tracker;
+    tracker.setTimeout(10);
+    tracker.setMaxRetries(1);
+    tracker.setWriter([&](const QByteArray &frame, const int priority, const uint8_t sequenceNumber) {
+        written.push_back({frame, priority, sequenceNumber});
+    });
+
+    std::vector<RequestTracker::Response> responses;
+    tracker.submit(2, 0x20, encodeSequenceNumber, [&](const RequestTracker::Response &response) {
+        responses.push_back(response);
+    });
+    QCOMPARE(written.size(), size_t(1));
+    const uint8_t sequenceNumber = written[0].sequenceNumber;
+
+    // The deadline only starts when it is written
+    QCOMPARE(tracker.nextDeadline(), int64_t(-1));
+    tracker.onWritten(sequenceNumber);
+    const int64_t deadline = tracker.nextDeadline();
+    QVERIFY(deadline > 0);
+
+    tracker.expire(deadline - 1);
+    QCOMPARE(written.size(), size_t(1));
+
+    // Resent with the same sequence number
+    tracker.expire(deadline);
+    QCOMPARE(written.size(), size_t(2));
+    QCOMPARE(written[1].sequenceNumber, sequenceNumber);
+    QCOMPARE(written[1].frame, written[0].frame);
+    QCOMPARE(tracker.stats().retries, 1u);
+    QVERIFY(responses.empty());
+
+    // Out of retries
+    tracker.onWritten(sequenceNumber);
+    tracker.expire(tracker.nextDeadline());
+    QCOMPARE(written.size(), size_t(2));
+    QCOMPARE(responses.size(), size_t(1));
+    QCOMPARE(responses[0].status, RequestTracker::Status::TimedOut);
+    QCOMPARE(responses[0].deviceId, uint8_t(2));
+    QCOMPARE(responses[0].commandId, uint8_t(0x20));
+    QCOMPARE(tracker.stats().timeouts, 1u);
+    QCOMPARE(tracker.stats().inFlight, 0);
+    QCOMPARE(tracker.nextDeadline(), int64_t(-1));
+
+    // A late response is not an error, but not expected either
+    uint8_t deviceId, commandId;
+    QVERIFY(!tracker.complete(sequenceNumber, true, 0, {}, &deviceId, &commandId));
+    QCOMPARE(tracker.stats().unexpected, 1u);
+}
+
+void ProtocolTest::requestRetryPolicy()
+{
+    std::vector<Written> written;
+    RequestTracker tracker;
+    tracker.setTimeout(10);
+    tracker.setMaxRetries(3);
+    tracker.setRetryPolicy([](const uint8_t, const uint8_t commandId) { return commandId != 0x22; });
+    tracker.setWriter([&](const QByteArray &frame, const int priority, const uint8_t sequenceNumber) {
+        written.push_back({frame, priority, sequenceNumber});
+    });
+
+    RequestTracker::Status status = RequestTracker::Status::Success;
+    tracker.submit(2, 0x22, encodeSequenceNumber, [&](const RequestTracker::Response &response) { status = response.status; });
+    tracker.onWritten(written[0].sequenceNumber);
+    tracker.expire(tracker.nextDeadline());
+
+    QCOMPARE(status, RequestTracker::Status::TimedOut);
+    QCOMPARE(written.size(), size_t(1));
+    QCOMPARE(tracker.stats().retries, 0u);
+}
+
+void ProtocolTest::requestCancelAll()
+{
+    RequestTracker tracker;
+    tracker.setPipelineDepth(1);
+    tracker.setWriter([](const QByteArray &, const int, const uint8_t) {});
+
+    std::vector<RequestTracker::Status> statuses;
+    const RequestTracker::Callback callback = [&](const RequestTracker::Response &response) { statuses.push_back(response.status); };
+    tracker.submit(1, 1, encodeSequenceNumber, callback);
+    tracker.submit(1, 2, encodeSequenceNumber, callback);
+    QCOMPARE(tracker.stats().queued, 1);
+
+    tracker.cancelAll();
+    QCOMPARE(statuses.size(), size_t(2));
+    QCOMPARE(statuses[0], RequestTracker::Status::Cancelled);
+    QCOMPARE(statuses[1], RequestTracker::Status::Cancelled);
+    QCOMPARE(tracker.stats().inFlight, 0);
+    QCOMPARE(tracker.stats().queued, 0);
+}
+
+void ProtocolTest::transmitPriorities()
+{
+    QList<QByteArray> written;
+    TransmitQueue queue;
+    queue.setMaxInFlight(1);
+    queue.setWriter([&](const QByteArray &frame, QLowEnergyService::WriteMode) { written.append(frame); });
+
+    queue.enqueue(TransmitQueue::Cosmetic, "led");
+    queue.enqueue(TransmitQueue::Config, "config");
+    queue.enqueue(TransmitQueue::Safety, "brake");
+    QCOMPARE(written, QList<QByteArray>({"led"}));
+    QCOMPARE(queue.stats().inFlight, 1);
+
+    // The brake overtakes the config write
+    queue.onWritten();
+    QCOMPARE(written, QList<QByteArray>({"led", "brake"}));
+    queue.onWritten();
+    QCOMPARE(written, QList<QByteArray>({"led", "brake", "config"}));
+    queue.onWritten();
+
+    QCOMPARE(queue.stats().written, 3u);
+    QCOMPARE(queue.stats().acknowledged, 3u);
+    QCOMPARE(queue.stats().inFlight, 0);
+    QCOMPARE(queue.stats().maxDepth, 2);
+}
+
+void ProtocolTest::transmitMotionCoalesced()
+{
+    QList<QByteArray> written;
+    TransmitQueue queue;
+    queue.setMaxInFlight(1);
+    queue.setWriter([&](const QByteArray &frame, QLowEnergyService::WriteMode) { written.append(frame); });
+
+    queue.enqueue(TransmitQueue::Config, "config");
+    QVERIFY(queue.enqueue(TransmitQueue::Motion, "old"));
+    QVERIFY(queue.enqueue(TransmitQueue::Motion, "new"));
+    QCOMPARE(queue.stats().dropped[TransmitQueue::Motion], 1u);
+
+    queue.onWritten();
+    QCOMPARE(written, QList<QByteArray>({"config", "new"}));
+}
+
+void ProtocolTest::transmitWithoutResponse()
+{
+    QList<QByteArray> written;
+    TransmitQueue queue;
+    queue.setMaxInFlight(1);
+    queue.setWriter([&](const QByteArray &frame, QLowEnergyService::WriteMode mode) {
+        QCOMPARE(mode, QLowEnergyService::WriteWithoutResponse);
+        written.append(frame);
+    });
+
+    // Never acknowledged, so they don't take up room
+    int writeCallbacks = 0;
+    for (int i=0; i<3; i++) {
+        queue.enqueue(TransmitQueue::Motion, QByteArray::number(i), QLowEnergyService::WriteWithoutResponse, [&]() { writeCallbacks++; });
+    }
+    QCOMPARE(written.size(), 3);
+    QCOMPARE(writeCallbacks, 3);
+    QCOMPARE(queue.stats().inFlight, 0);
+
+    bool drained = false;
+    queue.whenDrained([&]() { drained = true; });
+    QVERIFY(drained);
+
+    // And an unrelated failure doesn't touch anything
+    queue.onWriteFailed();
+    QCOMPARE(queue.stats().failed, 0u);
+}
+
+void ProtocolTest::transmitDrained()
+{
+    TransmitQueue queue;
+    queue.setWriter([](const QByteArray &, QLowEnergyService::WriteMode) {});
+
+    for (int i=0; i<3; i++) {
+        queue.enqueue(TransmitQueue::Config, QByteArray::number(i));
+    }
+
+    int drained = 0;
+    queue.whenDrained([&]() { drained++; });
+    queue.onWritten();
+    queue.onWritten();
+    QCOMPARE(drained, 0);
+    queue.onWritten();
+    QCOMPARE(drained, 1);
+
+    // Only once
+    queue.enqueue(TransmitQueue::Config, "more");
+    queue.onWritten();
+    QCOMPARE(drained, 1);
+}
+
+void ProtocolTest::transmitFailedWrite()
+{
+    // Transports report failures asynchronously, but the queue shouldn't
+    // recurse or write anything twice if one does it from inside write()
+    QList<QByteArray> written;
+    TransmitQueue queue;
+    queue.setMaxInFlight(1);
+    queue.setWriter([&](const QByteArray &frame, QLowEnergyService::WriteMode) {
+        written.append(frame);
+        if (frame.startsWith("bad")) {
+            queue.onWriteFailed();
+        }
+    });
+
+    queue.enqueue(TransmitQueue::Config, "first");
+    queue.enqueue(TransmitQueue::Config, "bad1");
+    queue.enqueue(TransmitQueue::Config, "bad2");
+    queue.enqueue(TransmitQueue::Config, "ok");
+    QCOMPARE(written, QList<QByteArray>({"first"}));
+
+    queue.onWritten();
+    QCOMPARE(written, QList<QByteArray>({"first", "bad1", "bad2", "ok"}));
+    QCOMPARE(queue.stats().failed, 2u);
+    QCOMPARE(queue.stats().acknowledged, 1u);
+    QCOMPARE(queue.stats().inFlight, 1);
+}
+
+void ProtocolTest::transmitFlush()
+{
+    QList<QByteArray> written;
+    TransmitQueue queue;
+    queue.setMaxInFlight(1);
+    queue.setWriter([&](const QByteArray &frame, QLowEnergyService::WriteMode) { written.append(frame); });
+
+    queue.enqueue(TransmitQueue::Config, "a");
+    queue.enqueue(TransmitQueue::Config, "b");
+    queue.enqueue(TransmitQueue::Safety, "stop");
+    QCOMPARE(written.size(), 1);
+
+    queue.flush();
+    QCOMPARE(written, QList<QByteArray>({"a", "stop", "b"}));
+
+    // Back to one at a time afterwards
+    queue.enqueue(TransmitQueue::Config, "c");
+    QCOMPARE(written.size(), 3);
+}
+
+void ProtocolTest::histogramBuckets()
+{
+    // Every value is in the bucket that covers it, and the buckets are in order
+    int previous = 0;
+    for (uint64_t value = 0; value < 2000000; value++) {
+        const int bucket = LatencyHistogram::bucketFor(value);
+        QVERIFY(bucket >= previous);
+        if (LatencyHistogram::lowerBound(bucket) > value || LatencyHistogram::lowerBound(bucket + 1) <= value) {
+            QFAIL(qPrintable(QStringLiteral("%1 µs in bucket %2 which is %3 to %4").arg(value).arg(bucket)
+                    .arg(LatencyHistogram::lowerBound(bucket)).arg(LatencyHistogram::lowerBound(bucket + 1))));
+        }
+        previous = bucket;
+    }
+
+    // Eight per power of two
+    QCOMPARE(LatencyHistogram::bucketFor(1000) - LatencyHistogram::bucketFor(500), LatencyHistogram::SubBuckets);
+
+    // Everything too long ends up in the last one
+    QCOMPARE(LatencyHistogram::bucketFor(uint64_t(1) << LatencyHistogram::MaxOctave), LatencyHistogram::BucketCount - LatencyHistogram::SubBuckets);
+    QCOMPARE(LatencyHistogram::bucketFor(~uint64_t(0)), LatencyHistogram::BucketCount - 1);
+}
+
+void ProtocolTest::histogramPercentile()
+{
+    LatencyHistogram histogram;
+    QCOMPARE(histogram.percentile(0.5), int64_t(0));
+
+    // 1 to 100 ms
+    for (int i=1; i<=100; i++) {
+        histogram.record(int64_t(i) * 1000000);
+    }
+    QCOMPARE(histogram.count(), uint64_t(100));
+    QCOMPARE(histogram.max(), int64_t(100000000));
+
+    // The upper bound of the bucket, so at most 12.5% above
+    const int64_t p50 = histogram.percentile(0.5);
+    QVERIFY(p50 >= 50000000);
+    QVERIFY(p50 <= 50000000 + 50000000 / 8);
+
+    const int64_t p90 = histogram.percentile(0.9);
+    QVERIFY(p90 >= 90000000);
+    QVERIFY(p90 <= 100000000);
+    QVERIFY(p90 >= p50);
+
+    // Never more than the max
+    QCOMPARE(histogram.percentile(1.), histogram.max());
+    QCOMPARE(histogram.percentile(0.999), histogram.max());
+
+    // The smallest bucket still gets an upper bound
+    LatencyHistogram small;
+    small.record(2500);
+    small.record(-1);
+    QCOMPARE(small.count(), uint64_t(2));
+    QCOMPARE(small.percentile(0.5), int64_t(1000));
+    QCOMPARE(small.percentile(1.), int64_t(2500));
+
+    histogram.clear();
+    QCOMPARE(histogram.count(), uint64_t(0));
+    QCOMPARE(histogram.percentile(0.5), int64_t(0));
+}
+
+void ProtocolTest::connectSequenceOrder()
+{
+    QStringList started;
+    ConnectSequence sequence;
+
+    // Nothing to wait for, so it finishes right away
+    sequence.addStep("controller", {}, [&]() { started.append("controller"); sequence.finish("controller"); });
+    sequence.addStep("main", {"controller"}, [&]() { started.append("main"); });
+    sequence.addStep("radio", {"controller"}, [&]() { started.append("radio"); });
+    sequence.addStep("ready", {"main", "radio"}, [&]() { started.append("ready"); });
+
+    QElapsedTimer clock;
+    clock.start();
+    sequence.start(clock);
+
+    // In parallel
+    QCOMPARE(started, QStringList({"controller", "main", "radio"}));
+    QVERIFY(sequence.isFinished("controller"));
+    QVERIFY(!sequence.isFinished("main"));
+
+    sequence.finish("radio");
+    QCOMPARE(started.size(), 3);
+    sequence.finish("main");
+    QCOMPARE(started, QStringList({"controller", "main", "radio", "ready"}));
+    QVERIFY(!sequence.isDone());
+
+    sequence.finish("ready");
+    QVERIFY(sequence.isDone());
+    QVERIFY(!sequence.trace().contains("not started"));
+    QVERIFY(!sequence.trace().contains("still running"));
+}
+
+void ProtocolTest::connectSequenceErrors()
+{
+    QStringList started;
+    ConnectSequence sequence;
+
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression("depends on unknown step"));
+    sequence.addStep("orphan", {"missing"}, [&]() { started.append("orphan"); });
+
+    sequence.addStep("first", {}, [&]() { started.append("first"); });
+    sequence.addStep("second", {"first"}, [&]() { started.append("second"); });
+
+    QElapsedTimer clock;
+    clock.start();
+    sequence.start(clock);
+    QCOMPARE(started, QStringList({"first"}));
+
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression("finished without running"));
+    sequence.finish("second");
+
+    // E. g. a step failed
+    sequence.stop();
+    sequence.finish("first");
+    QCOMPARE(started, QStringList({"first"}));
+    QVERIFY(!sequence.isDone());
+    QVERIFY(sequence.trace().contains("not started"));
+}
+
+void ProtocolTest::seqLockStress()
+{
+    // Bigger than a word, so a torn read would show up as fields that don't match
+    struct Value {
+        uint64_t count;
+        uint64_t tripled;
+        uint64_t inverted;
+        uint32_t low;
+        uint16_t flags;
+    };
+
+    static constexpr uint64_t Writes = 1000000;
+    static constexpr int Readers = 3;
+
+    SeqLock<Value> lock;
+    lock.store({0, 0, ~uint64_t(0), 0, 0});
+
+    std::atomic<bool> done{false};
+    std::atomic<int> running{0};
+    std::atomic<uint64_t> reads{0};
+    std::atomic<uint64_t> torn{0};
+    std::atomic<uint64_t> backwards{0};
+
+    std::vector<std::unique_ptr<QThread>> readers;
+    for (int i=0; i<Readers; i++) {
+        readers.emplace_back(QThread::create([&]() {
+            running++;
+            uint64_t last = 0;
+            while (!done.load(std::memory_order_acquire)) {
+                const Value value = lock.load();
+                if (value.tripled != value.count * 3 || value.inverted != ~value.count ||
+                        value.low != uint32_t(value.count) || value.flags != uint16_t(value.count >> 3)) {
+                    torn++;
+                }
+                if (value.count < last) {
+                    backwards++;
+                }
+                last = value.count;
+                reads++;
+            }
+        }));
+        readers.back()->start();
+    }
+
+    // Threads take a while to start, the writer would be done before that
+    while (running.load() < Readers) {
+        QThread::yieldCurrentThread();
+    }
+    for (uint64_t i=1; i<=Writes; i++) {
+        lock.store({i, i * 3, ~i, uint32_t(i), uint16_t(i >> 3)});
+    }
+    done = true;
+
+    for (const std::unique_ptr<QThread> &reader : readers) {
+        QVERIFY(reader->wait(10000));
+    }
+
+    QCOMPARE(torn.load(), uint64_t(0));
+    QCOMPARE(backwards.load(), uint64_t(0));
+    QVERIFY(reads.load() > 0);
+    QCOMPARE(lock.version(), Writes + 1);
+    QCOMPARE(lock.load().count, Writes);
+}
+
+QTEST_GUILESS_MAIN(ProtocolTest)
+
+#include "ProtocolTest.moc"